@@ -2,10 +2,9 @@
 #include <math.h>
 #include <string.h>
 
-static mavlink_global_position_int_t current_position;
-static mavlink_battery_status_t      current_battery_status;
-static int                           started         = 0;
-static bool                          update_required = false;
+static struct lwm_telemetry_t telemetry;
+static int                    started         = 0;
+static bool                   update_required = false;
 
 double
 get_distance_meters(int32_t lat1, int32_t lon1, int32_t lat2, int32_t lon2)
@@ -26,16 +25,15 @@ callback_on_current_position(
     ASSERT(param != NULL);
 
     mavlink_message_t* msg = param->detail.msg.msg;
-    if (msg->msgid != MAVLINK_MSG_ID_GLOBAL_POSITION_INT)
+    /* only the source read_telemetry looks up in the store */
+    if (msg->msgid != MAVLINK_MSG_ID_GLOBAL_POSITION_INT
+        || msg->sysid != action->vehicle->sysid
+        || msg->compid != action->vehicle->compid)
     {
         return LWM_ACTION_CONTINUE;
     }
 
-    mavlink_global_position_int_t global_pos;
-    mavlink_msg_global_position_int_decode(msg, &global_pos);
-
-    memcpy(
-        &current_position, &global_pos, sizeof(mavlink_global_position_int_t));
+    /* the message itself is kept in the telemetry store */
     started         = started | 1;
     update_required = true;
     return LWM_ACTION_CONTINUE;
@@ -49,17 +47,14 @@ callback_on_battery_status(
     ASSERT(param != NULL);
 
     mavlink_message_t* msg = param->detail.msg.msg;
-    if (msg->msgid != MAVLINK_MSG_ID_BATTERY_STATUS)
+    /* only the source read_telemetry looks up in the store */
+    if (msg->msgid != MAVLINK_MSG_ID_BATTERY_STATUS
+        || msg->sysid != action->vehicle->sysid
+        || msg->compid != action->vehicle->compid)
     {
         return LWM_ACTION_CONTINUE;
     }
 
-    mavlink_battery_status_t battery_status;
-    mavlink_msg_battery_status_decode(msg, &battery_status);
-
-    memcpy(&current_battery_status, &battery_status,
-        sizeof(mavlink_battery_status_t));
-
     started         = started | 2;
     update_required = true;
     return LWM_ACTION_CONTINUE;
@@ -68,11 +63,41 @@ callback_on_battery_status(
 static struct lwm_command_t cmd_get_curr_pos;
 static struct lwm_command_t cmd_get_battery_status;
 
+static enum lwm_error_t
+read_telemetry(struct lwm_vehicle_t* vehicle,
+    mavlink_global_position_int_t* position,
+    mavlink_battery_status_t*      battery_status)
+{
+    mavlink_message_t msg;
+    enum lwm_error_t  err = lwm_telemetry_read(vehicle->telemetry,
+        MAVLINK_MSG_ID_GLOBAL_POSITION_INT, vehicle->sysid, vehicle->compid,
+        &msg, NULL);
+    if (err != LWM_OK)
+    {
+        return err;
+    }
+    mavlink_msg_global_position_int_decode(&msg, position);
+
+    err = lwm_telemetry_read(vehicle->telemetry, MAVLINK_MSG_ID_BATTERY_STATUS,
+        vehicle->sysid, vehicle->compid, &msg, NULL);
+    if (err != LWM_OK)
+    {
+        return err;
+    }
+    mavlink_msg_battery_status_decode(&msg, battery_status);
+    return LWM_OK;
+}
+
 void
 battery_fence(struct lwm_vehicle_t* vehicle)
 {
     enum lwm_error_t   err = LWM_OK;
 
+    if (vehicle->telemetry == NULL)
+    {
+        lwm_vehicle_set_telemetry(vehicle, &telemetry);
+    }
+
     mavlink_message_t* msg;
     while((msg = lwm_command_get_home_position(vehicle)) == NULL)
     {
@@ -91,8 +116,26 @@ battery_fence(struct lwm_vehicle_t* vehicle)
     lwm_command_request_message_periodic(vehicle, &cmd_get_battery_status,
         MAVLINK_MSG_ID_BATTERY_STATUS, 250000, callback_on_battery_status);
 
-    while (err == LWM_OK && started != 3)
+    mavlink_global_position_int_t current_position       = { 0 };
+    mavlink_battery_status_t      current_battery_status = { 0 };
+    while (err == LWM_OK)
+    {
+        if (started == 3)
+        {
+            err = read_telemetry(
+                vehicle, &current_position, &current_battery_status);
+            if (err != LWM_ERR_NO_DATA)
+            {
+                break;
+            }
+        }
         err = lwm_vehicle_spin_once(vehicle);
+    }
+    if (err != LWM_OK)
+    {
+        WARN("battery fence: no telemetry (%d)\n", err);
+        return;
+    }
 
     mavlink_global_position_int_t prev_position;
     double                        distance_traveled = 0;
@@ -117,6 +160,18 @@ battery_fence(struct lwm_vehicle_t* vehicle)
         if (update_required)
         {
             update_required = false;
+            err             = read_telemetry(
+                vehicle, &current_position, &current_battery_status);
+            if (err == LWM_ERR_NO_DATA)
+            {
+                /* not in the store yet, skip this update */
+                err = lwm_vehicle_spin_once(vehicle);
+                continue;
+            }
+            if (err != LWM_OK)
+            {
+                break;
+            }
 
             /* message show frequency 1 Hz */
             if (ts < time_us())
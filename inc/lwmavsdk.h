@@ -37,6 +37,7 @@ enum lwm_conn_type_t
     LWM_CONN_TYPE_CERTIKOS_SERIAL,
     LWM_CONN_TYPE_CERTIKOS_THINROS,
     LWM_CONN_TYPE_PARTEE,
+    LWM_CONN_TYPE_UDP_PEER, /* one client of a lwm_udp_server_t */
 
     MAX_LWM_CONN_TYPE
 };
@@ -91,6 +92,11 @@ struct lwm_conn_params_t
             const char* publish_topic;
             const char* subscribe_topic;
         } partee;
+        struct
+        {
+            int         fd;   /* socket of the shard serving the peer */
+            const void* addr; /* struct sockaddr_in of the peer */
+        } udp_peer;
     } params;
 };
 
@@ -100,10 +106,26 @@ typedef enum lwm_error_t (*lwm_conn_send_t)(
     struct lwm_conn_context_t* ctx, const uint8_t* buf, size_t len);
 typedef ssize_t (*lwm_conn_recv_t)(
     struct lwm_conn_context_t* ctx, uint8_t* buf, size_t len);
+/* like recv, but 0 right away when nothing is there */
+typedef ssize_t (*lwm_conn_try_recv_t)(
+    struct lwm_conn_context_t* ctx, uint8_t* buf, size_t len);
 typedef void (*lwm_conn_close_t)(struct lwm_conn_context_t* ctx);
+/* descriptor to wait on for incoming data, -1 if there is none */
+typedef int (*lwm_conn_fd_t)(struct lwm_conn_context_t* ctx);
+/* let a blocking recv gather `min_bytes`, or wait `max_delay_us` after the
+ * last one; 0 returns on the first byte again */
+typedef enum lwm_error_t (*lwm_conn_coalesce_t)(
+    struct lwm_conn_context_t* ctx, uint32_t max_delay_us, uint32_t min_bytes);
 
 #define LWM_READ_BUFFER_SIZE 512
 
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+/* room for a few frames, sent in one write by backends that allow it */
+#define LWM_WRITE_BUFFER_SIZE (4 * MAVLINK_MAX_PACKET_LEN)
+#else
+#define LWM_WRITE_BUFFER_SIZE MAVLINK_MAX_PACKET_LEN
+#endif
+
 struct lwm_read_buffer_t
 {
     uint8_t buffer[LWM_READ_BUFFER_SIZE];
@@ -111,6 +133,27 @@ struct lwm_read_buffer_t
     size_t  pos;
 };
 
+enum lwm_poll_mode_t
+{
+    LWM_POLL_BLOCK,    /* wait in the backend's recv */
+    LWM_POLL_SPIN,     /* poll for max_spin_us, then block */
+    LWM_POLL_ADAPTIVE, /* poll for a window tuned to the traffic */
+};
+
+#define LWM_POLL_MIN_SPIN_US    5
+#define LWM_POLL_BACKOFF_MAX_US 1000 /* backends that cannot block sleep */
+
+/* how a connection waits for its next read */
+struct lwm_poll_t
+{
+    enum lwm_poll_mode_t mode;
+    uint32_t             max_spin_us;
+    uint32_t             spin_us;     /* current window */
+    uint64_t             gap_ewma_us; /* waited before data, smoothed */
+    uint64_t             hits;        /* reads the window caught */
+    uint64_t             blocks;      /* reads that had to block */
+};
+
 enum lwm_conn_status_t
 {
     LWM_CONN_STATUS_CLOSED,
@@ -119,6 +162,50 @@ enum lwm_conn_status_t
     LWM_CONN_STATUS_UNKNOWN
 };
 
+/***
+ * Signing
+ ***/
+
+#define LWM_SIGNING_KEY_LEN 32
+#define MAX_LWM_SIGNING_STREAM 16
+
+/* timestamps are in units of 10 us since 1st January 2015 GMT */
+#define LWM_SIGNING_EPOCH_US     1420070400000000ull
+#define LWM_SIGNING_REPLAY_LIMIT (60ull * 100000ull) /* 1 minute */
+
+struct lwm_sha256_t
+{
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t  buffer[64];
+};
+
+enum lwm_signing_flag_t
+{
+    LWM_SIGNING_SIGN_OUTGOING  = 1 << 0,
+    LWM_SIGNING_ALLOW_UNSIGNED = 1 << 1,
+};
+
+/* last accepted timestamp of one (link id, sysid, compid) stream */
+struct lwm_signing_stream_t
+{
+    uint8_t  link_id;
+    uint8_t  sysid;
+    uint8_t  compid;
+    uint64_t timestamp;
+};
+
+struct lwm_signing_t
+{
+    uint32_t                    flags;
+    uint8_t                     link_id;
+    uint8_t                     secret_key[LWM_SIGNING_KEY_LEN];
+    uint64_t                    timestamp; /* atomic, sending and receiving */
+    struct lwm_signing_stream_t streams[MAX_LWM_SIGNING_STREAM];
+    uint32_t                    n_streams;
+    uint32_t                    rx_rejected;
+};
+
 struct lwm_conn_context_t
 {
     enum lwm_conn_status_t   status;
@@ -127,39 +214,175 @@ struct lwm_conn_context_t
     lwm_conn_open_t          open;
     lwm_conn_send_t          send;
     lwm_conn_recv_t          recv;
+    lwm_conn_try_recv_t      try_recv; /* NULL if it can only block */
     lwm_conn_close_t         close;
-    uint8_t                  output[MAVLINK_MAX_PACKET_LEN];
+    lwm_conn_fd_t            fd; /* NULL if the backend has no descriptor */
+    lwm_conn_coalesce_t      coalesce; /* NULL if reads cannot be held */
+    uint8_t                  output[LWM_WRITE_BUFFER_SIZE];
+    size_t                   output_len; /* written, not flushed yet */
+    size_t                   output_max; /* bytes per send, 0 for one frame */
     struct lwm_read_buffer_t input;
+    struct lwm_poll_t        poll;
     mavlink_status_t         rx_status;
     mavlink_message_t        rx_message;
+    /* frame being parsed, kept per link rather than per mavlink channel */
+    mavlink_status_t         rx_parse;
+    mavlink_message_t        rx_frame;
+    struct lwm_signing_t*    signing;
 };
 
 /***
  * Microservices
  ***/
 struct lwm_microservice_t;
+struct lwm_microservice_registry_entry_t;
+struct lwm_filter_t;
+struct lwm_change_t;
+
+/* lower values run first within a dispatch */
+enum lwm_priority_t
+{
+    LWM_PRIORITY_CRITICAL = 0,
+    LWM_PRIORITY_HIGH     = 64,
+    LWM_PRIORITY_NORMAL   = 128,
+    LWM_PRIORITY_LOW      = 192,
+};
+
+/* one (service, msgid) pair, linked both on the registry entry and on the
+ * service so either side can drop it in O(1) */
+struct lwm_subscription_t
+{
+    struct lwm_microservice_t*                service;
+    struct lwm_microservice_registry_entry_t* entry;
+    struct lwm_filter_t*                      filter; /* NULL if exact */
+    struct lwm_change_t*                      change; /* NULL unless on-change */
+    uint32_t                                  index;
+    uint32_t                                  generation; /* bumped on free */
+    uint8_t                                   priority;
+    bool                                      is_pending;
+    uint16_t                                  decimation;
+    uint16_t                                  count;
+    uint32_t                                  interval_us;
+    uint32_t                                  skipped;
+    uint64_t                                  next_us;
+    struct lwm_subscription_t*                next;
+    struct lwm_subscription_t*                prev;
+    struct lwm_subscription_t*                sibling;
+    struct lwm_subscription_t*                next_free; /* pool, retired */
+    struct lwm_subscription_t*                hash_next; /* exact ones */
+};
+
+/* payload zero-extended to the full message length, which is the layout
+ * of the generated mavlink_<name>_t structs */
+struct lwm_decoded_t
+{
+    uint64_t payload64[(MAVLINK_MAX_PAYLOAD_LEN + 7) / 8];
+    bool     is_valid;
+};
+
+/* one message handed to a service */
+struct lwm_delivery_t
+{
+    mavlink_message_t*         msg;
+    struct lwm_subscription_t* subscription; /* NULL on a worker */
+    uint32_t                   index; /* position of msgid in the added set */
+    uint32_t                   skipped; /* held back since the last one */
+    uint64_t                   time_us; /* 0 until a rate limit reads it */
+    struct lwm_decoded_t*      decoded; /* shared by the whole dispatch */
+};
+
+#define LWM_DECODED(delivery, type) \
+    ((const type*)lwm_delivery_decode(delivery))
+
+typedef void (*lwm_deliver_t)(void* context, struct lwm_delivery_t* delivery);
+
+/* payload bytes compared by an on-change service for one msgid */
+struct lwm_change_mask_t
+{
+    uint32_t       msgid;
+    const uint8_t* mask; /* ANDed with the payload */
+    uint8_t        len;
+};
 
 struct lwm_microservice_t
 {
     bool  is_active;
     void* context;
     void (*handler)(void* context, mavlink_message_t* msg);
-    struct lwm_microservice_t* next;
-    struct lwm_microservice_t* prev;
+    lwm_deliver_t                   deliver; /* instead of handler if set */
+    uint8_t                         priority; /* of subscriptions added after */
+    uint16_t                        decimation; /* every n-th one, 0 for all */
+    uint32_t                        interval_us; /* min gap between two */
+    bool                            on_change; /* only payloads that differ */
+    const uint8_t*                  change_mask; /* if not in change_masks */
+    uint8_t                         change_mask_len;
+    const struct lwm_change_mask_t* change_masks; /* searched in order */
+    uint8_t                         n_change_masks;
+    bool                            on_worker; /* run by the worker pool */
+    struct lwm_subscription_t*      subscriptions;
+    struct lwm_microservice_t*      next_free;
 };
 
 #define MAX_LWM_SERVICE 128
+#define MAX_LWM_SUBSCRIPTION 256
+
+/* extra capacity chained on demand when pool growth is enabled (posix) */
+#define LWM_SERVICE_SLAB_SIZE      64
+#define LWM_SUBSCRIPTION_SLAB_SIZE 128
+
+struct lwm_service_slab_t
+{
+    struct lwm_service_slab_t* next;
+    struct lwm_microservice_t  services[LWM_SERVICE_SLAB_SIZE];
+};
+
+struct lwm_subscription_slab_t
+{
+    struct lwm_subscription_slab_t* next;
+    struct lwm_subscription_t       subscriptions[LWM_SUBSCRIPTION_SLAB_SIZE];
+};
 
 struct lwm_service_pool_t
 {
-    struct lwm_microservice_t services[MAX_LWM_SERVICE];
-    uint32_t                  n;
+    struct lwm_microservice_t  services[MAX_LWM_SERVICE];
+    struct lwm_microservice_t* free;
+    struct lwm_service_slab_t* slabs;
+    bool                       grow;
+    uint32_t                   n;
+    uint32_t                   capacity;
+    uint32_t                   high_water;
+    uint32_t                   failed;
+};
+
+struct lwm_subscription_pool_t
+{
+    struct lwm_subscription_t       subscriptions[MAX_LWM_SUBSCRIPTION];
+    struct lwm_subscription_t*      free;
+    struct lwm_subscription_slab_t* slabs;
+    bool                            grow;
+    uint32_t                        n;
+    uint32_t                        capacity;
+    uint32_t                        high_water;
+    uint32_t                        failed;
+};
+
+struct lwm_microservice_stats_t
+{
+    uint32_t services;
+    uint32_t services_capacity;
+    uint32_t services_high_water;
+    uint32_t services_failed;
+    uint32_t subscriptions;
+    uint32_t subscriptions_capacity;
+    uint32_t subscriptions_high_water;
+    uint32_t subscriptions_failed;
+    uint32_t deferred_overflow;
 };
 
 struct lwm_service_list_t
 {
-    struct lwm_microservice_t* head;
-    struct lwm_microservice_t* tail;
+    struct lwm_subscription_t* head;
+    struct lwm_subscription_t* tail;
 };
 
 struct lwm_microservice_registry_entry_t
@@ -170,27 +393,639 @@ struct lwm_microservice_registry_entry_t
     struct lwm_service_list_t pending;
 };
 
+/* msgids below the bound are matched on a bitmap, the rest on ranges */
+#define LWM_FILTER_MSGID_BITMAP 512
+#define MAX_LWM_FILTER_RANGE    4
+#define MAX_LWM_FILTER          16
+
+enum lwm_filter_flag_t
+{
+    LWM_FILTER_ANY_MSGID  = 1 << 0,
+    LWM_FILTER_ANY_SYSID  = 1 << 1,
+    LWM_FILTER_ANY_COMPID = 1 << 2,
+};
+
+struct lwm_filter_range_t
+{
+    uint32_t first;
+    uint32_t last;
+};
+
+/* msgid set/range, source sysid/compid, or catch-all match */
+struct lwm_filter_t
+{
+    uint32_t                  flags;
+    uint32_t                  msgids[LWM_FILTER_MSGID_BITMAP / 32];
+    uint32_t                  sysids[256 / 32];
+    uint32_t                  compids[256 / 32];
+    uint32_t                  n_ranges;
+    struct lwm_filter_range_t ranges[MAX_LWM_FILTER_RANGE];
+    struct lwm_filter_t*      next_free;
+};
+
+/* (sysid, compid, msgid) keys remembered per on-change subscription; one
+ * more evicts another in turn, whose next message then counts as changed */
+#define MAX_LWM_CHANGE_SOURCE 16
+#define MAX_LWM_CHANGE        32
+
+/* payload digest of the last delivery, per source and msgid */
+struct lwm_change_source_t
+{
+    bool     is_valid;
+    uint8_t  sysid;
+    uint8_t  compid;
+    uint32_t msgid;
+    uint64_t digest;
+};
+
+struct lwm_change_t
+{
+    struct lwm_change_source_t sources[MAX_LWM_CHANGE_SOURCE];
+    uint32_t                   victim; /* replaced when all are in use */
+    struct lwm_change_t*       next_free;
+};
+
 #define MAX_LWM_SERVICE_REGISTRY 128
 
+/* open addressing table msgid -> entry, kept at most half full */
+#define LWM_SERVICE_REGISTRY_HASH_BITS 8
+#define LWM_SERVICE_REGISTRY_HASH_SIZE (1u << LWM_SERVICE_REGISTRY_HASH_BITS)
+
+/* exact subscriptions chained by (msgid, service), to find a duplicate */
+#define LWM_SUBSCRIPTION_HASH_BITS 8
+#define LWM_SUBSCRIPTION_HASH_SIZE (1u << LWM_SUBSCRIPTION_HASH_BITS)
+
+struct lwm_microservice_registry_slot_t
+{
+    uint32_t msgid;
+    uint32_t index; /* entry index + 1, 0 if the slot is empty */
+};
+
 struct lwm_microservice_registry_t
 {
+    struct lwm_microservice_registry_slot_t
+        slots[LWM_SERVICE_REGISTRY_HASH_SIZE];
     struct lwm_microservice_registry_entry_t entries[MAX_LWM_SERVICE_REGISTRY];
     uint32_t                                 n;
+    struct lwm_subscription_t*
+        members[LWM_SUBSCRIPTION_HASH_SIZE];
+    /* filter subscriptions, run among the exact ones by priority */
+    struct lwm_microservice_registry_entry_t filtered;
+    struct lwm_filter_t                      filters[MAX_LWM_FILTER];
+    struct lwm_filter_t*                     filter_free;
+    struct lwm_change_t                      changes[MAX_LWM_CHANGE];
+    struct lwm_change_t*                     change_free;
+    /* removed while a dispatch runs, freed once it returns */
+    uint32_t                                 dispatching;
+    struct lwm_subscription_t*               retired;
 };
 
+#define MAX_LWM_DEFERRED 16
+
+struct lwm_deferred_t
+{
+    mavlink_message_t          msg;
+    struct lwm_subscription_t* subscription;
+    uint32_t                   generation;
+};
+
+/* low priority deliveries held until the end of the receive batch */
+struct lwm_deferred_queue_t
+{
+    bool                  is_enabled;
+    bool                  is_held; /* flushed by a reactor tick, not a batch */
+    uint8_t               priority; /* deferred at this value and above */
+    uint32_t              n;
+    uint32_t              overflow;
+    struct lwm_deferred_t items[MAX_LWM_DEFERRED];
+};
+
+/***
+ * Telemetry
+ ***/
+#define MAX_LWM_TELEMETRY 64
+
+/* open addressing table (msgid, sysid, compid) -> slot, at most half full */
+#define LWM_TELEMETRY_HASH_BITS 7
+#define LWM_TELEMETRY_HASH_SIZE (1u << LWM_TELEMETRY_HASH_BITS)
+
+/* latest message of one (msgid, sysid, compid), guarded by a seqlock */
+struct lwm_telemetry_slot_t
+{
+    uint32_t          seq; /* odd while the writer is in the slot */
+    uint32_t          count;
+    uint64_t          key; /* written once, before the slot is indexed */
+    uint64_t          time_us;
+    mavlink_message_t msg;
+};
+
+#define LWM_TELEMETRY_MAGIC 0x4c574d54 /* "LWMT" */
+
+/* one writer (the dispatching thread), any number of lock-free readers; no
+ * pointers inside, it can be mapped into other processes */
+struct lwm_telemetry_t
+{
+    uint32_t                    magic;
+    uint32_t                    size; /* sizeof, checked on attach */
+    uint32_t                    index[LWM_TELEMETRY_HASH_SIZE]; /* slot + 1 */
+    uint32_t                    n;
+    uint32_t                    dropped; /* keys that did not fit */
+    struct lwm_telemetry_slot_t slots[MAX_LWM_TELEMETRY];
+};
+
+/***
+ * Vehicle state
+ ***/
+enum lwm_state_field_t
+{
+    LWM_STATE_ARMED    = 1 << 0,
+    LWM_STATE_MODE     = 1 << 1,
+    LWM_STATE_STATUS   = 1 << 2,
+    LWM_STATE_POSITION = 1 << 3,
+    LWM_STATE_ALTITUDE = 1 << 4,
+    LWM_STATE_VELOCITY = 1 << 5,
+    LWM_STATE_HEADING  = 1 << 6,
+    LWM_STATE_ATTITUDE = 1 << 7,
+    LWM_STATE_RATES    = 1 << 8,
+    LWM_STATE_BATTERY  = 1 << 9,
+    LWM_STATE_POWER    = 1 << 10,
+    LWM_STATE_SENSORS  = 1 << 11,
+
+    MAX_LWM_STATE_FIELD = 12
+};
+
+/* what the vehicle last reported about itself, kept by the dispatcher */
+struct lwm_vehicle_state_t
+{
+    /* hot: read on every control step, fits one cache line */
+    int32_t  lat;          /* degE7 */
+    int32_t  lon;          /* degE7 */
+    int32_t  alt;          /* mm, MSL */
+    int32_t  relative_alt; /* mm, above home */
+    int16_t  vx;           /* cm/s */
+    int16_t  vy;
+    int16_t  vz;
+    uint16_t hdg;          /* cdeg, UINT16_MAX if unknown */
+    float    roll;         /* rad */
+    float    pitch;
+    float    yaw;
+    uint32_t custom_mode;
+    uint8_t  base_mode;
+    uint8_t  system_status;
+    bool     armed;
+    int8_t   battery_remaining; /* %, -1 if unknown */
+
+    /* cold */
+    uint32_t changed; /* fields changed since lwm_vehicle_state_changes */
+    uint32_t reported; /* fields carried by the last update */
+    float    rollspeed; /* rad/s */
+    float    pitchspeed;
+    float    yawspeed;
+    uint16_t voltage_battery; /* mV */
+    int16_t  current_battery; /* cA */
+    int32_t  current_consumed; /* mAh */
+    int32_t  energy_consumed;  /* hJ */
+    uint32_t sensors_present;
+    uint32_t sensors_enabled;
+    uint32_t sensors_health;
+    uint16_t load; /* d% */
+    uint64_t updated_us[MAX_LWM_STATE_FIELD]; /* last report, 0 if never */
+};
+
+/***
+ * Waiters
+ ***/
+typedef bool (*lwm_predicate_t)(
+    const struct lwm_vehicle_state_t* state, void* context);
+
+enum lwm_waiter_status_t
+{
+    LWM_WAITER_INIT,
+    LWM_WAITER_PENDING,
+    LWM_WAITER_SATISFIED,
+    LWM_WAITER_TIMEOUT,
+};
+
+struct lwm_waiter_t;
+typedef void (*lwm_waiter_done_t)(struct lwm_waiter_t* waiter);
+
+/* a predicate over the vehicle state, checked only when a message
+ * carrying one of the `depends` fields arrives */
+struct lwm_waiter_t
+{
+    lwm_predicate_t          predicate;
+    void*                    context;
+    uint32_t                 depends; /* lwm_state_field_t mask */
+    enum lwm_waiter_status_t status;
+    uint64_t                 deadline_us; /* 0 for none */
+    lwm_waiter_done_t        done; /* optional, once satisfied or timed out */
+    struct lwm_waiter_t*     next;
+};
+
+/***
+ * Submission
+ ***/
+#define LWM_SUBMIT_QUEUE_BITS 5
+#define LWM_SUBMIT_QUEUE_SIZE (1u << LWM_SUBMIT_QUEUE_BITS)
+
+struct lwm_action_t;
+
+enum lwm_submission_type_t
+{
+    LWM_SUBMIT_MESSAGE,
+    LWM_SUBMIT_ACTION,
+};
+
+struct lwm_submission_t
+{
+    uint32_t                   seq; /* whose turn the cell is, see submit.c */
+    enum lwm_submission_type_t type;
+    struct lwm_action_t*       action;
+    uint64_t                   timeout_us;
+    mavlink_message_t          msg;
+};
+
+/* bounded lock-free queue, any thread posts and the spinning thread drains
+ * it, so only that thread ever touches the connection and the registry */
+struct lwm_submit_queue_t
+{
+    /* claimed by posting threads */
+    uint32_t tail __attribute__((aligned(64)));
+    uint32_t rejected; /* posts on a full queue */
+    /* drained by the spinning thread */
+    uint32_t                head __attribute__((aligned(64)));
+    uint32_t                drained;
+    struct lwm_submission_t cells[LWM_SUBMIT_QUEUE_SIZE];
+};
+
+/***
+ * Workers
+ ***/
+#define MAX_LWM_WORKER        8
+#define LWM_WORKER_QUEUE_BITS 6
+#define LWM_WORKER_QUEUE_SIZE (1u << LWM_WORKER_QUEUE_BITS)
+
+struct lwm_workers_t;
+
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+/* a delivery copied out for a worker, nothing in it points into the
+ * registry */
+struct lwm_worker_job_t
+{
+    mavlink_message_t msg;
+    void*             context;
+    void (*handler)(void* context, mavlink_message_t* msg);
+    lwm_deliver_t     deliver;
+    uint32_t          index;
+    uint32_t          skipped;
+    uint64_t          time_us;
+};
+
+/* one thread and its queue, the dispatching thread is the only producer */
+struct lwm_worker_t
+{
+    struct lwm_worker_job_t jobs[LWM_WORKER_QUEUE_SIZE];
+    /* moved by the worker once the job ran */
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t sleeping;
+    /* moved by the dispatcher */
+    uint32_t              tail __attribute__((aligned(64)));
+    uint32_t              overflow; /* jobs dropped on a full queue */
+    uint32_t              high_water;
+    pthread_t             thread;
+    pthread_mutex_t       lock;
+    pthread_cond_t        wake;
+    struct lwm_workers_t* pool;
+};
+
+/* services are sharded over the workers, so each handler keeps running on
+ * one thread and sees its messages in order */
+struct lwm_workers_t
+{
+    struct lwm_worker_t workers[MAX_LWM_WORKER];
+    uint32_t            n;
+    bool                is_stopping;
+};
+#endif
 
 /***
  * Vehicle
  ***/
+#define MAX_LWM_BATCH 32
+
+#define LWM_LATENCY_BUCKETS 16
+
+/* time from a link being ready to its frames being dispatched, per spin:
+ * from the reactor's wakeup, the I/O thread's read or the call to
+ * lwm_vehicle_process_input; a blocking read only shows its return */
+struct lwm_latency_t
+{
+    uint64_t loops;
+    uint64_t max_us;
+    uint64_t total_us;
+    /* [i] counts loops under 2^i us, the last bucket everything above */
+    uint32_t buckets[LWM_LATENCY_BUCKETS];
+};
+
+/* lets another loop know something was posted to the vehicle */
+typedef void (*lwm_wake_t)(void* context);
+
+/* frames of one read, dispatched in arrival order or grouped by msgid */
+struct lwm_batch_t
+{
+    mavlink_message_t frames[MAX_LWM_BATCH];
+    uint8_t           order[MAX_LWM_BATCH];
+    size_t            n;
+};
+
 struct lwm_vehicle_t
 {
     struct lwm_conn_context_t          conn;
     struct lwm_microservice_registry_t registry;
     struct lwm_service_pool_t          service_pool;
+    struct lwm_subscription_pool_t     subscription_pool;
+    struct lwm_deferred_queue_t        deferred;
+    struct lwm_batch_t                 batch;
+    struct lwm_telemetry_t*            telemetry; /* NULL if not kept */
+    struct lwm_workers_t*              workers; /* NULL to run inline */
+    struct lwm_submit_queue_t          submitted;
+    struct lwm_io_thread_t*            io; /* frames come from its ring */
+    lwm_wake_t                         wake; /* called on posts */
+    void*                              wake_context;
+    struct lwm_vehicle_state_t         state;
+    struct lwm_waiter_t*               waiters;
+    uint32_t                           waiter_depends; /* union of pending */
+    uint64_t                           waiter_deadline_us; /* earliest */
+    struct lwm_action_t*               actions; /* pending with a timeout */
+    uint64_t                           action_deadline_us; /* earliest */
+    struct lwm_latency_t*              latency; /* NULL if not measured */
+    bool                               grouped; /* process_input by msgid */
+    uint64_t                           ready_us; /* the reactor's wakeup */
     uint32_t                           sysid;
     uint32_t                           compid;
 };
 
+/***
+ * I/O thread
+ ***/
+#define LWM_FRAME_RING_BITS 8
+#define LWM_FRAME_RING_SIZE (1u << LWM_FRAME_RING_BITS)
+
+/* how long an empty ring blocks the spinning thread, so deadlines are
+ * still checked */
+#define LWM_IO_WAIT_US 10000
+
+struct lwm_io_stats_t
+{
+    uint32_t occupancy; /* frames waiting to be processed */
+    uint32_t high_water;
+    uint32_t overflow; /* frames dropped on a full ring */
+    uint64_t frames;   /* parsed by the I/O thread */
+};
+
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+/* frames parsed by the I/O thread, processed by the spinning thread */
+struct lwm_frame_ring_t
+{
+    /* moved by the spinning thread */
+    uint32_t head __attribute__((aligned(64)));
+    uint32_t waiting;
+    /* moved by the I/O thread */
+    uint32_t          tail __attribute__((aligned(64)));
+    uint32_t          overflow;
+    uint32_t          high_water;
+    uint64_t          frames;
+    uint64_t          read_us; /* when the newest frames were read */
+    mavlink_message_t slots[LWM_FRAME_RING_SIZE];
+};
+
+/* reads and parses the connection on its own thread, so frames keep being
+ * taken off the socket while the application is busy */
+struct lwm_io_thread_t
+{
+    struct lwm_vehicle_t*   vehicle;
+    struct lwm_frame_ring_t ring;
+    bool                    is_running;
+    enum lwm_error_t        err; /* why it stopped */
+    pthread_t               thread;
+    pthread_mutex_t         lock;
+    pthread_cond_t          wake;
+    mavlink_message_t       spill[MAX_LWM_BATCH]; /* parsed, ring full */
+};
+#endif
+
+/***
+ * Reactor
+ ***/
+#define MAX_LWM_REACTOR_LINK  16
+#define MAX_LWM_REACTOR_TIMER 16
+#define MAX_LWM_REACTOR_EVENT 32 /* handled per wait */
+#define MAX_LWM_REACTOR_DRAIN 64 /* reads of a coalesced link per wakeup */
+
+typedef void (*lwm_reactor_tick_t)(void* context, uint64_t expirations);
+
+/* a timerfd for a task of the application */
+struct lwm_reactor_timer_t
+{
+    int                fd; /* -1 if free */
+    uint64_t           period_us; /* 0 fires once */
+    lwm_reactor_tick_t tick;
+    void*              context;
+};
+
+struct lwm_reactor_link_t
+{
+    struct lwm_vehicle_t* vehicle; /* NULL if free */
+    int                   fd;
+    uint64_t              rearm_us; /* not watched until then, 0 if watched */
+};
+
+/* fewer wakeups for some latency: deadlines, timers and the end of input
+ * coalescing all fall on multiples of the tick */
+struct lwm_reactor_power_t
+{
+    uint32_t tick_us;       /* 0 turns power saving off */
+    uint32_t coalesce_us;   /* a link is left alone this long after a read */
+    bool     hold_deferred; /* deferred handlers run on the tick */
+};
+
+struct lwm_reactor_stats_t
+{
+    uint64_t wakeups;
+    uint64_t reads;         /* of the connections */
+    uint32_t wakeups_per_s; /* since the previous call */
+};
+
+/* one epoll set for the connections of many vehicles and periodic tasks;
+ * the vehicles' deadlines bound the wait, an eventfd wakes it for posted
+ * work */
+struct lwm_reactor_t
+{
+    int                        epoll;
+    int                        wake; /* eventfd */
+    bool                       is_stopping;
+    uint64_t                   wakeups; /* returns from epoll_wait */
+    uint64_t                   reads;
+    uint64_t                   stats_us; /* previous lwm_reactor_stats */
+    uint64_t                   stats_wakeups;
+    struct lwm_reactor_power_t power;
+    uint64_t                   tick_due_us; /* held handlers run then */
+    struct lwm_reactor_link_t  links[MAX_LWM_REACTOR_LINK];
+    struct lwm_reactor_timer_t timers[MAX_LWM_REACTOR_TIMER];
+};
+
+/***
+ * Real-time
+ ***/
+struct lwm_rt_thread_t
+{
+    int cpu;      /* core to pin to, -1 to leave the affinity */
+    int priority; /* SCHED_FIFO priority, 0 to leave the policy */
+};
+
+struct lwm_rt_config_t
+{
+    struct lwm_rt_thread_t dispatch; /* the thread spinning the vehicle */
+    struct lwm_rt_thread_t io;       /* if an I/O thread runs */
+    struct lwm_rt_thread_t workers;  /* cpu is the first of consecutive ones */
+    bool                   lock_memory; /* mlockall, pools stop growing */
+    size_t                 stack_prefault; /* bytes of stack touched */
+};
+
+/***
+ * UDP server
+ ***/
+#define MAX_LWM_UDP_SHARD     16
+#define LWM_UDP_PEER_BITS     8
+#define LWM_UDP_PEER_SIZE     (1u << LWM_UDP_PEER_BITS)
+#define MAX_LWM_UDP_PEER      (LWM_UDP_PEER_SIZE * 3 / 4) /* per shard */
+#define LWM_UDP_BATCH         32   /* datagrams per recvmmsg */
+#define LWM_UDP_DATAGRAM_SIZE 2048 /* longer ones are dropped */
+#define LWM_UDP_RCVBUF_SIZE   (4 << 20) /* asked for, per shard */
+/* how long a shard blocks at most, so deadlines and stop are checked */
+#define LWM_UDP_WAIT_US 10000
+/* a peer silent this long is released, a refused one is asked again */
+#define LWM_UDP_PEER_IDLE_US 5000000 /* default */
+
+/* a vehicle for a new peer, initialized and subscribed, NULL to ignore it;
+ * `addr` and `port` are in network order. `release` gets it back on the
+ * shard's thread once the peer went idle, or on stop */
+typedef struct lwm_vehicle_t* (*lwm_udp_accept_t)(
+    void* context, uint32_t shard, uint32_t addr, uint16_t port);
+typedef void (*lwm_udp_release_t)(
+    void* context, struct lwm_vehicle_t* vehicle);
+
+struct lwm_udp_server_stats_t
+{
+    uint32_t peers;   /* with a vehicle */
+    uint32_t refused; /* remembered until they expire */
+    uint64_t datagrams;
+    uint64_t dropped; /* refused peers, full tables, oversized */
+};
+
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+struct lwm_udp_peer_t
+{
+    uint32_t              addr;
+    uint16_t              port;
+    bool                  is_used;
+    uint64_t              last_us; /* last datagram, or the refusal */
+    struct lwm_vehicle_t* vehicle; /* NULL if refused */
+};
+
+/* one socket of the SO_REUSEPORT group, and the peers the kernel hashes
+ * to it; only its thread touches them */
+struct lwm_udp_shard_t
+{
+    int                      fd;
+    uint32_t                 index;
+    pthread_t                thread;
+    struct lwm_udp_server_t* server;
+    uint32_t                 n_used; /* slots, refused peers too */
+    uint32_t                 n_peers;
+    uint32_t                 n_refused;
+    uint64_t                 datagrams;
+    uint64_t                 dropped;
+    uint64_t                 sweep_us; /* next pass over posts and deadlines */
+    struct lwm_udp_peer_t    peers[LWM_UDP_PEER_SIZE]; /* open addressing */
+    uint8_t buffers[LWM_UDP_BATCH][LWM_UDP_DATAGRAM_SIZE];
+} __attribute__((aligned(64)));
+
+/* many clients on one port, e.g. a swarm of simulated vehicles; each peer
+ * gets its own vehicle and parse state on the shard that receives it */
+struct lwm_udp_server_t
+{
+    uint16_t               port;
+    uint32_t               n;
+    bool                   is_stopping;
+    lwm_udp_accept_t       accept;
+    lwm_udp_release_t      release; /* NULL to keep the vehicles */
+    void*                  context;
+    uint64_t               idle_us; /* read by the shards */
+    struct lwm_udp_shard_t shards[MAX_LWM_UDP_SHARD];
+};
+#endif
+
+/***
+ * Bridge
+ ***/
+#define MAX_LWM_BRIDGE_CLIENT  8
+#define MAX_LWM_BRIDGE_RATE    32
+#define LWM_BRIDGE_PATH_LEN    108 /* sun_path */
+#define LWM_BRIDGE_CONFIG_LEN  32
+#define LWM_BRIDGE_BUFFER_SIZE 4096
+
+enum lwm_bridge_format_t
+{
+    LWM_BRIDGE_JSON,   /* one object per line */
+    LWM_BRIDGE_BINARY, /* lwm_bridge_header_t, then the decoded payload */
+};
+
+/* little endian, followed by `len` payload bytes */
+struct __attribute__((packed)) lwm_bridge_header_t
+{
+    uint32_t msgid;
+    uint8_t  sysid;
+    uint8_t  compid;
+    uint16_t len;
+    uint64_t time_us;
+};
+
+/* earliest time a client takes the next message of one msgid */
+struct lwm_bridge_rate_t
+{
+    uint32_t msgid; /* UINT32_MAX if free */
+    uint64_t next_us;
+};
+
+/* json and unlimited until the client sends a line such as "binary 100000",
+ * for at most one message per msgid every 100 ms */
+struct lwm_bridge_client_t
+{
+    int                      fd; /* -1 if free */
+    enum lwm_bridge_format_t format;
+    uint32_t                 interval_us; /* per msgid, 0 for all */
+    uint32_t                 dropped; /* socket full */
+    uint32_t                 unlimited; /* sent past a full rate table */
+    uint32_t                 config_len;
+    char                     config[LWM_BRIDGE_CONFIG_LEN];
+    struct lwm_bridge_rate_t rates[MAX_LWM_BRIDGE_RATE];
+};
+
+/* streams the messages a filter matches to local clients over a unix
+ * socket, serialized once per message and format */
+struct lwm_bridge_t
+{
+    struct lwm_vehicle_t*      vehicle;
+    struct lwm_microservice_t* service;
+    int                        fd;
+    char                       path[LWM_BRIDGE_PATH_LEN];
+    struct lwm_bridge_client_t clients[MAX_LWM_BRIDGE_CLIENT];
+    char                       json[LWM_BRIDGE_BUFFER_SIZE];
+    uint8_t                    binary[sizeof(struct lwm_bridge_header_t)
+                                      + MAVLINK_MAX_PAYLOAD_LEN];
+};
+
 /***
  * Protocol
  ***/
@@ -215,7 +1050,8 @@ struct lwm_action_param_t
     {
         struct
         {
-            mavlink_message_t* msg;
+            mavlink_message_t*     msg;
+            struct lwm_delivery_t* delivery;
         } msg;
         struct
         {
@@ -249,7 +1085,6 @@ struct lwm_msgid_list_t
 {
     uint32_t n;
     uint32_t msgid[LWM_MSGID_LIST_SIZE];
-    struct lwm_microservice_t * microservice[LWM_MSGID_LIST_SIZE];
 };
 
 enum lwm_action_status_t
@@ -273,8 +1108,10 @@ struct lwm_action_t
     lwm_except_t               except;
     struct lwm_msgid_list_t    then_msgid_list;
     lwm_then_t                 then;
+    struct lwm_microservice_t* service;
     uint64_t                   timeout_time;
     lwm_timeout_t              timeout;
+    struct lwm_action_t*       next; /* in the vehicle's list of deadlines */
 };
 
 struct lwm_command_t
@@ -300,17 +1137,194 @@ extern "C"
         struct lwm_conn_context_t* ctx, enum lwm_conn_type_t type, ...);
     enum lwm_error_t lwm_conn_send(
         struct lwm_conn_context_t* ctx, mavlink_message_t* msg);
+    /**
+     * @brief append a frame to the output buffer, sending what is there
+     * first if it would not fit
+     */
+    enum lwm_error_t lwm_conn_write(
+        struct lwm_conn_context_t* ctx, mavlink_message_t* msg);
+    enum lwm_error_t lwm_conn_flush(struct lwm_conn_context_t* ctx);
     enum lwm_error_t lwm_conn_recv(
         struct lwm_conn_context_t* ctx, mavlink_message_t* msg);
+    /**
+     * @brief parse up to `max` frames from the read buffer, reading only if
+     * it is empty
+     */
+    enum lwm_error_t lwm_conn_recv_batch(struct lwm_conn_context_t* ctx,
+        mavlink_message_t* msgs, size_t max, size_t* n);
+    /**
+     * @brief as lwm_conn_recv_batch, but an empty buffer is filled with
+     * try_recv only, never waiting on the backend
+     * @return LWM_ERR_NOT_SUPPORTED if the backend has no try_recv
+     */
+    enum lwm_error_t lwm_conn_try_recv_batch(struct lwm_conn_context_t* ctx,
+        mavlink_message_t* msgs, size_t max, size_t* n);
+    /**
+     * @brief descriptor that becomes readable when the connection has data
+     * @return -1 if the backend has none (certikos)
+     */
+    int              lwm_conn_fd(struct lwm_conn_context_t* ctx);
     void             lwm_conn_close(struct lwm_conn_context_t* ctx);
+    /**
+     * @brief poll for data before blocking, for at most `max_spin_us`
+     * after each read; sockets also get SO_BUSY_POLL (posix only)
+     */
+    void lwm_conn_set_poll(struct lwm_conn_context_t* ctx,
+        enum lwm_poll_mode_t mode, uint32_t max_spin_us);
+    /**
+     * @brief have each read gather up to `min_bytes`, at most `max_delay_us`
+     * apart (serial VMIN/VTIME), 0 to read as bytes come
+     * @return LWM_ERR_NOT_SUPPORTED if the backend has no such setting
+     */
+    enum lwm_error_t lwm_conn_set_coalesce(struct lwm_conn_context_t* ctx,
+        uint32_t max_delay_us, uint32_t min_bytes);
     enum lwm_error_t lwm_conn_register(
         struct lwm_conn_context_t* ctx, enum lwm_conn_type_t type);
+    void lwm_conn_set_signing(
+        struct lwm_conn_context_t* ctx, struct lwm_signing_t* signing);
+
+    void lwm_sha256_init(struct lwm_sha256_t* ctx);
+    void lwm_sha256_update(
+        struct lwm_sha256_t* ctx, const void* data, size_t len);
+    void        lwm_sha256_final(struct lwm_sha256_t* ctx, uint8_t digest[32]);
+    const char* lwm_sha256_backend(void);
+    /**
+     * @brief pin the portable implementation (`true`) or go back to runtime
+     * detection (`false`), e.g. to compare both in benchmarks
+     */
+    void lwm_sha256_force_generic(bool generic);
+
+    void lwm_signing_init(struct lwm_signing_t* signing, uint8_t link_id,
+        const uint8_t key[LWM_SIGNING_KEY_LEN], uint32_t flags);
+    enum lwm_error_t lwm_signing_sign(
+        struct lwm_signing_t* signing, mavlink_message_t* msg);
+    enum lwm_error_t lwm_signing_verify(
+        struct lwm_signing_t* signing, const mavlink_message_t* msg);
+
+    /**
+     * @brief an empty filter matches no msgid from any sysid/compid
+     */
+    void lwm_filter_init(struct lwm_filter_t* filter);
+    void lwm_filter_any(struct lwm_filter_t* filter);
+    enum lwm_error_t lwm_filter_msgid(
+        struct lwm_filter_t* filter, uint32_t msgid);
+    enum lwm_error_t lwm_filter_msgid_range(
+        struct lwm_filter_t* filter, uint32_t first, uint32_t last);
+    /**
+     * @brief the first sysid/compid added restricts the filter to the ones
+     * added
+     */
+    void lwm_filter_sysid(struct lwm_filter_t* filter, uint8_t sysid);
+    void lwm_filter_compid(struct lwm_filter_t* filter, uint8_t compid);
+    bool lwm_filter_match(
+        const struct lwm_filter_t* filter, const mavlink_message_t* msg);
+
+    /**
+     * @brief decode the delivered message on first use, later calls in the
+     * same dispatch return the same struct
+     */
+    const void* lwm_delivery_decode(struct lwm_delivery_t* delivery);
+
+    void lwm_telemetry_init(struct lwm_telemetry_t* telemetry);
+    void lwm_telemetry_update(struct lwm_telemetry_t* telemetry,
+        const mavlink_message_t* msg, uint64_t time_us);
+    /**
+     * @brief copy out the latest message from a source, safe from any thread
+     * while the vehicle keeps updating the store
+     * @return LWM_ERR_NO_DATA if nothing was received from it yet
+     */
+    enum lwm_error_t lwm_telemetry_read(const struct lwm_telemetry_t* telemetry,
+        uint32_t msgid, uint8_t sysid, uint8_t compid, mavlink_message_t* msg,
+        uint64_t* time_us);
+    /**
+     * @brief create a store in the named shared memory segment, publish it
+     * with lwm_vehicle_set_telemetry (posix only)
+     */
+    enum lwm_error_t lwm_telemetry_shm_create(
+        const char* name, struct lwm_telemetry_t** telemetry);
+    void lwm_telemetry_shm_destroy(
+        const char* name, struct lwm_telemetry_t* telemetry);
+    /**
+     * @brief map a published store read-only, lwm_telemetry_read then costs
+     * no syscall (posix only)
+     */
+    enum lwm_error_t lwm_telemetry_shm_attach(
+        const char* name, const struct lwm_telemetry_t** telemetry);
+    void lwm_telemetry_shm_detach(const struct lwm_telemetry_t* telemetry);
+
+    /**
+     * @brief listen on the unix socket `path` and stream every message the
+     * filter matches to the clients connected there (posix only)
+     */
+    enum lwm_error_t lwm_bridge_open(struct lwm_bridge_t* bridge,
+        struct lwm_vehicle_t* vehicle, const char* path,
+        const struct lwm_filter_t* filter);
+    /**
+     * @brief accept new clients and read their configuration, never blocks
+     */
+    void lwm_bridge_poll(struct lwm_bridge_t* bridge);
+    void lwm_bridge_close(struct lwm_bridge_t* bridge);
+    /**
+     * @brief one line of json, fields named after the message definition
+     * @return bytes written, 0 if it does not fit
+     */
+    size_t lwm_bridge_serialize_json(
+        struct lwm_delivery_t* delivery, char* buf, size_t size);
+    /**
+     * @return bytes written, 0 if it does not fit
+     */
+    size_t lwm_bridge_serialize_binary(
+        struct lwm_delivery_t* delivery, uint8_t* buf, size_t size);
 
     void lwm_microservice_init(struct lwm_vehicle_t* vehicle);
+    void lwm_microservice_fini(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief let the service and subscription pools chain heap slabs when
+     * they run out (posix only, baremetal pools stay static)
+     */
+    void lwm_microservice_pool_growth(
+        struct lwm_vehicle_t* vehicle, bool enable);
+    void lwm_microservice_stats(struct lwm_vehicle_t* vehicle,
+        struct lwm_microservice_stats_t*             stats);
     void lwm_microservice_process(
         struct lwm_vehicle_t* vehicle, mavlink_message_t* msg);
+    /**
+     * @brief dispatch a batch grouped by msgid, `order` lists the frames
+     * sorted by msgid
+     */
+    void lwm_microservice_process_batch(struct lwm_vehicle_t* vehicle,
+        mavlink_message_t* msgs, const uint8_t* order, size_t n);
+    /**
+     * @brief hold deliveries to subscriptions of `priority` and lower until
+     * lwm_microservice_flush_deferred, called at the end of each receive
+     * batch by the vehicle
+     */
+    void lwm_microservice_defer(
+        struct lwm_vehicle_t* vehicle, bool enable, uint8_t priority);
+    void lwm_microservice_flush_deferred(struct lwm_vehicle_t* vehicle);
     enum lwm_error_t lwm_microservice_add_to(struct lwm_vehicle_t* vehicle,
         uint32_t msgid, struct lwm_microservice_t* service);
+    /**
+     * @brief subscribe with the given index, reported back in the delivery
+     */
+    enum lwm_error_t lwm_microservice_add_indexed(struct lwm_vehicle_t* vehicle,
+        uint32_t msgid, uint32_t index, struct lwm_microservice_t* service);
+    /**
+     * @brief subscribe to every msgid of a set with a single service, the
+     * delivery index tells which entry matched
+     */
+    enum lwm_error_t lwm_microservice_add_set(struct lwm_vehicle_t* vehicle,
+        const uint32_t* msgids, size_t n, struct lwm_microservice_t* service);
+    /**
+     * @brief subscribe to every message the filter matches, the filter is
+     * copied and can be reused by the caller; it runs among the msgid
+     * subscriptions by priority, after those of the same priority
+     */
+    enum lwm_error_t lwm_microservice_add_filter(struct lwm_vehicle_t* vehicle,
+        const struct lwm_filter_t* filter, uint32_t index,
+        struct lwm_microservice_t* service);
+    void lwm_microservice_remove_filters(
+        struct lwm_vehicle_t* vehicle, struct lwm_microservice_t* service);
     enum lwm_error_t lwm_microservice_remove_from(struct lwm_vehicle_t* vehicle,
         uint32_t msgid, struct lwm_microservice_t* service);
     struct lwm_microservice_t* lwm_microservice_create(
@@ -319,14 +1333,259 @@ extern "C"
         struct lwm_vehicle_t* vehicle, struct lwm_microservice_t* service);
 
     void             lwm_vehicle_init(struct lwm_vehicle_t* vehicle);
+    void lwm_vehicle_state_init(struct lwm_vehicle_state_t* state);
+    /**
+     * @brief fold a message from the vehicle into its state
+     * @return the fields whose value changed
+     */
+    uint32_t lwm_vehicle_state_update(
+        struct lwm_vehicle_state_t* state, struct lwm_delivery_t* delivery);
+    /**
+     * @brief fields changed since the last call
+     */
+    uint32_t lwm_vehicle_state_changes(struct lwm_vehicle_state_t* state);
+    /**
+     * @brief microseconds since `field` was last reported, UINT64_MAX if never
+     */
+    uint64_t lwm_vehicle_state_age(const struct lwm_vehicle_state_t* state,
+        enum lwm_state_field_t field, uint64_t now_us);
+
+    void lwm_waiter_init(struct lwm_waiter_t* waiter, lwm_predicate_t predicate,
+        void* context, uint32_t depends);
+    /**
+     * @brief start waiting, the predicate is checked once right away
+     */
+    enum lwm_error_t lwm_waiter_submit(struct lwm_vehicle_t* vehicle,
+        struct lwm_waiter_t* waiter, uint64_t timeout_us);
+    void lwm_waiter_cancel(
+        struct lwm_vehicle_t* vehicle, struct lwm_waiter_t* waiter);
+    /**
+     * @brief re-check the predicates that depend on `reported` and expire
+     * the ones past their deadline, called by the vehicle
+     */
+    void lwm_waiter_notify(
+        struct lwm_vehicle_t* vehicle, uint32_t reported, uint64_t now_us);
+    /**
+     * @brief spin the vehicle until the waiter is satisfied or times out
+     */
+    enum lwm_error_t lwm_waiter_wait(struct lwm_vehicle_t* vehicle,
+        struct lwm_waiter_t* waiter, uint64_t timeout_us);
+
+    bool lwm_predicate_armed(
+        const struct lwm_vehicle_state_t* state, void* context);
+    bool lwm_predicate_disarmed(
+        const struct lwm_vehicle_state_t* state, void* context);
+    /* context: the custom mode, cast to a pointer */
+    bool lwm_predicate_mode(
+        const struct lwm_vehicle_state_t* state, void* context);
+    /* context: millimeters above home, cast to a pointer */
+    bool lwm_predicate_altitude_above(
+        const struct lwm_vehicle_state_t* state, void* context);
+    /**
+     * @brief keep the latest message per (msgid, sysid, compid) in `store`
+     */
+    void lwm_vehicle_set_telemetry(
+        struct lwm_vehicle_t* vehicle, struct lwm_telemetry_t* store);
+    /**
+     * @brief run the handlers of services marked `on_worker` on `n` threads
+     * (posix only); their handlers must not add or remove subscriptions
+     */
+    enum lwm_error_t lwm_workers_start(struct lwm_vehicle_t* vehicle,
+        struct lwm_workers_t* workers, uint32_t n);
+    /**
+     * @brief wait until every queued job ran, e.g. before destroying a
+     * service marked `on_worker`
+     */
+    void lwm_workers_drain(struct lwm_vehicle_t* vehicle);
+    void lwm_workers_stop(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief queue a delivery on the worker of its service, called by the
+     * dispatcher
+     * @return false if the queue was full and the delivery dropped
+     */
+    bool lwm_workers_submit(struct lwm_workers_t* workers,
+        struct lwm_subscription_t* sub, struct lwm_delivery_t* delivery);
+    void lwm_submit_init(struct lwm_submit_queue_t* queue);
+    /**
+     * @brief send a message from any thread, the spinning thread sends it
+     * @return LWM_ERR_NO_MEM if the queue is full
+     */
+    enum lwm_error_t lwm_vehicle_post(
+        struct lwm_vehicle_t* vehicle, const mavlink_message_t* msg);
+    /**
+     * @brief submit an action from any thread, it runs and gets its
+     * callbacks on the spinning thread
+     * @return LWM_ERR_NO_MEM if the queue is full
+     */
+    enum lwm_error_t lwm_vehicle_post_action(struct lwm_vehicle_t* vehicle,
+        struct lwm_action_t* action, uint64_t timeout_us);
+    /**
+     * @brief send and submit what was posted, in order, called by the
+     * vehicle on every spin
+     */
+    void lwm_vehicle_drain_posted(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief read and parse the connection on a thread of its own; the
+     * vehicle then takes frames from its ring when spinning (posix only)
+     */
+    enum lwm_error_t lwm_io_thread_start(
+        struct lwm_vehicle_t* vehicle, struct lwm_io_thread_t* io);
+    void lwm_io_thread_stop(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief take up to `max` frames off the ring, waiting at most `wait_us`
+     * for the first one
+     * @return LWM_ERR_NO_DATA if none came, the I/O thread's error once it
+     * stopped and the ring is empty
+     */
+    enum lwm_error_t lwm_io_thread_pop(struct lwm_io_thread_t* io,
+        mavlink_message_t* msgs, size_t max, size_t* n, uint32_t wait_us);
+    void lwm_io_thread_stats(
+        struct lwm_io_thread_t* io, struct lwm_io_stats_t* stats);
+    enum lwm_error_t lwm_reactor_init(struct lwm_reactor_t* reactor);
+    void             lwm_reactor_fini(struct lwm_reactor_t* reactor);
+    /**
+     * @brief serve the vehicle's connection from the reactor, which must
+     * then be the only one spinning it (posix only)
+     * @return LWM_ERR_NOT_SUPPORTED if the backend has no descriptor
+     */
+    enum lwm_error_t lwm_reactor_add_vehicle(
+        struct lwm_reactor_t* reactor, struct lwm_vehicle_t* vehicle);
+    void lwm_reactor_remove_vehicle(
+        struct lwm_reactor_t* reactor, struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief call `tick` every `period_us`, or once after it if `periodic`
+     * is false
+     * @param id set to the timer, for lwm_reactor_cancel_timer
+     */
+    enum lwm_error_t lwm_reactor_add_timer(struct lwm_reactor_t* reactor,
+        uint64_t period_us, bool periodic, lwm_reactor_tick_t tick,
+        void* context, uint32_t* id);
+    void lwm_reactor_cancel_timer(struct lwm_reactor_t* reactor, uint32_t id);
+    /**
+     * @brief trade latency for wakeups, NULL turns it off; timers added
+     * afterwards are aligned to the tick
+     */
+    void lwm_reactor_set_power(struct lwm_reactor_t* reactor,
+        const struct lwm_reactor_power_t* power);
+    void lwm_reactor_stats(
+        struct lwm_reactor_t* reactor, struct lwm_reactor_stats_t* stats);
+    /**
+     * @brief make the reactor drain what was posted to its vehicles, safe
+     * from any thread; posts to its vehicles do it already
+     */
+    void lwm_reactor_wake(struct lwm_reactor_t* reactor);
+    /**
+     * @brief make lwm_reactor_run return, safe from any thread
+     */
+    void lwm_reactor_stop(struct lwm_reactor_t* reactor);
+    /**
+     * @brief wait up to `timeout_ms` (-1 for ever) and handle what is ready
+     * @return LWM_ERR_STOPPED once lwm_reactor_stop was called
+     */
+    enum lwm_error_t lwm_reactor_run_once(
+        struct lwm_reactor_t* reactor, int timeout_ms);
+    enum lwm_error_t lwm_reactor_run(struct lwm_reactor_t* reactor);
+    /**
+     * @brief call `wake` from the posting thread after each post, e.g. to
+     * signal the host's event loop; set it before anything is posted
+     */
+    void lwm_vehicle_set_wake(
+        struct lwm_vehicle_t* vehicle, lwm_wake_t wake, void* context);
+    /**
+     * @brief descriptor to wait on before lwm_vehicle_process_input
+     * @return -1 if there is none (certikos, or read by an I/O thread)
+     */
+    int lwm_vehicle_fd(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief earliest waiter or action deadline, in time_us(), 0 for none
+     */
+    uint64_t lwm_vehicle_next_deadline(const struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief read once without blocking and dispatch every frame the read
+     * brought in arrival order, call it when the descriptor is readable
+     */
+    enum lwm_error_t lwm_vehicle_process_input(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief time out the waiters and actions whose deadline passed
+     */
+    void lwm_vehicle_process_timers(
+        struct lwm_vehicle_t* vehicle, uint64_t now_us);
+    /**
+     * @brief never blocks: send what was posted, read if `readable` and
+     * expire deadlines; the entry point for a host event loop
+     */
+    enum lwm_error_t lwm_vehicle_process(
+        struct lwm_vehicle_t* vehicle, bool readable);
+    /**
+     * @brief measure every spin into `latency`, NULL to stop
+     */
+    void lwm_vehicle_set_latency(
+        struct lwm_vehicle_t* vehicle, struct lwm_latency_t* latency);
+    /**
+     * @brief let lwm_vehicle_process_input dispatch each read grouped by
+     * msgid, as lwm_vehicle_spin_batch does, instead of in arrival order
+     */
+    void lwm_vehicle_set_grouped(struct lwm_vehicle_t* vehicle, bool grouped);
+    /**
+     * @brief leave every thread and memory setting as it is
+     */
+    void lwm_rt_config_init(struct lwm_rt_config_t* config);
+    /**
+     * @brief pin and raise the calling thread, the vehicle's I/O thread and
+     * workers, then lock and prefault the vehicle's memory (posix only);
+     * call it from the dispatch thread once they are started; a failure
+     * leaves the threads and the memory lock as they were
+     * @return LWM_ERR_NOT_SUPPORTED if not permitted, e.g. without
+     * CAP_SYS_NICE or CAP_IPC_LOCK
+     */
+    enum lwm_error_t lwm_rt_start(
+        struct lwm_vehicle_t* vehicle, const struct lwm_rt_config_t* config);
+    /**
+     * @brief serve `port` (0 for any) from `n` sockets and threads, one per
+     * core if 0 (posix only); peers stay on the shard their first datagram
+     * reached, `accept` is called there
+     */
+    enum lwm_error_t lwm_udp_server_start(struct lwm_udp_server_t* server,
+        uint16_t port, uint32_t n, lwm_udp_accept_t accept,
+        lwm_udp_release_t release, void* context);
+    /**
+     * @brief join the shards, then close and release every peer's vehicle
+     */
+    void lwm_udp_server_stop(struct lwm_udp_server_t* server);
+    /**
+     * @brief release peers silent for `idle_us`, and ask refused ones again
+     * after it; LWM_UDP_PEER_IDLE_US until set
+     */
+    void lwm_udp_server_set_idle(
+        struct lwm_udp_server_t* server, uint64_t idle_us);
+    void lwm_udp_server_stats(struct lwm_udp_server_t* server,
+        struct lwm_udp_server_stats_t* stats);
     enum lwm_error_t lwm_vehicle_spin_once(struct lwm_vehicle_t* vehicle);
+    /**
+     * @brief like lwm_vehicle_spin_once, for every frame of one read; frames
+     * of the same msgid keep their order, different msgids may not
+     */
+    enum lwm_error_t lwm_vehicle_spin_batch(struct lwm_vehicle_t* vehicle);
     void             lwm_vehicle_spin(struct lwm_vehicle_t* vehicle);
 
     void             lwm_action_init(struct lwm_action_t* action,
                     struct lwm_vehicle_t* vehicle, lwm_run_t run);
     enum lwm_error_t lwm_action_poll_once(struct lwm_action_t* action);
-    void lwm_action_submit(struct lwm_action_t* action, uint64_t timeout_us);
+    enum lwm_error_t lwm_action_submit(
+        struct lwm_action_t* action, uint64_t timeout_us);
     enum lwm_error_t lwm_action_poll(struct lwm_action_t* action);
+    /**
+     * @brief time the action out if it still runs past its deadline, for
+     * loops that wait on timers rather than polling
+     * @return LWM_ERR_TIMEOUT if it did, LWM_ERR_STOPPED if it already ended
+     */
+    enum lwm_error_t lwm_action_expire(
+        struct lwm_action_t* action, uint64_t now_us);
+    /**
+     * @brief time out the vehicle's actions past their deadline, called by
+     * the vehicle
+     */
+    void lwm_action_notify(struct lwm_vehicle_t* vehicle, uint64_t now_us);
 
 
 
@@ -395,6 +1654,12 @@ lwm_command_mission_clear_all(
     void lwm_command_execute_timeout(
         struct lwm_command_t* x, uint64_t timeout_us);
     void               lwm_command_execute_async(struct lwm_command_t* x);
+    /**
+     * @brief lwm_command_execute_async from a thread other than the one
+     * spinning the vehicle
+     */
+    enum lwm_error_t lwm_command_post(
+        struct lwm_command_t* x, uint64_t timeout_us);
 
     mavlink_message_t* lwm_command_request_message(
         struct lwm_vehicle_t* vehicle, uint32_t msgid);
@@ -423,6 +1688,7 @@ lwm_command_mission_clear_all(
     void posix_serial_register(struct lwm_conn_context_t *ctx);
     void posix_udp_register(struct lwm_conn_context_t *ctx);
     void posix_udp_client_register(struct lwm_conn_context_t *ctx);
+    void posix_udp_peer_register(struct lwm_conn_context_t *ctx);
     void certikos_user_serial_register(struct lwm_conn_context_t* ctx);
     void certikos_user_thinros_register(struct lwm_conn_context_t* ctx);
 
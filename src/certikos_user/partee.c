@@ -16,15 +16,41 @@ certikos_user_partee_recv(
     ASSERT(ctx != NULL);
     ASSERT(len >= MAVLINK_MAX_PACKET_LEN);
     struct lwm_partee* lwm_partee = (struct lwm_partee*)ctx->opaque;
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+    uint32_t backoff_us = 1;
+#endif
     while((len = partee_topic_read(lwm_partee->sub, data)) == 0)
     {
         // wait for data
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+        /* there is nothing to block on: once a poll policy's window ran
+         * out, sleep between reads rather than keep spinning */
+        if (ctx->poll.mode != LWM_POLL_BLOCK)
+        {
+            struct timespec ts = {0, (long)backoff_us * 1000};
+            nanosleep(&ts, NULL);
+            if (backoff_us < LWM_POLL_BACKOFF_MAX_US)
+            {
+                backoff_us *= 2;
+            }
+        }
+#endif
     }
 
     return (ssize_t)len;
 
 }
 
+static ssize_t
+certikos_user_partee_try_recv(
+    struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(len >= MAVLINK_MAX_PACKET_LEN);
+    struct lwm_partee* lwm_partee = (struct lwm_partee*)ctx->opaque;
+    return (ssize_t)partee_topic_read(lwm_partee->sub, data);
+}
+
 static enum lwm_error_t
 certikos_user_partee_send(
     struct lwm_conn_context_t* ctx, const uint8_t* data, size_t len)
@@ -104,8 +130,9 @@ certikos_user_partee_register(struct lwm_conn_context_t *ctx)
 {
     ASSERT(ctx != NULL);
 
-    ctx->open  = certikos_user_partee_open;
-    ctx->close = certikos_user_partee_close;
-    ctx->send  = certikos_user_partee_send;
-    ctx->recv  = certikos_user_partee_recv;
+    ctx->open     = certikos_user_partee_open;
+    ctx->close    = certikos_user_partee_close;
+    ctx->send     = certikos_user_partee_send;
+    ctx->recv     = certikos_user_partee_recv;
+    ctx->try_recv = certikos_user_partee_try_recv;
 }
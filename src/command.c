@@ -255,3 +255,12 @@ lwm_command_execute_async(struct lwm_command_t* x)
 
     lwm_action_submit(&x->action, 0);
 }
+
+enum lwm_error_t
+lwm_command_post(struct lwm_command_t* x, uint64_t timeout_us)
+{
+    ASSERT(x != NULL);
+    ASSERT(x->action.vehicle != NULL);
+
+    return lwm_vehicle_post_action(x->action.vehicle, &x->action, timeout_us);
+}
@@ -11,14 +11,15 @@ lwm_command_then_nop(
 
     if(msg->msgid == MAVLINK_MSG_ID_COMMAND_ACK)
     {
-        mavlink_command_ack_t ack;
-        mavlink_msg_command_ack_decode(msg, &ack);
+        /* every pending command sees the same ack, decode it once */
+        const mavlink_command_ack_t* ack
+            = LWM_DECODED(param->detail.msg.delivery, mavlink_command_ack_t);
 
         struct lwm_command_t* x = (struct lwm_command_t*)action->data;
 
-        if(x->msg_id == ack.command)
+        if(x->msg_id == ack->command)
         {
-            if(ack.result != MAV_RESULT_ACCEPTED)
+            if(ack->result != MAV_RESULT_ACCEPTED)
             {
                 action->status = LWM_ACTION_FAILED;
             }
@@ -59,11 +60,11 @@ lwm_command_handle_ack(
 
     //struct lwm_command_t *cmd = (struct lwm_command_t *)action->data;
 
-    mavlink_command_ack_t ack;
-    mavlink_msg_command_ack_decode(msg, &ack);
+    const mavlink_command_ack_t* ack
+        = LWM_DECODED(param->detail.msg.delivery, mavlink_command_ack_t);
 
-    if (ack.command &&
-        ack.result == MAV_RESULT_ACCEPTED)
+    if (ack->command &&
+        ack->result == MAV_RESULT_ACCEPTED)
     {
         action->result = msg;
         return LWM_ACTION_STOP;
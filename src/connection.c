@@ -1,5 +1,9 @@
 #include "lwmavsdk.h"
 
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+#include <sys/socket.h>
+#endif
+
 static void
 lwm_read_buffer_init(struct lwm_read_buffer_t* buf)
 {
@@ -29,14 +33,22 @@ lwm_read_buffer_empty(struct lwm_read_buffer_t* buf)
 static void
 lwm_conn_init(struct lwm_conn_context_t* ctx)
 {
-    ctx->status = LWM_CONN_STATUS_CLOSED;
-    ctx->opaque = NULL;
-    ctx->open   = NULL;
-    ctx->close  = NULL;
-    ctx->send   = NULL;
-    ctx->recv   = NULL;
+    ctx->status     = LWM_CONN_STATUS_CLOSED;
+    ctx->opaque     = NULL;
+    ctx->open       = NULL;
+    ctx->close      = NULL;
+    ctx->send       = NULL;
+    ctx->recv       = NULL;
+    ctx->try_recv   = NULL;
+    ctx->fd         = NULL;
+    ctx->coalesce   = NULL;
+    ctx->signing    = NULL;
+    ctx->output_len = 0;
+    ctx->output_max = 0;
     memset(&ctx->rx_status, 0, sizeof(ctx->rx_status));
-    mavlink_reset_channel_status(MAVLINK_COMM_0);
+    memset(&ctx->rx_parse, 0, sizeof(ctx->rx_parse));
+    memset(&ctx->poll, 0, sizeof(ctx->poll));
+    ctx->poll.mode = LWM_POLL_BLOCK;
 }
 
 enum lwm_error_t
@@ -97,6 +109,12 @@ lwm_conn_open(struct lwm_conn_context_t* ctx, enum lwm_conn_type_t type, ...)
         params.params.partee.subscribe_topic = va_arg(args, const char *);
         break;
     }
+    case LWM_CONN_TYPE_UDP_PEER:
+    {
+        params.params.udp_peer.fd   = va_arg(args, int);
+        params.params.udp_peer.addr = va_arg(args, const void*);
+        break;
+    }
     default:
     {
         va_end(args);
@@ -116,19 +134,65 @@ lwm_conn_open(struct lwm_conn_context_t* ctx, enum lwm_conn_type_t type, ...)
 }
 
 enum lwm_error_t
-lwm_conn_send(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
+lwm_conn_write(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
 {
     ASSERT(ctx != NULL && ctx->send != NULL
         && ctx->status == LWM_CONN_STATUS_OPEN);
 
+    enum lwm_error_t err = LWM_OK;
+    size_t max = ctx->output_max < LWM_WRITE_BUFFER_SIZE
+        ? ctx->output_max
+        : LWM_WRITE_BUFFER_SIZE;
+    if (ctx->output_len > 0 && ctx->output_len + MAVLINK_MAX_PACKET_LEN > max)
+    {
+        err = lwm_conn_flush(ctx);
+    }
+
     size_t  min_len   = mavlink_min_message_length(msg);
     uint8_t crc_extra = mavlink_get_crc_extra(msg);
     mavlink_finalize_message(
         msg, msg->sysid, msg->compid, min_len, msg->len, crc_extra);
-    size_t len = mavlink_msg_to_send_buffer(ctx->output, msg);
+    if (ctx->signing != NULL
+        && (ctx->signing->flags & LWM_SIGNING_SIGN_OUTGOING))
+    {
+        lwm_signing_sign(ctx->signing, msg);
+    }
+    ctx->output_len
+        += mavlink_msg_to_send_buffer(&ctx->output[ctx->output_len], msg);
+    return err;
+}
+
+enum lwm_error_t
+lwm_conn_flush(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL && ctx->send != NULL);
+
+    if (ctx->output_len == 0)
+    {
+        return LWM_OK;
+    }
+    size_t len      = ctx->output_len;
+    ctx->output_len = 0;
     return ctx->send(ctx, ctx->output, len);
 }
 
+enum lwm_error_t
+lwm_conn_send(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
+{
+    /* anything written before goes out in the same send */
+    enum lwm_error_t err     = lwm_conn_write(ctx, msg);
+    enum lwm_error_t flushed = lwm_conn_flush(ctx);
+    return err != LWM_OK ? err : flushed;
+}
+
+void
+lwm_conn_set_signing(
+    struct lwm_conn_context_t* ctx, struct lwm_signing_t* signing)
+{
+    ASSERT(ctx != NULL);
+    ctx->signing = signing;
+}
+
 static void
 lwm_conn_packet_drop_analyzer(
     struct lwm_conn_context_t* ctx, size_t pos, size_t len)
@@ -145,12 +209,33 @@ lwm_conn_packet_drop_analyzer(
         ctx->rx_message.sysid, ctx->rx_message.compid);
 }
 
-enum lwm_error_t
-lwm_conn_recv(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
+static bool
+lwm_conn_parse_char(struct lwm_conn_context_t* ctx, uint8_t c)
 {
-    ASSERT(ctx != NULL && ctx->send != NULL
-        && ctx->status == LWM_CONN_STATUS_OPEN);
+    /* same as mavlink_parse_char, on the link's own state instead of a
+     * channel's: links served from one thread would mix partial frames */
+    uint8_t framing = mavlink_frame_char_buffer(
+        &ctx->rx_frame, &ctx->rx_parse, c, &ctx->rx_message, &ctx->rx_status);
+    if (framing == MAVLINK_FRAMING_BAD_CRC
+        || framing == MAVLINK_FRAMING_BAD_SIGNATURE)
+    {
+        ctx->rx_parse.parse_error++;
+        ctx->rx_parse.msg_received = MAVLINK_FRAMING_INCOMPLETE;
+        ctx->rx_parse.parse_state  = MAVLINK_PARSE_STATE_IDLE;
+        if (c == MAVLINK_STX)
+        {
+            ctx->rx_parse.parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+            ctx->rx_frame.len         = 0;
+            mavlink_start_checksum(&ctx->rx_frame);
+        }
+        return false;
+    }
+    return framing == MAVLINK_FRAMING_OK;
+}
 
+static enum lwm_error_t
+lwm_conn_parse(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
+{
     struct lwm_read_buffer_t* input = &ctx->input;
     if (!lwm_read_buffer_empty(input))
     {
@@ -158,14 +243,20 @@ lwm_conn_recv(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
         for (; input->pos < input->len; input->pos++)
         {
             uint8_t c = input->buffer[input->pos];
-            if (mavlink_parse_char(
-                    MAVLINK_COMM_0, c, &ctx->rx_message, &ctx->rx_status))
+            if (lwm_conn_parse_char(ctx, c))
             {
 //                printf("rx message: sys %3d, comp %3d, seq %3d, id %3d, len %3d\n",
 //                    ctx->rx_message.sysid, ctx->rx_message.compid,
 //                    ctx->rx_message.seq, ctx->rx_message.msgid,
 //                    ctx->rx_message.len);
 
+                if (ctx->signing != NULL
+                    && lwm_signing_verify(ctx->signing, &ctx->rx_message)
+                        != LWM_OK)
+                {
+                    /* unsigned, forged or replayed */
+                    continue;
+                }
                 memcpy(msg, &ctx->rx_message, sizeof(mavlink_message_t));
                 input->pos++;
                 return LWM_OK;
@@ -180,8 +271,121 @@ lwm_conn_recv(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
             }
         }
     }
+    return LWM_ERR_NO_DATA;
+}
+
+void
+lwm_conn_set_poll(struct lwm_conn_context_t* ctx, enum lwm_poll_mode_t mode,
+    uint32_t max_spin_us)
+{
+    ASSERT(ctx != NULL && ctx->status == LWM_CONN_STATUS_OPEN);
+
+    struct lwm_poll_t* poll = &ctx->poll;
+    poll->mode        = mode;
+    poll->max_spin_us = max_spin_us;
+    poll->spin_us     = mode == LWM_POLL_BLOCK ? 0 : max_spin_us;
+    poll->gap_ewma_us = max_spin_us / 2;
+    poll->hits        = 0;
+    poll->blocks      = 0;
+    if (mode != LWM_POLL_BLOCK && ctx->try_recv == NULL)
+    {
+        WARN("lwm_conn_set_poll: backend can only block\n");
+    }
+
+#if (defined(POSIX_LIBC) || defined(_MUSL_)) && defined(SO_BUSY_POLL)
+    /* the kernel then polls the device queue too, on each try and for `us`
+     * before sleeping in recv; adaptive windows may shrink to nothing, so
+     * that part stays short */
+    int fd = lwm_conn_fd(ctx);
+    int us = mode == LWM_POLL_SPIN ? (int)max_spin_us
+        : mode == LWM_POLL_ADAPTIVE ? LWM_POLL_MIN_SPIN_US
+                                    : 0;
+    if (fd >= 0
+        && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0)
+    {
+        /* not a socket, or raising it needs CAP_NET_ADMIN */
+        INFO("lwm_conn_set_poll: no SO_BUSY_POLL on fd %d\n", fd);
+    }
+#endif
+}
+
+enum lwm_error_t
+lwm_conn_set_coalesce(struct lwm_conn_context_t* ctx, uint32_t max_delay_us,
+    uint32_t min_bytes)
+{
+    ASSERT(ctx != NULL && ctx->status == LWM_CONN_STATUS_OPEN);
+
+    if (ctx->coalesce == NULL)
+    {
+        return LWM_ERR_NOT_SUPPORTED;
+    }
+    return ctx->coalesce(ctx, max_delay_us, min_bytes);
+}
+
+static void
+lwm_conn_poll_adapt(struct lwm_poll_t* poll, uint64_t waited_us)
+{
+    /* 1/8 of each sample, as TCP smooths its round trip time */
+    int64_t diff = (int64_t)waited_us - (int64_t)poll->gap_ewma_us;
+    poll->gap_ewma_us += diff / 8;
+
+    /* cover most gaps; when they usually outlast the budget, spinning would
+     * only burn it before blocking anyway */
+    uint64_t window = 2 * poll->gap_ewma_us;
+    if (window > poll->max_spin_us)
+    {
+        window = 0;
+    }
+    else if (window < LWM_POLL_MIN_SPIN_US)
+    {
+        window = LWM_POLL_MIN_SPIN_US;
+    }
+    poll->spin_us = (uint32_t)window;
+}
+
+static ssize_t
+lwm_conn_wait(struct lwm_conn_context_t* ctx, uint8_t* buf, size_t len)
+{
+    struct lwm_poll_t* poll = &ctx->poll;
+    if (poll->mode == LWM_POLL_BLOCK || ctx->try_recv == NULL)
+    {
+        return ctx->recv(ctx, buf, len);
+    }
+
+    uint64_t start = time_us();
+    uint64_t until = start + poll->spin_us;
+    ssize_t  n     = 0;
+    while (n == 0 && poll->spin_us > 0)
+    {
+        n = ctx->try_recv(ctx, buf, len);
+        if (time_us() >= until)
+        {
+            break;
+        }
+    }
+    if (n > 0)
+    {
+        poll->hits++;
+    }
+    else if (n == 0)
+    {
+        poll->blocks++;
+        n = ctx->recv(ctx, buf, len);
+    }
+
+    if (n > 0 && poll->mode == LWM_POLL_ADAPTIVE)
+    {
+        lwm_conn_poll_adapt(poll, time_us() - start);
+    }
+    return n;
+}
+
+static enum lwm_error_t
+lwm_conn_fill(struct lwm_conn_context_t* ctx)
+{
+    struct lwm_read_buffer_t* input = &ctx->input;
     ASSERT(lwm_read_buffer_empty(input));
-    ssize_t len = ctx->recv(ctx, input->buffer, LWM_READ_BUFFER_SIZE - 1);
+    ssize_t len = lwm_conn_wait(ctx, input->buffer, LWM_READ_BUFFER_SIZE - 1);
     if (len < 0)
     {
         WARN("Connection recv error: %zi\n", len);
@@ -192,6 +396,94 @@ lwm_conn_recv(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
     return LWM_ERR_NO_DATA;
 }
 
+enum lwm_error_t
+lwm_conn_recv(struct lwm_conn_context_t* ctx, mavlink_message_t* msg)
+{
+    ASSERT(ctx != NULL && ctx->send != NULL
+        && ctx->status == LWM_CONN_STATUS_OPEN);
+
+    if (lwm_conn_parse(ctx, msg) == LWM_OK)
+    {
+        return LWM_OK;
+    }
+    return lwm_conn_fill(ctx);
+}
+
+static enum lwm_error_t
+lwm_conn_parse_batch(struct lwm_conn_context_t* ctx, mavlink_message_t* msgs,
+    size_t max, size_t* n)
+{
+    /* never reads again, a partial frame at the end waits for the next */
+    while (*n < max && lwm_conn_parse(ctx, &msgs[*n]) == LWM_OK)
+    {
+        (*n)++;
+    }
+    return *n > 0 ? LWM_OK : LWM_ERR_NO_DATA;
+}
+
+enum lwm_error_t
+lwm_conn_recv_batch(struct lwm_conn_context_t* ctx, mavlink_message_t* msgs,
+    size_t max, size_t* n)
+{
+    ASSERT(ctx != NULL && ctx->send != NULL
+        && ctx->status == LWM_CONN_STATUS_OPEN);
+    ASSERT(msgs != NULL && n != NULL);
+
+    *n = 0;
+    if (lwm_read_buffer_empty(&ctx->input))
+    {
+        enum lwm_error_t err = lwm_conn_fill(ctx);
+        if (err != LWM_ERR_NO_DATA)
+        {
+            return err;
+        }
+    }
+    return lwm_conn_parse_batch(ctx, msgs, max, n);
+}
+
+enum lwm_error_t
+lwm_conn_try_recv_batch(struct lwm_conn_context_t* ctx,
+    mavlink_message_t* msgs, size_t max, size_t* n)
+{
+    ASSERT(ctx != NULL && ctx->send != NULL
+        && ctx->status == LWM_CONN_STATUS_OPEN);
+    ASSERT(msgs != NULL && n != NULL);
+
+    *n = 0;
+    if (lwm_read_buffer_empty(&ctx->input))
+    {
+        if (ctx->try_recv == NULL)
+        {
+            return LWM_ERR_NOT_SUPPORTED;
+        }
+        ssize_t len = ctx->try_recv(
+            ctx, ctx->input.buffer, LWM_READ_BUFFER_SIZE - 1);
+        if (len < 0)
+        {
+            WARN("Connection try_recv error: %zi\n", len);
+            return LWM_ERR_IO;
+        }
+        if (len == 0)
+        {
+            return LWM_ERR_NO_DATA;
+        }
+        lwm_read_buffer_set(&ctx->input, len);
+    }
+    return lwm_conn_parse_batch(ctx, msgs, max, n);
+}
+
+int
+lwm_conn_fd(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL && ctx->status == LWM_CONN_STATUS_OPEN);
+
+    if (ctx->fd == NULL)
+    {
+        return -1;
+    }
+    return ctx->fd(ctx);
+}
+
 void
 lwm_conn_close(struct lwm_conn_context_t* ctx)
 {
@@ -16,6 +16,9 @@ lwm_conn_register(struct lwm_conn_context_t * ctx, enum lwm_conn_type_t type)
     case LWM_CONN_TYPE_UDP_CLIENT:
         posix_udp_client_register(ctx);
         return LWM_OK;
+    case LWM_CONN_TYPE_UDP_PEER:
+        posix_udp_peer_register(ctx);
+        return LWM_OK;
 #endif
     case LWM_CONN_TYPE_PARTEE:
         certikos_user_partee_register(ctx);
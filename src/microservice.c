@@ -1,43 +1,233 @@
 #include "lwmavsdk.h"
 
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+#define LWM_SERVICE_POOL_CAN_GROW 1
+#endif
+
+static void
+lwm_service_pool_push_free(
+        struct lwm_service_pool_t * pool,
+        struct lwm_microservice_t * service)
+{
+    service->is_active = false;
+    service->next_free = pool->free;
+    pool->free = service;
+}
+
 static void
 lwm_service_pool_init(struct lwm_service_pool_t * pool)
 {
     pool->n = 0;
-    for (uint32_t i = 0; i < MAX_LWM_SERVICE; i++)
+    pool->free = NULL;
+    pool->slabs = NULL;
+    pool->grow = false;
+    pool->capacity = MAX_LWM_SERVICE;
+    pool->high_water = 0;
+    pool->failed = 0;
+    for (uint32_t i = MAX_LWM_SERVICE; i > 0; i--)
     {
-        pool->services[i].is_active = false;
+        lwm_service_pool_push_free(pool, &pool->services[i - 1]);
     }
 }
 
+static bool
+lwm_service_pool_grow(struct lwm_service_pool_t * pool)
+{
+#if defined(LWM_SERVICE_POOL_CAN_GROW)
+    if (!pool->grow)
+    {
+        return false;
+    }
+    struct lwm_service_slab_t * slab = malloc(sizeof(struct lwm_service_slab_t));
+    if (slab == NULL)
+    {
+        return false;
+    }
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    for (uint32_t i = LWM_SERVICE_SLAB_SIZE; i > 0; i--)
+    {
+        lwm_service_pool_push_free(pool, &slab->services[i - 1]);
+    }
+    pool->capacity += LWM_SERVICE_SLAB_SIZE;
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void
+lwm_service_pool_fini(struct lwm_service_pool_t * pool)
+{
+#if defined(LWM_SERVICE_POOL_CAN_GROW)
+    while (pool->slabs != NULL)
+    {
+        struct lwm_service_slab_t * next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+#endif
+}
+
 static struct lwm_microservice_t *
 lwm_service_pool_alloc(struct lwm_service_pool_t * pool)
 {
-    if (pool->n >= MAX_LWM_SERVICE)
+    if (pool->free == NULL && !lwm_service_pool_grow(pool))
     {
+        pool->failed++;
         WARN("Service pool is full\n");
         return NULL;
     }
-    for (uint32_t i = 0; i < MAX_LWM_SERVICE; i++)
+
+    struct lwm_microservice_t * service = pool->free;
+    pool->free = service->next_free;
+    service->is_active = true;
+    service->context = NULL;
+    service->handler = NULL;
+    service->deliver = NULL;
+    service->priority = LWM_PRIORITY_NORMAL;
+    service->decimation = 0;
+    service->interval_us = 0;
+    service->on_change = false;
+    service->change_mask = NULL;
+    service->change_mask_len = 0;
+    service->change_masks = NULL;
+    service->n_change_masks = 0;
+    service->on_worker = false;
+    service->subscriptions = NULL;
+    service->next_free = NULL;
+
+    pool->n++;
+    if (pool->n > pool->high_water)
     {
-        if (!pool->services[i].is_active)
-        {
-            pool->services[i].is_active = true;
-            pool->services[i].context = NULL;
-            pool->services[i].handler = NULL;
-            pool->services[i].next = NULL;
-            pool->services[i].prev = NULL;
-            pool->n++;
-            return &pool->services[i];
-        }
+        pool->high_water = pool->n;
     }
-    return NULL;
+    return service;
 }
 
 static void
 lwm_service_pool_free(struct lwm_service_pool_t * pool, struct lwm_microservice_t * service)
 {
-    service->is_active = false;
+    ASSERT(service->is_active);
+    lwm_service_pool_push_free(pool, service);
+    pool->n--;
+}
+
+static void
+lwm_subscription_pool_push_free(
+        struct lwm_subscription_pool_t * pool,
+        struct lwm_subscription_t * sub)
+{
+    sub->service = NULL;
+    sub->entry = NULL;
+    sub->next_free = pool->free;
+    pool->free = sub;
+}
+
+static void
+lwm_subscription_pool_init(struct lwm_subscription_pool_t * pool)
+{
+    pool->n = 0;
+    pool->free = NULL;
+    pool->slabs = NULL;
+    pool->grow = false;
+    pool->capacity = MAX_LWM_SUBSCRIPTION;
+    pool->high_water = 0;
+    pool->failed = 0;
+    for (uint32_t i = MAX_LWM_SUBSCRIPTION; i > 0; i--)
+    {
+        pool->subscriptions[i - 1].generation = 0;
+        lwm_subscription_pool_push_free(pool, &pool->subscriptions[i - 1]);
+    }
+}
+
+static bool
+lwm_subscription_pool_grow(struct lwm_subscription_pool_t * pool)
+{
+#if defined(LWM_SERVICE_POOL_CAN_GROW)
+    if (!pool->grow)
+    {
+        return false;
+    }
+    struct lwm_subscription_slab_t * slab =
+        malloc(sizeof(struct lwm_subscription_slab_t));
+    if (slab == NULL)
+    {
+        return false;
+    }
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    for (uint32_t i = LWM_SUBSCRIPTION_SLAB_SIZE; i > 0; i--)
+    {
+        slab->subscriptions[i - 1].generation = 0;
+        lwm_subscription_pool_push_free(pool, &slab->subscriptions[i - 1]);
+    }
+    pool->capacity += LWM_SUBSCRIPTION_SLAB_SIZE;
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void
+lwm_subscription_pool_fini(struct lwm_subscription_pool_t * pool)
+{
+#if defined(LWM_SERVICE_POOL_CAN_GROW)
+    while (pool->slabs != NULL)
+    {
+        struct lwm_subscription_slab_t * next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+#endif
+}
+
+static struct lwm_subscription_t *
+lwm_subscription_pool_alloc(struct lwm_subscription_pool_t * pool)
+{
+    if (pool->free == NULL && !lwm_subscription_pool_grow(pool))
+    {
+        pool->failed++;
+        WARN("Subscription pool is full\n");
+        return NULL;
+    }
+
+    struct lwm_subscription_t * sub = pool->free;
+    pool->free = sub->next_free;
+    sub->service = NULL;
+    sub->entry = NULL;
+    sub->filter = NULL;
+    sub->change = NULL;
+    sub->index = 0;
+    sub->priority = LWM_PRIORITY_NORMAL;
+    sub->is_pending = false;
+    sub->decimation = 0;
+    sub->count = 0;
+    sub->interval_us = 0;
+    sub->skipped = 0;
+    sub->next_us = 0;
+    sub->next = NULL;
+    sub->prev = NULL;
+    sub->sibling = NULL;
+    sub->next_free = NULL;
+    sub->hash_next = NULL;
+
+    pool->n++;
+    if (pool->n > pool->high_water)
+    {
+        pool->high_water = pool->n;
+    }
+    return sub;
+}
+
+static void
+lwm_subscription_pool_free(
+        struct lwm_subscription_pool_t * pool,
+        struct lwm_subscription_t * sub)
+{
+    /* invalidates deliveries still deferred to this subscription */
+    sub->generation++;
+    lwm_subscription_pool_push_free(pool, sub);
     pool->n--;
 }
 
@@ -50,129 +240,585 @@ lwm_service_list_init(struct lwm_service_list_t * list)
 }
 
 static void
-lwm_service_push_tail(struct lwm_service_list_t * list, struct lwm_microservice_t * service)
+lwm_service_push_tail(struct lwm_service_list_t * list, struct lwm_subscription_t * sub)
 {
+    sub->next = NULL;
     if (list->head == NULL)
     {
-        list->head = service;
-        list->tail = service;
-        service->prev = NULL;
+        list->head = sub;
+        list->tail = sub;
+        sub->prev = NULL;
+    }
+    else
+    {
+        list->tail->next = sub;
+        sub->prev = list->tail;
+        list->tail = sub;
+    }
+}
+
+static void
+lwm_service_insert_sorted(struct lwm_service_list_t * list, struct lwm_subscription_t * sub)
+{
+    /* after the last one of the same or a more urgent priority, new
+     * subscriptions usually land on the tail */
+    struct lwm_subscription_t * at = list->tail;
+    while (at != NULL && at->priority > sub->priority)
+    {
+        at = at->prev;
+    }
+    if (at == NULL)
+    {
+        sub->prev = NULL;
+        sub->next = list->head;
+        if (list->head == NULL)
+        {
+            list->tail = sub;
+        }
+        else
+        {
+            list->head->prev = sub;
+        }
+        list->head = sub;
+        return;
+    }
+    sub->prev = at;
+    sub->next = at->next;
+    if (at->next == NULL)
+    {
+        list->tail = sub;
     }
     else
     {
-        list->tail->next = service;
-        service->prev = list->tail;
-        list->tail = service;
+        at->next->prev = sub;
     }
-    /* Not setting null allows to push a list to another list */
-    //service->next = NULL;
+    at->next = sub;
 }
 
 static void
-lwm_service_remove(struct lwm_service_list_t * list, struct lwm_microservice_t * service)
+lwm_service_remove(struct lwm_service_list_t * list, struct lwm_subscription_t * sub)
 {
-    if (service->prev == NULL)
+    if (sub->prev == NULL)
     {
-        list->head = service->next;
+        list->head = sub->next;
     }
     else
     {
-        service->prev->next = service->next;
+        sub->prev->next = sub->next;
     }
 
-    if (service->next == NULL)
+    if (sub->next == NULL)
     {
-        list->tail = service->prev;
+        list->tail = sub->prev;
     }
     else
     {
-        service->next->prev = service->prev;
+        sub->next->prev = sub->prev;
     }
-    service->prev = NULL;
-    service->next = NULL;
+    /* next is kept: a dispatch standing on sub carries on from it */
+    sub->prev = NULL;
 }
 
-static struct lwm_microservice_t *
+static struct lwm_subscription_t *
 lwm_service_head(struct lwm_service_list_t * list)
 {
     return list->head;
 }
 
-static struct lwm_microservice_t *
-lwm_service_next(struct lwm_microservice_t * service)
+static struct lwm_subscription_t *
+lwm_service_next(struct lwm_subscription_t * sub)
+{
+    return sub->next;
+}
+
+static uint64_t
+lwm_change_mix(uint64_t x)
+{
+    /* splitmix64 finalizer */
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t
+lwm_change_digest(
+        const mavlink_message_t * msg,
+        const uint8_t * mask,
+        uint32_t mask_len)
+{
+    /* a sum over the non-zero words, so the zeros MAVLink 2 trims off the
+     * end of a payload do not change it */
+    const uint8_t * payload = (const uint8_t *)_MAV_PAYLOAD(msg);
+    uint64_t digest = 0;
+    for (uint32_t pos = 0; pos < msg->len; pos += 8)
+    {
+        uint8_t bytes[8] = { 0 };
+        uint32_t n = msg->len - pos < 8 ? msg->len - pos : 8;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            bytes[i] = payload[pos + i];
+            if (pos + i < mask_len)
+            {
+                bytes[i] &= mask[pos + i];
+            }
+        }
+
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        if (word != 0)
+        {
+            digest += lwm_change_mix(word ^ (pos * 0x9e3779b97f4a7c15ull));
+        }
+    }
+    return digest;
+}
+
+static struct lwm_change_source_t *
+lwm_change_source(struct lwm_change_t * change, const mavlink_message_t * msg)
+{
+    struct lwm_change_source_t * unused = NULL;
+    for (uint32_t i = 0; i < MAX_LWM_CHANGE_SOURCE; i++)
+    {
+        struct lwm_change_source_t * source = &change->sources[i];
+        if (!source->is_valid)
+        {
+            unused = unused == NULL ? source : unused;
+        }
+        else if (source->sysid == msg->sysid && source->compid == msg->compid
+                 && source->msgid == msg->msgid)
+        {
+            return source;
+        }
+    }
+    if (unused == NULL)
+    {
+        /* more senders than slots, forget one and treat this as new */
+        unused = &change->sources[change->victim];
+        change->victim = (change->victim + 1) % MAX_LWM_CHANGE_SOURCE;
+    }
+    unused->is_valid = false;
+    unused->sysid = msg->sysid;
+    unused->compid = msg->compid;
+    unused->msgid = msg->msgid;
+    return unused;
+}
+
+static const uint8_t *
+lwm_change_mask(
+        const struct lwm_microservice_t * service,
+        uint32_t msgid,
+        uint32_t * len)
 {
-    return service->next;
+    for (uint32_t i = 0; i < service->n_change_masks; i++)
+    {
+        if (service->change_masks[i].msgid == msgid)
+        {
+            *len = service->change_masks[i].len;
+            return service->change_masks[i].mask;
+        }
+    }
+    *len = service->change_mask_len;
+    return service->change_mask;
 }
 
 static bool
-lwm_service_on_list(
-        struct lwm_service_list_t * list,
-        struct lwm_microservice_t * service)
+lwm_subscription_admit(
+        struct lwm_subscription_t * sub,
+        struct lwm_delivery_t * delivery)
 {
-    struct lwm_microservice_t * s = lwm_service_head(list);
-    while (s != NULL)
+    struct lwm_change_source_t * source = NULL;
+    uint64_t digest = 0;
+    if (sub->change != NULL)
     {
-        if (s == service)
+        uint32_t mask_len;
+        const uint8_t * mask =
+            lwm_change_mask(sub->service, delivery->msg->msgid, &mask_len);
+        source = lwm_change_source(sub->change, delivery->msg);
+        digest = lwm_change_digest(delivery->msg, mask, mask_len);
+        if (source->is_valid && source->digest == digest)
+        {
+            sub->skipped++;
+            return false;
+        }
+    }
+
+    if (sub->decimation > 1 && ++sub->count < sub->decimation)
+    {
+        sub->skipped++;
+        return false;
+    }
+    sub->count = 0;
+
+    if (sub->interval_us > 0)
+    {
+        /* one clock read per dispatch, shared by all rate limited ones */
+        if (delivery->time_us == 0)
+        {
+            delivery->time_us = time_us();
+        }
+        uint64_t now = delivery->time_us;
+        if (now < sub->next_us)
+        {
+            sub->skipped++;
+            return false;
+        }
+        /* keep the cadence unless we fell a full interval behind */
+        sub->next_us = now - sub->next_us < sub->interval_us
+            ? sub->next_us + sub->interval_us
+            : now + sub->interval_us;
+    }
+
+    /* only a delivered payload becomes the one to compare against */
+    if (source != NULL)
+    {
+        source->is_valid = true;
+        source->digest = digest;
+    }
+    return true;
+}
+
+static void
+lwm_subscription_deliver(
+        struct lwm_workers_t * workers,
+        struct lwm_subscription_t * sub,
+        struct lwm_delivery_t * delivery)
+{
+    struct lwm_microservice_t * service = sub->service;
+    delivery->skipped = sub->skipped;
+    sub->skipped = 0;
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+    if (service->on_worker && workers != NULL)
+    {
+        if (!lwm_workers_submit(workers, sub, delivery))
+        {
+            /* the next delivery reports it as skipped */
+            sub->skipped = delivery->skipped + 1;
+        }
+        return;
+    }
+#endif
+    if (service->deliver != NULL)
+    {
+        delivery->subscription = sub;
+        delivery->index = sub->index;
+        service->deliver(service->context, delivery);
+    }
+    else
+    {
+        service->handler(service->context, delivery->msg);
+    }
+}
+
+static bool
+lwm_subscription_defer(
+        struct lwm_deferred_queue_t * queue,
+        struct lwm_subscription_t * sub,
+        const mavlink_message_t * msg)
+{
+    if (!queue->is_enabled || sub->priority < queue->priority)
+    {
+        return false;
+    }
+    if (queue->n >= MAX_LWM_DEFERRED)
+    {
+        /* run it late rather than drop it */
+        queue->overflow++;
+        return false;
+    }
+    struct lwm_deferred_t * item = &queue->items[queue->n++];
+    memcpy(&item->msg, msg, sizeof(mavlink_message_t));
+    item->subscription = sub;
+    item->generation = sub->generation;
+    return true;
+}
+
+static bool
+lwm_filter_test(const uint32_t * bitmap, uint32_t bit)
+{
+    return (bitmap[bit >> 5] >> (bit & 31)) & 1;
+}
+
+static void
+lwm_filter_set(uint32_t * bitmap, uint32_t bit)
+{
+    bitmap[bit >> 5] |= 1u << (bit & 31);
+}
+
+void
+lwm_filter_init(struct lwm_filter_t * filter)
+{
+    ASSERT(filter != NULL);
+
+    memset(filter, 0, sizeof(struct lwm_filter_t));
+    filter->flags = LWM_FILTER_ANY_SYSID | LWM_FILTER_ANY_COMPID;
+}
+
+void
+lwm_filter_any(struct lwm_filter_t * filter)
+{
+    ASSERT(filter != NULL);
+
+    filter->flags |= LWM_FILTER_ANY_MSGID;
+}
+
+enum lwm_error_t
+lwm_filter_msgid(struct lwm_filter_t * filter, uint32_t msgid)
+{
+    return lwm_filter_msgid_range(filter, msgid, msgid);
+}
+
+enum lwm_error_t
+lwm_filter_msgid_range(
+        struct lwm_filter_t * filter,
+        uint32_t first,
+        uint32_t last)
+{
+    ASSERT(filter != NULL);
+
+    if (first > last)
+    {
+        return LWM_ERR_BAD_PARAM;
+    }
+
+    /* the low part goes to the bitmap, whatever is left takes a range */
+    for (; first <= last && first < LWM_FILTER_MSGID_BITMAP; first++)
+    {
+        lwm_filter_set(filter->msgids, first);
+    }
+    if (first > last)
+    {
+        return LWM_OK;
+    }
+    if (filter->n_ranges >= MAX_LWM_FILTER_RANGE)
+    {
+        WARN("Filter has too many msgid ranges\n");
+        return LWM_ERR_NO_MEM;
+    }
+    filter->ranges[filter->n_ranges].first = first;
+    filter->ranges[filter->n_ranges].last = last;
+    filter->n_ranges++;
+    return LWM_OK;
+}
+
+void
+lwm_filter_sysid(struct lwm_filter_t * filter, uint8_t sysid)
+{
+    ASSERT(filter != NULL);
+
+    filter->flags &= ~LWM_FILTER_ANY_SYSID;
+    lwm_filter_set(filter->sysids, sysid);
+}
+
+void
+lwm_filter_compid(struct lwm_filter_t * filter, uint8_t compid)
+{
+    ASSERT(filter != NULL);
+
+    filter->flags &= ~LWM_FILTER_ANY_COMPID;
+    lwm_filter_set(filter->compids, compid);
+}
+
+bool
+lwm_filter_match(
+        const struct lwm_filter_t * filter,
+        const mavlink_message_t * msg)
+{
+    if (!(filter->flags & LWM_FILTER_ANY_SYSID)
+        && !lwm_filter_test(filter->sysids, msg->sysid))
+    {
+        return false;
+    }
+    if (!(filter->flags & LWM_FILTER_ANY_COMPID)
+        && !lwm_filter_test(filter->compids, msg->compid))
+    {
+        return false;
+    }
+    if (filter->flags & LWM_FILTER_ANY_MSGID)
+    {
+        return true;
+    }
+    if (msg->msgid < LWM_FILTER_MSGID_BITMAP)
+    {
+        return lwm_filter_test(filter->msgids, msg->msgid);
+    }
+    for (uint32_t i = 0; i < filter->n_ranges; i++)
+    {
+        if (msg->msgid >= filter->ranges[i].first
+            && msg->msgid <= filter->ranges[i].last)
         {
             return true;
         }
-        s = lwm_service_next(s);
     }
     return false;
 }
 
 static void
 lwm_service_foreach(
-        struct lwm_service_list_t * list,
-        mavlink_message_t * msg)
+        struct lwm_service_list_t * exact,
+        struct lwm_service_list_t * filtered,
+        struct lwm_vehicle_t * vehicle,
+        struct lwm_delivery_t * delivery)
 {
-    struct lwm_microservice_t * service = lwm_service_head(list);
-    while (service != NULL)
+    /* both lists are sorted by priority, merging them runs a filter among
+     * the exact subscriptions of its priority; exact ones go first on a tie */
+    struct lwm_deferred_queue_t * queue = &vehicle->deferred;
+    struct lwm_subscription_t * x =
+        exact != NULL ? lwm_service_head(exact) : NULL;
+    struct lwm_subscription_t * f = lwm_service_head(filtered);
+    while (x != NULL || f != NULL)
     {
-        /* prefetch next, in case the current service is removed */
-        struct lwm_microservice_t * next = lwm_service_next(service);
-        service->handler(service->context, msg);
-        service = next;
+        /* step past it first, in case the current service is removed;
+         * removed ones are retired, not freed, and still lead back to
+         * their list */
+        struct lwm_subscription_t * sub;
+        if (f == NULL || (x != NULL && x->priority <= f->priority))
+        {
+            sub = x;
+            x = lwm_service_next(x);
+        }
+        else
+        {
+            sub = f;
+            f = lwm_service_next(f);
+        }
+        if (sub->service != NULL
+            && (sub->filter == NULL
+                || lwm_filter_match(sub->filter, delivery->msg))
+            && lwm_subscription_admit(sub, delivery)
+            && !lwm_subscription_defer(queue, sub, delivery->msg))
+        {
+            lwm_subscription_deliver(vehicle->workers, sub, delivery);
+        }
     }
 }
 
+#if MAVLINK_NEED_BYTE_SWAP
+#error "decoded payloads are the wire layout, big-endian targets need swapping"
+#endif
+
+const void *
+lwm_delivery_decode(struct lwm_delivery_t * delivery)
+{
+    ASSERT(delivery != NULL);
+    ASSERT(delivery->decoded != NULL);
+
+    struct lwm_decoded_t * decoded = delivery->decoded;
+    if (!decoded->is_valid)
+    {
+        /* MAVLink 2 trims trailing zeros, decoding puts them back */
+        const mavlink_message_t * msg = delivery->msg;
+        const mavlink_msg_entry_t * info = mavlink_get_msg_entry(msg->msgid);
+        uint32_t size = info != NULL ? info->max_msg_len : msg->len;
+        uint32_t len = msg->len < size ? msg->len : size;
+        memcpy(decoded->payload64, _MAV_PAYLOAD(msg), len);
+        memset((uint8_t *)decoded->payload64 + len, 0, size - len);
+        decoded->is_valid = true;
+    }
+    return decoded->payload64;
+}
+
+#if MAX_LWM_SERVICE_REGISTRY * 2 > LWM_SERVICE_REGISTRY_HASH_SIZE
+#error "registry hash table must be at least twice MAX_LWM_SERVICE_REGISTRY"
+#endif
+
+static uint32_t
+lwm_microservice_registry_hash(uint32_t msgid)
+{
+    /* fibonacci hashing, spreads the dense low msgids over the table */
+    return (msgid * 2654435769u) >> (32 - LWM_SERVICE_REGISTRY_HASH_BITS);
+}
+
 static void
 lwm_microservice_registry_init(struct lwm_microservice_registry_t * registry)
 {
     registry->n = 0;
+    memset(registry->slots, 0, sizeof(registry->slots));
+    memset(registry->members, 0, sizeof(registry->members));
     for (uint32_t i = 0; i < MAX_LWM_SERVICE_REGISTRY; i++)
     {
         registry->entries[i].is_active = false;
     }
+
+    /* not in the hash table, the msgid is out of the 24-bit MAVLink range */
+    registry->filtered.is_active = true;
+    registry->filtered.msgid = UINT32_MAX;
+    lwm_service_list_init(&registry->filtered.list);
+    lwm_service_list_init(&registry->filtered.pending);
+    registry->filter_free = NULL;
+    for (uint32_t i = MAX_LWM_FILTER; i > 0; i--)
+    {
+        registry->filters[i - 1].next_free = registry->filter_free;
+        registry->filter_free = &registry->filters[i - 1];
+    }
+    registry->change_free = NULL;
+    for (uint32_t i = MAX_LWM_CHANGE; i > 0; i--)
+    {
+        registry->changes[i - 1].next_free = registry->change_free;
+        registry->change_free = &registry->changes[i - 1];
+    }
+    registry->dispatching = 0;
+    registry->retired = NULL;
 }
 
-static struct lwm_microservice_registry_entry_t *
-lwm_microservice_registry_alloc(struct lwm_microservice_registry_t * registry)
+static struct lwm_change_t *
+lwm_microservice_registry_change_alloc(
+        struct lwm_microservice_registry_t * registry)
 {
-    if (registry->n >= MAX_LWM_SERVICE_REGISTRY)
+    struct lwm_change_t * change = registry->change_free;
+    if (change == NULL)
     {
-        WARN("Service registry is full\n");
+        WARN("Change table is full\n");
         return NULL;
     }
-    for (uint32_t i = 0; i < MAX_LWM_SERVICE_REGISTRY; i++)
+    registry->change_free = change->next_free;
+    memset(change, 0, sizeof(struct lwm_change_t));
+    return change;
+}
+
+static void
+lwm_microservice_registry_change_free(
+        struct lwm_microservice_registry_t * registry,
+        struct lwm_change_t * change)
+{
+    if (change != NULL)
     {
-        if (!registry->entries[i].is_active)
-        {
-            registry->entries[i].is_active = true;
-            registry->n++;
-            return &registry->entries[i];
-        }
+        change->next_free = registry->change_free;
+        registry->change_free = change;
     }
-    return NULL;
 }
 
-static void
-lwm_microservice_registry_free(
+static struct lwm_microservice_registry_entry_t *
+lwm_microservice_registry_alloc(
         struct lwm_microservice_registry_t * registry,
-        struct lwm_microservice_registry_entry_t * entry)
+        uint32_t msgid)
 {
-    entry->is_active = false;
-    registry->n--;
+    if (registry->n >= MAX_LWM_SERVICE_REGISTRY)
+    {
+        WARN("Service registry is full\n");
+        return NULL;
+    }
+
+    uint32_t h = lwm_microservice_registry_hash(msgid);
+    struct lwm_microservice_registry_slot_t * slot = &registry->slots[h];
+    while (slot->index != 0)
+    {
+        h = (h + 1) & (LWM_SERVICE_REGISTRY_HASH_SIZE - 1);
+        slot = &registry->slots[h];
+    }
+
+    /* entries are never freed, so they are handed out in order */
+    struct lwm_microservice_registry_entry_t * entry =
+        &registry->entries[registry->n];
+    entry->is_active = true;
+    entry->msgid = msgid;
+    registry->n++;
+
+    slot->msgid = msgid;
+    slot->index = registry->n;
+    return entry;
 }
 
 static struct lwm_microservice_registry_entry_t *
@@ -180,14 +826,21 @@ lwm_microservice_registry_find(
         struct lwm_microservice_registry_t * registry,
         uint32_t msgid)
 {
-    for (uint32_t i = 0; i < MAX_LWM_SERVICE_REGISTRY; i++)
+    uint32_t h = lwm_microservice_registry_hash(msgid);
+    for (;;)
     {
-        if (registry->entries[i].is_active && registry->entries[i].msgid == msgid)
+        /* terminates: the table is never more than half full */
+        struct lwm_microservice_registry_slot_t * slot = &registry->slots[h];
+        if (slot->index == 0)
         {
-            return &registry->entries[i];
+            return NULL;
         }
+        if (slot->msgid == msgid)
+        {
+            return &registry->entries[slot->index - 1];
+        }
+        h = (h + 1) & (LWM_SERVICE_REGISTRY_HASH_SIZE - 1);
     }
-    return NULL;
 }
 
 static struct lwm_microservice_registry_entry_t *
@@ -199,10 +852,9 @@ lwm_microservice_registry_find_or_alloc(
         lwm_microservice_registry_find(registry, msgid);
     if (entry == NULL)
     {
-        entry = lwm_microservice_registry_alloc(registry);
+        entry = lwm_microservice_registry_alloc(registry, msgid);
         if (entry != NULL)
         {
-            entry->msgid = msgid;
             lwm_service_list_init(&entry->list);
             lwm_service_list_init(&entry->pending);
         }
@@ -210,68 +862,346 @@ lwm_microservice_registry_find_or_alloc(
     return entry;
 }
 
-static void
+static struct lwm_subscription_t **
+lwm_microservice_registry_member(
+        struct lwm_microservice_registry_t * registry,
+        uint32_t msgid,
+        const struct lwm_microservice_t * service)
+{
+    /* the link to the (msgid, service) subscription, or to the NULL that
+     * ends its chain */
+    uint32_t key = msgid ^ (uint32_t)((uintptr_t)service >> 4);
+    struct lwm_subscription_t ** link = &registry->members[
+        (key * 2654435769u) >> (32 - LWM_SUBSCRIPTION_HASH_BITS)];
+    while (*link != NULL
+           && ((*link)->service != service || (*link)->entry->msgid != msgid))
+    {
+        link = &(*link)->hash_next;
+    }
+    return link;
+}
+
+static enum lwm_error_t
 lwm_microservice_registry_add(
         struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_pool_t * pool,
         uint32_t msgid,
+        uint32_t index,
         struct lwm_microservice_t * service)
 {
+    struct lwm_subscription_t ** member =
+        lwm_microservice_registry_member(registry, msgid, service);
+    if (*member != NULL)
+    {
+        /* already subscribed */
+        return LWM_OK;
+    }
+
     struct lwm_microservice_registry_entry_t * entry =
         lwm_microservice_registry_find_or_alloc(registry, msgid);
-    ASSERT(service->next == NULL);
-    ASSERT(service->prev == NULL);
+    if (entry == NULL)
+    {
+        return LWM_ERR_NO_MEM;
+    }
+
+    struct lwm_change_t * change = NULL;
+    if (service->on_change)
+    {
+        change = lwm_microservice_registry_change_alloc(registry);
+        if (change == NULL)
+        {
+            return LWM_ERR_NO_MEM;
+        }
+    }
+    struct lwm_subscription_t * sub = lwm_subscription_pool_alloc(pool);
+    if (sub == NULL)
+    {
+        lwm_microservice_registry_change_free(registry, change);
+        return LWM_ERR_NO_MEM;
+    }
+    sub->service = service;
+    sub->entry = entry;
+    sub->change = change;
+    sub->index = index;
+    sub->priority = service->priority;
+    sub->decimation = service->decimation;
+    sub->interval_us = service->interval_us;
+    sub->is_pending = true;
+    lwm_service_push_tail(&entry->pending, sub);
+    *member = sub;
+
+    sub->sibling = service->subscriptions;
+    service->subscriptions = sub;
+    return LWM_OK;
+}
+
+static enum lwm_error_t
+lwm_microservice_registry_add_filter(
+        struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_pool_t * pool,
+        const struct lwm_filter_t * filter,
+        uint32_t index,
+        struct lwm_microservice_t * service)
+{
+    if (registry->filter_free == NULL)
+    {
+        WARN("Filter table is full\n");
+        return LWM_ERR_NO_MEM;
+    }
+    struct lwm_change_t * change = NULL;
+    if (service->on_change)
+    {
+        change = lwm_microservice_registry_change_alloc(registry);
+        if (change == NULL)
+        {
+            return LWM_ERR_NO_MEM;
+        }
+    }
+    struct lwm_subscription_t * sub = lwm_subscription_pool_alloc(pool);
+    if (sub == NULL)
+    {
+        lwm_microservice_registry_change_free(registry, change);
+        return LWM_ERR_NO_MEM;
+    }
 
-    if (entry != NULL &&
-        !lwm_service_on_list(&entry->list, service) &&
-        !lwm_service_on_list(&entry->pending, service))
+    struct lwm_filter_t * copy = registry->filter_free;
+    registry->filter_free = copy->next_free;
+    *copy = *filter;
+    copy->next_free = NULL;
+
+    sub->service = service;
+    sub->entry = &registry->filtered;
+    sub->filter = copy;
+    sub->change = change;
+    sub->index = index;
+    sub->priority = service->priority;
+    sub->decimation = service->decimation;
+    sub->interval_us = service->interval_us;
+    sub->is_pending = true;
+    lwm_service_push_tail(&registry->filtered.pending, sub);
+
+    sub->sibling = service->subscriptions;
+    service->subscriptions = sub;
+    return LWM_OK;
+}
+
+static void
+lwm_microservice_registry_unlink(
+        struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_t * sub)
+{
+    struct lwm_microservice_registry_entry_t * entry = sub->entry;
+    lwm_service_remove(sub->is_pending ? &entry->pending : &entry->list, sub);
+    if (sub->filter == NULL)
+    {
+        struct lwm_subscription_t ** member = lwm_microservice_registry_member(
+            registry, entry->msgid, sub->service);
+        *member = sub->hash_next;
+    }
+    else
+    {
+        sub->filter->next_free = registry->filter_free;
+        registry->filter_free = sub->filter;
+        sub->filter = NULL;
+    }
+    lwm_microservice_registry_change_free(registry, sub->change);
+    sub->change = NULL;
+}
+
+static void
+lwm_microservice_registry_free(
+        struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_pool_t * pool,
+        struct lwm_subscription_t * sub)
+{
+    if (registry->dispatching > 0)
     {
-        lwm_service_push_tail(&entry->pending, service);
+        /* a handler removed it: the dispatch may have it or the one before
+         * it in hand, it stays out of the pool until the dispatch returns */
+        sub->generation++;
+        sub->service = NULL;
+        sub->next_free = registry->retired;
+        registry->retired = sub;
+        return;
     }
+    lwm_subscription_pool_free(pool, sub);
 }
 
 static void
 lwm_microservice_registry_remove(
         struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_pool_t * pool,
         uint32_t msgid,
         struct lwm_microservice_t * service)
 {
-    struct lwm_microservice_registry_entry_t * entry =
-        lwm_microservice_registry_find(registry, msgid);
-    if (entry != NULL && lwm_service_on_list(&entry->list, service))
+    struct lwm_subscription_t ** link = &service->subscriptions;
+    while (*link != NULL)
     {
-        lwm_service_remove(&entry->list, service);
-    }
-    else if (entry != NULL && lwm_service_on_list(&entry->pending, service))
-    {
-        lwm_service_remove(&entry->pending, service);
+        struct lwm_subscription_t * sub = *link;
+        if (sub->filter == NULL && sub->entry->msgid == msgid)
+        {
+            *link = sub->sibling;
+            lwm_microservice_registry_unlink(registry, sub);
+            lwm_microservice_registry_free(registry, pool, sub);
+            return;
+        }
+        link = &sub->sibling;
     }
 }
 
-static void lwm_microservice_registry_remove_all(
+static void
+lwm_microservice_registry_remove_filters(
         struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_pool_t * pool,
         struct lwm_microservice_t * service)
 {
-    for (uint32_t i = 0; i < MAX_LWM_SERVICE_REGISTRY; i++)
+    struct lwm_subscription_t ** link = &service->subscriptions;
+    while (*link != NULL)
     {
-        struct lwm_microservice_registry_entry_t * entry = &registry->entries[i];
-        if (entry->is_active && lwm_service_on_list(&entry->list, service))
+        struct lwm_subscription_t * sub = *link;
+        if (sub->filter != NULL)
         {
-            lwm_service_remove(&entry->list, service);
-            break;
+            *link = sub->sibling;
+            lwm_microservice_registry_unlink(registry, sub);
+            lwm_microservice_registry_free(registry, pool, sub);
         }
-        else if(entry->is_active && lwm_service_on_list(&entry->pending, service))
+        else
         {
-            lwm_service_remove(&entry->pending, service);
-            break;
+            link = &sub->sibling;
         }
     }
 }
 
+static void lwm_microservice_registry_remove_all(
+        struct lwm_microservice_registry_t * registry,
+        struct lwm_subscription_pool_t * pool,
+        struct lwm_microservice_t * service)
+{
+    struct lwm_subscription_t * sub = service->subscriptions;
+    while (sub != NULL)
+    {
+        struct lwm_subscription_t * sibling = sub->sibling;
+        lwm_microservice_registry_unlink(registry, sub);
+        lwm_microservice_registry_free(registry, pool, sub);
+        sub = sibling;
+    }
+    service->subscriptions = NULL;
+}
+
 void
 lwm_microservice_init(struct lwm_vehicle_t * vehicle)
 {
     lwm_microservice_registry_init(&vehicle->registry);
     lwm_service_pool_init(&vehicle->service_pool);
+    lwm_subscription_pool_init(&vehicle->subscription_pool);
+    vehicle->deferred.is_enabled = false;
+    vehicle->deferred.is_held = false;
+    vehicle->deferred.priority = LWM_PRIORITY_LOW;
+    vehicle->deferred.n = 0;
+    vehicle->deferred.overflow = 0;
+}
+
+void
+lwm_microservice_fini(struct lwm_vehicle_t * vehicle)
+{
+    lwm_service_pool_fini(&vehicle->service_pool);
+    lwm_subscription_pool_fini(&vehicle->subscription_pool);
+}
+
+void
+lwm_microservice_pool_growth(struct lwm_vehicle_t * vehicle, bool enable)
+{
+#if !defined(LWM_SERVICE_POOL_CAN_GROW)
+    if (enable)
+    {
+        WARN("Service pool growth is not supported on this target\n");
+    }
+#endif
+    vehicle->service_pool.grow = enable;
+    vehicle->subscription_pool.grow = enable;
+}
+
+void
+lwm_microservice_stats(
+        struct lwm_vehicle_t * vehicle,
+        struct lwm_microservice_stats_t * stats)
+{
+    struct lwm_service_pool_t * services = &vehicle->service_pool;
+    struct lwm_subscription_pool_t * subs = &vehicle->subscription_pool;
+
+    stats->services = services->n;
+    stats->services_capacity = services->capacity;
+    stats->services_high_water = services->high_water;
+    stats->services_failed = services->failed;
+    stats->subscriptions = subs->n;
+    stats->subscriptions_capacity = subs->capacity;
+    stats->subscriptions_high_water = subs->high_water;
+    stats->subscriptions_failed = subs->failed;
+    stats->deferred_overflow = vehicle->deferred.overflow;
+}
+
+static void
+lwm_microservice_activate_pending(
+        struct lwm_microservice_registry_entry_t * entry)
+{
+    /* Using a pending list avoids reading messages that are currently
+     * being processed. */
+    struct lwm_subscription_t * pending;
+    while ((pending = lwm_service_head(&entry->pending)) != NULL)
+    {
+        lwm_service_remove(&entry->pending, pending);
+        pending->is_pending = false;
+        lwm_service_insert_sorted(&entry->list, pending);
+    }
+}
+
+static void
+lwm_microservice_dispatch(
+        struct lwm_vehicle_t * vehicle,
+        struct lwm_microservice_registry_entry_t * entry,
+        mavlink_message_t * msg)
+{
+    struct lwm_decoded_t decoded;
+    struct lwm_delivery_t delivery;
+    decoded.is_valid = false;
+    delivery.msg = msg;
+    delivery.subscription = NULL;
+    delivery.index = 0;
+    delivery.skipped = 0;
+    delivery.time_us = 0;
+    delivery.decoded = &decoded;
+
+    if (vehicle->telemetry != NULL)
+    {
+        /* stored before the handlers run, they can read it back */
+        delivery.time_us = time_us();
+        lwm_telemetry_update(vehicle->telemetry, msg, delivery.time_us);
+    }
+    if (msg->sysid == vehicle->sysid && msg->compid == vehicle->compid)
+    {
+        lwm_vehicle_state_update(&vehicle->state, &delivery);
+        if (vehicle->waiters != NULL && vehicle->state.reported != 0)
+        {
+            lwm_waiter_notify(
+                vehicle, vehicle->state.reported, delivery.time_us);
+        }
+    }
+
+    struct lwm_microservice_registry_t * registry = &vehicle->registry;
+    /* messages nobody asked for by msgid still reach the filters */
+    registry->dispatching++;
+    lwm_service_foreach(entry != NULL ? &entry->list : NULL,
+        &registry->filtered.list, vehicle, &delivery);
+
+    if (--registry->dispatching == 0)
+    {
+        while (registry->retired != NULL)
+        {
+            struct lwm_subscription_t * sub = registry->retired;
+            registry->retired = sub->next_free;
+            lwm_subscription_pool_free(&vehicle->subscription_pool, sub);
+        }
+    }
 }
 
 void
@@ -279,28 +1209,82 @@ lwm_microservice_process(
         struct lwm_vehicle_t * vehicle,
         mavlink_message_t * msg)
 {
+    struct lwm_microservice_registry_t * registry = &vehicle->registry;
     struct lwm_microservice_registry_entry_t * entry =
-        lwm_microservice_registry_find(&vehicle->registry, msg->msgid);
+        lwm_microservice_registry_find(registry, msg->msgid);
     if (entry != NULL)
     {
-        /* Using a pending list avoids reading messages that are currently
-         * being processed. */
-        struct lwm_microservice_t * pending_list = lwm_service_head(&entry->pending);
-        if(pending_list != NULL)
+        lwm_microservice_activate_pending(entry);
+    }
+    lwm_microservice_activate_pending(&registry->filtered);
+    lwm_microservice_dispatch(vehicle, entry, msg);
+}
+
+void
+lwm_microservice_process_batch(
+        struct lwm_vehicle_t * vehicle,
+        mavlink_message_t * msgs,
+        const uint8_t * order,
+        size_t n)
+{
+    struct lwm_microservice_registry_t * registry = &vehicle->registry;
+    size_t i = 0;
+    while (i < n)
+    {
+        /* one lookup for the whole run of the same msgid */
+        uint32_t msgid = msgs[order[i]].msgid;
+        struct lwm_microservice_registry_entry_t * entry =
+            lwm_microservice_registry_find(registry, msgid);
+        if (entry != NULL)
         {
-            /* linked list concat */
-            lwm_service_push_tail(&entry->list, pending_list);
-            lwm_service_list_init(&entry->pending);
+            lwm_microservice_activate_pending(entry);
         }
+        lwm_microservice_activate_pending(&registry->filtered);
 
+        for (; i < n && msgs[order[i]].msgid == msgid; i++)
+        {
+            lwm_microservice_dispatch(vehicle, entry, &msgs[order[i]]);
+        }
+    }
+}
 
-        lwm_service_foreach(&entry->list, msg);
+void
+lwm_microservice_defer(
+        struct lwm_vehicle_t * vehicle,
+        bool enable,
+        uint8_t priority)
+{
+    if (!enable)
+    {
+        lwm_microservice_flush_deferred(vehicle);
     }
-    else
+    vehicle->deferred.is_enabled = enable;
+    vehicle->deferred.priority = priority;
+}
+
+void
+lwm_microservice_flush_deferred(struct lwm_vehicle_t * vehicle)
+{
+    struct lwm_deferred_queue_t * queue = &vehicle->deferred;
+    for (uint32_t i = 0; i < queue->n; i++)
     {
-        //TODO handle unknown message with service
-        //WARN("Unknown message id: %d\n", (int)msg->msgid);
+        struct lwm_deferred_t * item = &queue->items[i];
+        struct lwm_subscription_t * sub = item->subscription;
+        if (sub->generation != item->generation)
+        {
+            /* unsubscribed since it was deferred */
+            continue;
+        }
+
+        struct lwm_decoded_t decoded;
+        struct lwm_delivery_t delivery;
+        decoded.is_valid = false;
+        delivery.msg = &item->msg;
+        delivery.time_us = 0;
+        delivery.decoded = &decoded;
+        lwm_subscription_deliver(vehicle->workers, sub, &delivery);
     }
+    queue->n = 0;
 }
 
 enum lwm_error_t
@@ -308,23 +1292,84 @@ lwm_microservice_add_to(
         struct lwm_vehicle_t * vehicle,
         uint32_t msgid,
         struct lwm_microservice_t * service)
+{
+    return lwm_microservice_add_indexed(vehicle, msgid, 0, service);
+}
+
+enum lwm_error_t
+lwm_microservice_add_indexed(
+        struct lwm_vehicle_t * vehicle,
+        uint32_t msgid,
+        uint32_t index,
+        struct lwm_microservice_t * service)
+{
+    ASSERT(service != NULL);
+    ASSERT(service->handler != NULL || service->deliver != NULL);
+
+    return lwm_microservice_registry_add(
+        &vehicle->registry, &vehicle->subscription_pool, msgid, index, service);
+}
+
+enum lwm_error_t
+lwm_microservice_add_set(
+        struct lwm_vehicle_t * vehicle,
+        const uint32_t * msgids,
+        size_t n,
+        struct lwm_microservice_t * service)
 {
     ASSERT(service != NULL);
-    ASSERT(service->handler != NULL);
-    ASSERT(service->next == NULL); /* cannot be in two lists */
-    ASSERT(service->prev == NULL); /* cannot be in two lists */
+    ASSERT(msgids != NULL || n == 0);
+    ASSERT(service->handler != NULL || service->deliver != NULL);
 
-    lwm_microservice_registry_add(&vehicle->registry, msgid, service);
+    for (size_t i = 0; i < n; i++)
+    {
+        /* a msgid repeated in the set keeps its first index */
+        enum lwm_error_t err
+            = lwm_microservice_add_indexed(vehicle, msgids[i], i, service);
+        if (err != LWM_OK)
+        {
+            return err;
+        }
+    }
     return LWM_OK;
 }
 
+enum lwm_error_t
+lwm_microservice_add_filter(
+        struct lwm_vehicle_t * vehicle,
+        const struct lwm_filter_t * filter,
+        uint32_t index,
+        struct lwm_microservice_t * service)
+{
+    ASSERT(filter != NULL);
+    ASSERT(service != NULL);
+    ASSERT(service->handler != NULL || service->deliver != NULL);
+
+    return lwm_microservice_registry_add_filter(&vehicle->registry,
+        &vehicle->subscription_pool, filter, index, service);
+}
+
+void
+lwm_microservice_remove_filters(
+        struct lwm_vehicle_t * vehicle,
+        struct lwm_microservice_t * service)
+{
+    ASSERT(service != NULL);
+
+    lwm_microservice_registry_remove_filters(
+        &vehicle->registry, &vehicle->subscription_pool, service);
+}
+
 enum lwm_error_t
 lwm_microservice_remove_from(
         struct lwm_vehicle_t * vehicle,
         uint32_t msgid,
         struct lwm_microservice_t * service)
 {
-    lwm_microservice_registry_remove(&vehicle->registry, msgid, service);
+    ASSERT(service != NULL);
+
+    lwm_microservice_registry_remove(
+        &vehicle->registry, &vehicle->subscription_pool, msgid, service);
     return LWM_OK;
 }
 
@@ -338,7 +1383,8 @@ void lwm_microservice_destroy(struct lwm_vehicle_t * vehicle, struct lwm_microse
 {
     if(service != NULL)
     {
-        lwm_microservice_registry_remove_all(&vehicle->registry, service);
+        lwm_microservice_registry_remove_all(
+            &vehicle->registry, &vehicle->subscription_pool, service);
         lwm_service_pool_free(&vehicle->service_pool, service);
     }
 }
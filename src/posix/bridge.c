@@ -0,0 +1,645 @@
+/* field names and types of every message, for the json serializer */
+#define MAVLINK_USE_MESSAGE_INFO
+#include "lwmavsdk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * Local telemetry bridge: a unix socket server fed by a filter
+ * subscription. Each message is serialized at most once per format into
+ * the bridge buffers and written to every client without blocking; a client
+ * too slow to keep up loses messages, not the dispatcher's time.
+ */
+
+struct lwm_bridge_writer_t
+{
+    char*  buf;
+    size_t size;
+    size_t len;
+    bool   overflow;
+};
+
+static void
+lwm_bridge_printf(struct lwm_bridge_writer_t* w, const char* fmt, ...)
+{
+    if (w->overflow)
+    {
+        return;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(&w->buf[w->len], w->size - w->len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= w->size - w->len)
+    {
+        w->overflow = true;
+        return;
+    }
+    w->len += n;
+}
+
+static void
+lwm_bridge_putc(struct lwm_bridge_writer_t* w, char c)
+{
+    if (w->overflow || w->len + 1 >= w->size)
+    {
+        w->overflow = true;
+        return;
+    }
+    w->buf[w->len++] = c;
+}
+
+static void
+lwm_bridge_string(struct lwm_bridge_writer_t* w, const char* s, size_t n)
+{
+    lwm_bridge_putc(w, '"');
+    for (size_t i = 0; i < n && s[i] != '\0'; i++)
+    {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            lwm_bridge_putc(w, '\\');
+            lwm_bridge_putc(w, c);
+        }
+        else if (c < 0x20 || c >= 0x7f)
+        {
+            lwm_bridge_printf(w, "\\u%04x", c);
+        }
+        else
+        {
+            lwm_bridge_putc(w, c);
+        }
+    }
+    lwm_bridge_putc(w, '"');
+}
+
+static void
+lwm_bridge_real(struct lwm_bridge_writer_t* w, double v, const char* fmt)
+{
+    if (isfinite(v))
+    {
+        lwm_bridge_printf(w, fmt, v);
+    }
+    else
+    {
+        lwm_bridge_printf(w, "null");
+    }
+}
+
+/* payloads are little endian on the wire, as is every supported target */
+static void
+lwm_bridge_value(struct lwm_bridge_writer_t* w, mavlink_message_type_t type,
+    const uint8_t* p)
+{
+    switch (type)
+    {
+    case MAVLINK_TYPE_CHAR:
+    case MAVLINK_TYPE_UINT8_T:
+        lwm_bridge_printf(w, "%u", *p);
+        break;
+    case MAVLINK_TYPE_INT8_T:
+        lwm_bridge_printf(w, "%d", (int8_t)*p);
+        break;
+    case MAVLINK_TYPE_UINT16_T:
+    {
+        uint16_t v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_printf(w, "%u", v);
+        break;
+    }
+    case MAVLINK_TYPE_INT16_T:
+    {
+        int16_t v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_printf(w, "%d", v);
+        break;
+    }
+    case MAVLINK_TYPE_UINT32_T:
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_printf(w, "%" PRIu32, v);
+        break;
+    }
+    case MAVLINK_TYPE_INT32_T:
+    {
+        int32_t v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_printf(w, "%" PRId32, v);
+        break;
+    }
+    case MAVLINK_TYPE_UINT64_T:
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_printf(w, "%" PRIu64, v);
+        break;
+    }
+    case MAVLINK_TYPE_INT64_T:
+    {
+        int64_t v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_printf(w, "%" PRId64, v);
+        break;
+    }
+    case MAVLINK_TYPE_FLOAT:
+    {
+        float v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_real(w, v, "%.9g");
+        break;
+    }
+    case MAVLINK_TYPE_DOUBLE:
+    {
+        double v;
+        memcpy(&v, p, sizeof(v));
+        lwm_bridge_real(w, v, "%.17g");
+        break;
+    }
+    default:
+        lwm_bridge_printf(w, "null");
+    }
+}
+
+static size_t
+lwm_bridge_type_size(mavlink_message_type_t type)
+{
+    switch (type)
+    {
+    case MAVLINK_TYPE_UINT16_T:
+    case MAVLINK_TYPE_INT16_T:
+        return 2;
+    case MAVLINK_TYPE_UINT32_T:
+    case MAVLINK_TYPE_INT32_T:
+    case MAVLINK_TYPE_FLOAT:
+        return 4;
+    case MAVLINK_TYPE_UINT64_T:
+    case MAVLINK_TYPE_INT64_T:
+    case MAVLINK_TYPE_DOUBLE:
+        return 8;
+    default:
+        return 1;
+    }
+}
+
+static uint64_t
+lwm_bridge_time(struct lwm_delivery_t* delivery)
+{
+    if (delivery->time_us == 0)
+    {
+        delivery->time_us = time_us();
+    }
+    return delivery->time_us;
+}
+
+static uint32_t
+lwm_bridge_payload_len(const mavlink_message_t* msg)
+{
+    const mavlink_msg_entry_t* entry = mavlink_get_msg_entry(msg->msgid);
+    return entry != NULL ? entry->max_msg_len : msg->len;
+}
+
+size_t
+lwm_bridge_serialize_json(
+    struct lwm_delivery_t* delivery, char* buf, size_t size)
+{
+    ASSERT(delivery != NULL);
+    ASSERT(buf != NULL);
+
+    const mavlink_message_t*      msg  = delivery->msg;
+    const mavlink_message_info_t* info = mavlink_get_message_info(msg);
+    const uint8_t*                payload = lwm_delivery_decode(delivery);
+    struct lwm_bridge_writer_t    w = { buf, size, 0, false };
+
+    lwm_bridge_printf(&w,
+        "{\"msgid\":%" PRIu32 ",\"sysid\":%u,\"compid\":%u,\"time_us\":%" PRIu64,
+        (uint32_t)msg->msgid, msg->sysid, msg->compid,
+        lwm_bridge_time(delivery));
+    if (info == NULL)
+    {
+        /* not in our dialect, pass the raw payload on */
+        lwm_bridge_printf(&w, ",\"payload\":\"");
+        for (uint32_t i = 0; i < msg->len; i++)
+        {
+            lwm_bridge_printf(&w, "%02x", payload[i]);
+        }
+        lwm_bridge_printf(&w, "\"}\n");
+        return w.overflow ? 0 : w.len;
+    }
+
+    lwm_bridge_printf(&w, ",\"name\":\"%s\",\"fields\":{", info->name);
+    for (unsigned i = 0; i < info->num_fields; i++)
+    {
+        const mavlink_field_info_t* field = &info->fields[i];
+        const uint8_t*              p     = &payload[field->wire_offset];
+
+        lwm_bridge_printf(&w, "%s\"%s\":", i == 0 ? "" : ",", field->name);
+        if (field->type == MAVLINK_TYPE_CHAR && field->array_length > 0)
+        {
+            lwm_bridge_string(&w, (const char*)p, field->array_length);
+        }
+        else if (field->array_length > 0)
+        {
+            size_t step = lwm_bridge_type_size(field->type);
+            lwm_bridge_putc(&w, '[');
+            for (unsigned j = 0; j < field->array_length; j++)
+            {
+                if (j > 0)
+                {
+                    lwm_bridge_putc(&w, ',');
+                }
+                lwm_bridge_value(&w, field->type, &p[j * step]);
+            }
+            lwm_bridge_putc(&w, ']');
+        }
+        else
+        {
+            lwm_bridge_value(&w, field->type, p);
+        }
+    }
+    lwm_bridge_printf(&w, "}}\n");
+    return w.overflow ? 0 : w.len;
+}
+
+size_t
+lwm_bridge_serialize_binary(
+    struct lwm_delivery_t* delivery, uint8_t* buf, size_t size)
+{
+    ASSERT(delivery != NULL);
+    ASSERT(buf != NULL);
+
+    const mavlink_message_t*   msg = delivery->msg;
+    struct lwm_bridge_header_t header;
+    uint32_t                   len = lwm_bridge_payload_len(msg);
+
+    if (sizeof(header) + len > size)
+    {
+        return 0;
+    }
+    header.msgid   = msg->msgid;
+    header.sysid   = msg->sysid;
+    header.compid  = msg->compid;
+    header.len     = len;
+    header.time_us = lwm_bridge_time(delivery);
+    memcpy(buf, &header, sizeof(header));
+    memcpy(&buf[sizeof(header)], lwm_delivery_decode(delivery), len);
+    return sizeof(header) + len;
+}
+
+static void
+lwm_bridge_client_close(struct lwm_bridge_client_t* client)
+{
+    close(client->fd);
+    client->fd = -1;
+}
+
+static void
+lwm_bridge_client_reset(struct lwm_bridge_client_t* client)
+{
+    for (int i = 0; i < MAX_LWM_BRIDGE_RATE; i++)
+    {
+        client->rates[i].msgid   = UINT32_MAX;
+        client->rates[i].next_us = 0;
+    }
+}
+
+static bool
+lwm_bridge_client_admit(
+    struct lwm_bridge_client_t* client, uint32_t msgid, uint64_t now)
+{
+    if (client->interval_us == 0)
+    {
+        return true;
+    }
+
+    struct lwm_bridge_rate_t* free = NULL;
+    for (int i = 0; i < MAX_LWM_BRIDGE_RATE; i++)
+    {
+        struct lwm_bridge_rate_t* rate = &client->rates[i];
+        if (rate->msgid == msgid)
+        {
+            if (now < rate->next_us)
+            {
+                return false;
+            }
+            rate->next_us = now + client->interval_us;
+            return true;
+        }
+        if (rate->msgid == UINT32_MAX && free == NULL)
+        {
+            free = rate;
+        }
+    }
+    if (free == NULL)
+    {
+        /* cannot hold the limit for one more msgid, send it unlimited */
+        if (client->unlimited++ == 0)
+        {
+            WARN("lwm_bridge: rate table full, msgid %u not limited\n",
+                msgid);
+        }
+        return true;
+    }
+    free->msgid   = msgid;
+    free->next_us = now + client->interval_us;
+    return true;
+}
+
+static void
+lwm_bridge_client_send(
+    struct lwm_bridge_client_t* client, const void* buf, size_t len)
+{
+    ssize_t n = send(client->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n == (ssize_t)len)
+    {
+        return;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        client->dropped++;
+        return;
+    }
+    if (n >= 0)
+    {
+        /* a torn record would desync the stream, the client reconnects */
+        WARN("lwm_bridge: client fell behind, closing\n");
+    }
+    lwm_bridge_client_close(client);
+}
+
+static void
+lwm_bridge_deliver(void* context, struct lwm_delivery_t* delivery)
+{
+    struct lwm_bridge_t* bridge = context;
+    uint64_t             now    = lwm_bridge_time(delivery);
+    size_t               json_len   = 0;
+    size_t               binary_len = 0;
+    bool                 has_json   = false;
+    bool                 has_binary = false;
+
+    for (int i = 0; i < MAX_LWM_BRIDGE_CLIENT; i++)
+    {
+        struct lwm_bridge_client_t* client = &bridge->clients[i];
+        if (client->fd < 0
+            || !lwm_bridge_client_admit(client, delivery->msg->msgid, now))
+        {
+            continue;
+        }
+
+        const void* buf;
+        size_t      len;
+        if (client->format == LWM_BRIDGE_BINARY)
+        {
+            if (!has_binary)
+            {
+                binary_len = lwm_bridge_serialize_binary(
+                    delivery, bridge->binary, sizeof(bridge->binary));
+                has_binary = true;
+            }
+            buf = bridge->binary;
+            len = binary_len;
+        }
+        else
+        {
+            if (!has_json)
+            {
+                json_len = lwm_bridge_serialize_json(
+                    delivery, bridge->json, sizeof(bridge->json));
+                has_json = true;
+            }
+            buf = bridge->json;
+            len = json_len;
+        }
+
+        if (len == 0)
+        {
+            client->dropped++;
+            continue;
+        }
+        lwm_bridge_client_send(client, buf, len);
+    }
+}
+
+static void
+lwm_bridge_client_configure(struct lwm_bridge_client_t* client)
+{
+    const char* line = client->config;
+    char*       end;
+
+    if (strncmp(line, "json", 4) == 0)
+    {
+        client->format = LWM_BRIDGE_JSON;
+        line += 4;
+    }
+    else if (strncmp(line, "binary", 6) == 0)
+    {
+        client->format = LWM_BRIDGE_BINARY;
+        line += 6;
+    }
+    else
+    {
+        WARN("lwm_bridge: bad client config \"%s\"\n", client->config);
+        return;
+    }
+
+    unsigned long interval = strtoul(line, &end, 10);
+    client->interval_us    = end != line ? (uint32_t)interval : 0;
+    lwm_bridge_client_reset(client);
+}
+
+static void
+lwm_bridge_client_read(struct lwm_bridge_client_t* client)
+{
+    char buf[64];
+    for (;;)
+    {
+        ssize_t n = recv(client->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == 0)
+        {
+            lwm_bridge_client_close(client);
+            return;
+        }
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                lwm_bridge_client_close(client);
+            }
+            return;
+        }
+
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (buf[i] == '\n')
+            {
+                client->config[client->config_len] = '\0';
+                lwm_bridge_client_configure(client);
+                client->config_len = 0;
+            }
+            else if (client->config_len + 1 < LWM_BRIDGE_CONFIG_LEN)
+            {
+                client->config[client->config_len++] = buf[i];
+            }
+        }
+    }
+}
+
+static void
+lwm_bridge_accept(struct lwm_bridge_t* bridge)
+{
+    for (;;)
+    {
+        int fd = accept(bridge->fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                WARN("lwm_bridge_poll: unable to accept, err %s\n",
+                    strerror(errno));
+            }
+            return;
+        }
+
+        struct lwm_bridge_client_t* client = NULL;
+        for (int i = 0; i < MAX_LWM_BRIDGE_CLIENT; i++)
+        {
+            if (bridge->clients[i].fd < 0)
+            {
+                client = &bridge->clients[i];
+                break;
+            }
+        }
+        if (client == NULL)
+        {
+            WARN("lwm_bridge_poll: too many clients\n");
+            close(fd);
+            continue;
+        }
+
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        memset(client, 0, sizeof(struct lwm_bridge_client_t));
+        client->fd     = fd;
+        client->format = LWM_BRIDGE_JSON;
+        lwm_bridge_client_reset(client);
+    }
+}
+
+enum lwm_error_t
+lwm_bridge_open(struct lwm_bridge_t* bridge, struct lwm_vehicle_t* vehicle,
+    const char* path, const struct lwm_filter_t* filter)
+{
+    ASSERT(bridge != NULL);
+    ASSERT(vehicle != NULL);
+    ASSERT(path != NULL);
+    ASSERT(filter != NULL);
+
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return LWM_ERR_BAD_PARAM;
+    }
+
+    memset(bridge, 0, sizeof(struct lwm_bridge_t));
+    bridge->vehicle = vehicle;
+    strcpy(bridge->path, path);
+    for (int i = 0; i < MAX_LWM_BRIDGE_CLIENT; i++)
+    {
+        bridge->clients[i].fd = -1;
+    }
+
+    bridge->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (bridge->fd < 0)
+    {
+        WARN("lwm_bridge_open: unable to create socket, err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    /* a socket left behind by a previous run, anything else makes bind
+     * fail below */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+    if (bind(bridge->fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+        || listen(bridge->fd, MAX_LWM_BRIDGE_CLIENT) < 0)
+    {
+        WARN("lwm_bridge_open: unable to listen on %s, err %s\n", path,
+            strerror(errno));
+        close(bridge->fd);
+        bridge->fd = -1;
+        return LWM_ERR_IO;
+    }
+
+    bridge->service = lwm_microservice_create(vehicle);
+    if (bridge->service == NULL)
+    {
+        lwm_bridge_close(bridge);
+        return LWM_ERR_NO_MEM;
+    }
+    bridge->service->context  = bridge;
+    bridge->service->deliver  = lwm_bridge_deliver;
+    bridge->service->priority = LWM_PRIORITY_LOW;
+
+    enum lwm_error_t err
+        = lwm_microservice_add_filter(vehicle, filter, 0, bridge->service);
+    if (err != LWM_OK)
+    {
+        lwm_bridge_close(bridge);
+        return err;
+    }
+    return LWM_OK;
+}
+
+void
+lwm_bridge_poll(struct lwm_bridge_t* bridge)
+{
+    ASSERT(bridge != NULL);
+
+    lwm_bridge_accept(bridge);
+    for (int i = 0; i < MAX_LWM_BRIDGE_CLIENT; i++)
+    {
+        if (bridge->clients[i].fd >= 0)
+        {
+            lwm_bridge_client_read(&bridge->clients[i]);
+        }
+    }
+}
+
+void
+lwm_bridge_close(struct lwm_bridge_t* bridge)
+{
+    ASSERT(bridge != NULL);
+
+    if (bridge->service != NULL)
+    {
+        lwm_microservice_destroy(bridge->vehicle, bridge->service);
+        bridge->service = NULL;
+    }
+    for (int i = 0; i < MAX_LWM_BRIDGE_CLIENT; i++)
+    {
+        if (bridge->clients[i].fd >= 0)
+        {
+            lwm_bridge_client_close(&bridge->clients[i]);
+        }
+    }
+    if (bridge->fd >= 0)
+    {
+        close(bridge->fd);
+        bridge->fd = -1;
+        unlink(bridge->path);
+    }
+}
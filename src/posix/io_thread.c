@@ -0,0 +1,243 @@
+#include "lwmavsdk.h"
+
+#include <errno.h>
+
+/*
+ * A dedicated thread reads the connection and parses straight into a
+ * single-producer single-consumer ring of frames. The spinning thread takes
+ * frames off the ring at its own pace, the socket keeps being drained
+ * meanwhile. Sending stays on the spinning thread. Besides the descriptor,
+ * the two share the signing timestamp and the peer a udp backend learns
+ * from each datagram; both are published atomically.
+ */
+
+#define LWM_FRAME_RING_MASK (LWM_FRAME_RING_SIZE - 1)
+
+static void
+lwm_io_thread_wake(struct lwm_io_thread_t* io)
+{
+    pthread_mutex_lock(&io->lock);
+    pthread_cond_signal(&io->wake);
+    pthread_mutex_unlock(&io->lock);
+}
+
+static enum lwm_error_t
+lwm_io_thread_read(struct lwm_io_thread_t* io)
+{
+    struct lwm_frame_ring_t* ring = &io->ring;
+    uint32_t                 tail = ring->tail;
+    uint32_t used = tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    /* parse in place, into the free slots up to the end of the array */
+    mavlink_message_t* dst  = io->spill;
+    size_t             room = MAX_LWM_BATCH;
+    if (used < LWM_FRAME_RING_SIZE)
+    {
+        dst  = &ring->slots[tail & LWM_FRAME_RING_MASK];
+        room = LWM_FRAME_RING_SIZE - used;
+        if (room > LWM_FRAME_RING_SIZE - (tail & LWM_FRAME_RING_MASK))
+        {
+            room = LWM_FRAME_RING_SIZE - (tail & LWM_FRAME_RING_MASK);
+        }
+    }
+
+    /* only the blocking read can be cancelled by lwm_io_thread_stop */
+    size_t n;
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    enum lwm_error_t err
+        = lwm_conn_recv_batch(&io->vehicle->conn, dst, room, &n);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    if (err == LWM_ERR_NO_DATA)
+    {
+        return LWM_OK;
+    }
+    if (err != LWM_OK)
+    {
+        return err;
+    }
+    uint64_t read_us = time_us();
+
+    /* counters are read from other threads by lwm_io_thread_stats */
+    __atomic_store_n(&ring->frames, ring->frames + n, __ATOMIC_RELAXED);
+    if (dst == io->spill)
+    {
+        /* the ring was full when the read started, the spinning thread
+         * may have made room while it blocked */
+        size_t kept = 0;
+        used = tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (; kept < n && used + kept < LWM_FRAME_RING_SIZE; kept++)
+        {
+            memcpy(&ring->slots[(tail + kept) & LWM_FRAME_RING_MASK],
+                &io->spill[kept], sizeof(mavlink_message_t));
+        }
+        __atomic_store_n(
+            &ring->overflow, ring->overflow + (n - kept), __ATOMIC_RELAXED);
+        if (kept == 0)
+        {
+            return LWM_OK;
+        }
+        n = kept;
+    }
+    if (used + n > ring->high_water)
+    {
+        __atomic_store_n(&ring->high_water, used + n, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ring->read_us, read_us, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->tail, tail + n, __ATOMIC_SEQ_CST);
+    /* pairs with the store in lwm_io_thread_pop, see lwm_worker_sleep */
+    if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+    {
+        lwm_io_thread_wake(io);
+    }
+    return LWM_OK;
+}
+
+static void*
+lwm_io_thread_main(void* arg)
+{
+    struct lwm_io_thread_t* io = arg;
+    enum lwm_error_t        err;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    do
+    {
+        err = lwm_io_thread_read(io);
+    } while (err == LWM_OK);
+
+    WARN("lwm_io_thread: stopped, err %d\n", err);
+    io->err = err;
+    __atomic_store_n(&io->is_running, false, __ATOMIC_SEQ_CST);
+    lwm_io_thread_wake(io);
+    return NULL;
+}
+
+enum lwm_error_t
+lwm_io_thread_start(struct lwm_vehicle_t* vehicle, struct lwm_io_thread_t* io)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(io != NULL);
+    ASSERT(vehicle->io == NULL);
+    ASSERT(vehicle->conn.status == LWM_CONN_STATUS_OPEN);
+
+    memset(&io->ring, 0, sizeof(struct lwm_frame_ring_t));
+    io->vehicle    = vehicle;
+    io->is_running = true;
+    io->err        = LWM_OK;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&io->wake, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&io->lock, NULL);
+
+    int err = pthread_create(&io->thread, NULL, lwm_io_thread_main, io);
+    if (err != 0)
+    {
+        WARN("lwm_io_thread_start: unable to create thread, err %s\n",
+            strerror(err));
+        pthread_cond_destroy(&io->wake);
+        pthread_mutex_destroy(&io->lock);
+        return LWM_ERR_NO_MEM;
+    }
+    vehicle->io = io;
+    return LWM_OK;
+}
+
+void
+lwm_io_thread_stop(struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(vehicle != NULL);
+
+    struct lwm_io_thread_t* io = vehicle->io;
+    if (io == NULL)
+    {
+        return;
+    }
+    vehicle->io = NULL;
+    pthread_cancel(io->thread);
+    pthread_join(io->thread, NULL);
+    pthread_cond_destroy(&io->wake);
+    pthread_mutex_destroy(&io->lock);
+}
+
+static void
+lwm_io_thread_wait(
+    struct lwm_io_thread_t* io, uint32_t head, uint32_t wait_us)
+{
+    struct lwm_frame_ring_t* ring = &io->ring;
+    struct timespec          deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += wait_us / 1000000;
+    deadline.tv_nsec += (long)(wait_us % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&io->lock);
+    __atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head
+        && __atomic_load_n(&io->is_running, __ATOMIC_SEQ_CST))
+    {
+        if (pthread_cond_timedwait(&io->wake, &io->lock, &deadline)
+            == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    __atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&io->lock);
+}
+
+enum lwm_error_t
+lwm_io_thread_pop(struct lwm_io_thread_t* io, mavlink_message_t* msgs,
+    size_t max, size_t* n, uint32_t wait_us)
+{
+    ASSERT(io != NULL);
+    ASSERT(msgs != NULL && n != NULL);
+
+    struct lwm_frame_ring_t* ring = &io->ring;
+    uint32_t                 head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (tail == head && wait_us > 0)
+    {
+        lwm_io_thread_wait(io, head, wait_us);
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+
+    *n = 0;
+    if (tail == head)
+    {
+        if (!__atomic_load_n(&io->is_running, __ATOMIC_ACQUIRE))
+        {
+            /* the last frames are out, report why the reading stopped */
+            return io->err;
+        }
+        return LWM_ERR_NO_DATA;
+    }
+
+    while (*n < max && head != tail)
+    {
+        memcpy(&msgs[(*n)++], &ring->slots[head & LWM_FRAME_RING_MASK],
+            sizeof(mavlink_message_t));
+        head++;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    return LWM_OK;
+}
+
+void
+lwm_io_thread_stats(struct lwm_io_thread_t* io, struct lwm_io_stats_t* stats)
+{
+    ASSERT(io != NULL);
+    ASSERT(stats != NULL);
+
+    struct lwm_frame_ring_t* ring = &io->ring;
+    stats->occupancy = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED)
+        - __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    stats->high_water = __atomic_load_n(&ring->high_water, __ATOMIC_RELAXED);
+    stats->overflow   = __atomic_load_n(&ring->overflow, __ATOMIC_RELAXED);
+    stats->frames     = __atomic_load_n(&ring->frames, __ATOMIC_RELAXED);
+}
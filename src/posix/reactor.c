@@ -0,0 +1,621 @@
+#include "lwmavsdk.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+/*
+ * One thread serving many links. Every connection descriptor, timer and the
+ * wake eventfd sit in one epoll set, the thread only runs when one of them
+ * is ready. Epoll data carries the kind of source and its slot; an event
+ * for a slot freed earlier in the same wait finds it empty, or its timer
+ * not readable.
+ *
+ * Saving power, a link read from is left out of the set for the coalescing
+ * window, whatever arrives meanwhile is read in one go; deadlines, timers
+ * and the end of those windows are rounded up to a shared tick, so they
+ * come due together and the thread wakes once for all of them.
+ */
+
+enum lwm_reactor_source_t
+{
+    LWM_REACTOR_WAKE,
+    LWM_REACTOR_LINK,
+    LWM_REACTOR_TIMER,
+};
+
+static uint64_t
+lwm_reactor_key(enum lwm_reactor_source_t source, uint32_t slot)
+{
+    return (uint64_t)source << 32 | slot;
+}
+
+static enum lwm_error_t
+lwm_reactor_watch(struct lwm_reactor_t* reactor, int fd, uint64_t key)
+{
+    struct epoll_event event;
+    event.events   = EPOLLIN;
+    event.data.u64 = key;
+    if (epoll_ctl(reactor->epoll, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        WARN("lwm_reactor: unable to watch fd %d, err %s\n", fd,
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+    return LWM_OK;
+}
+
+enum lwm_error_t
+lwm_reactor_init(struct lwm_reactor_t* reactor)
+{
+    ASSERT(reactor != NULL);
+
+    memset(reactor, 0, sizeof(struct lwm_reactor_t));
+    reactor->stats_us = time_us();
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_TIMER; i++)
+    {
+        reactor->timers[i].fd = -1;
+    }
+
+    reactor->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epoll < 0)
+    {
+        WARN("lwm_reactor_init: unable to create epoll, err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+    reactor->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (reactor->wake < 0)
+    {
+        WARN("lwm_reactor_init: unable to create eventfd, err %s\n",
+            strerror(errno));
+        close(reactor->epoll);
+        return LWM_ERR_IO;
+    }
+    enum lwm_error_t err = lwm_reactor_watch(
+        reactor, reactor->wake, lwm_reactor_key(LWM_REACTOR_WAKE, 0));
+    if (err != LWM_OK)
+    {
+        close(reactor->wake);
+        close(reactor->epoll);
+    }
+    return err;
+}
+
+static uint64_t
+lwm_reactor_align(const struct lwm_reactor_t* reactor, uint64_t us)
+{
+    uint64_t tick = reactor->power.tick_us;
+    if (tick == 0)
+    {
+        return us;
+    }
+    return (us + tick - 1) / tick * tick;
+}
+
+static bool
+lwm_reactor_holds(const struct lwm_reactor_t* reactor)
+{
+    return reactor->power.tick_us > 0 && reactor->power.hold_deferred;
+}
+
+static void
+lwm_reactor_release_timer(struct lwm_reactor_timer_t* timer)
+{
+    /* closing it takes it out of the epoll set too */
+    close(timer->fd);
+    timer->fd = -1;
+}
+
+void
+lwm_reactor_fini(struct lwm_reactor_t* reactor)
+{
+    ASSERT(reactor != NULL);
+
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        if (reactor->links[i].vehicle != NULL)
+        {
+            lwm_reactor_remove_vehicle(reactor, reactor->links[i].vehicle);
+        }
+    }
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_TIMER; i++)
+    {
+        if (reactor->timers[i].fd >= 0)
+        {
+            lwm_reactor_release_timer(&reactor->timers[i]);
+        }
+    }
+    close(reactor->wake);
+    close(reactor->epoll);
+}
+
+static void
+lwm_reactor_wake_vehicle(void* context)
+{
+    lwm_reactor_wake(context);
+}
+
+enum lwm_error_t
+lwm_reactor_add_vehicle(
+    struct lwm_reactor_t* reactor, struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(reactor != NULL);
+    ASSERT(vehicle != NULL);
+    ASSERT(vehicle->io == NULL && vehicle->wake == NULL);
+
+    int fd = lwm_conn_fd(&vehicle->conn);
+    if (fd < 0)
+    {
+        return LWM_ERR_NOT_SUPPORTED;
+    }
+
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        struct lwm_reactor_link_t* link = &reactor->links[i];
+        if (link->vehicle != NULL)
+        {
+            continue;
+        }
+        enum lwm_error_t err = lwm_reactor_watch(
+            reactor, fd, lwm_reactor_key(LWM_REACTOR_LINK, i));
+        if (err != LWM_OK)
+        {
+            return err;
+        }
+        link->vehicle  = vehicle;
+        link->fd       = fd;
+        link->rearm_us = 0;
+        vehicle->deferred.is_held = lwm_reactor_holds(reactor);
+        lwm_vehicle_set_wake(vehicle, lwm_reactor_wake_vehicle, reactor);
+        return LWM_OK;
+    }
+    return LWM_ERR_NO_MEM;
+}
+
+void
+lwm_reactor_remove_vehicle(
+    struct lwm_reactor_t* reactor, struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(reactor != NULL);
+    ASSERT(vehicle != NULL);
+
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        struct lwm_reactor_link_t* link = &reactor->links[i];
+        if (link->vehicle == vehicle)
+        {
+            epoll_ctl(reactor->epoll, EPOLL_CTL_DEL, link->fd, NULL);
+            link->vehicle = NULL;
+            lwm_vehicle_set_wake(vehicle, NULL, NULL);
+            if (vehicle->deferred.is_held)
+            {
+                vehicle->deferred.is_held = false;
+                lwm_microservice_flush_deferred(vehicle);
+            }
+            return;
+        }
+    }
+}
+
+static void
+lwm_reactor_timespec(struct timespec* ts, uint64_t us)
+{
+    ts->tv_sec  = us / 1000000;
+    ts->tv_nsec = (long)(us % 1000000) * 1000;
+}
+
+static enum lwm_error_t
+lwm_reactor_arm(struct lwm_reactor_t* reactor, uint64_t first_us,
+    uint64_t period_us, struct lwm_reactor_timer_t** timer, uint32_t* id)
+{
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_TIMER; i++)
+    {
+        struct lwm_reactor_timer_t* t = &reactor->timers[i];
+        if (t->fd >= 0)
+        {
+            continue;
+        }
+
+        /* time_us is CLOCK_MONOTONIC, deadlines are armed as they are */
+        t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (t->fd < 0)
+        {
+            WARN("lwm_reactor: unable to create timer, err %s\n",
+                strerror(errno));
+            return LWM_ERR_IO;
+        }
+        struct itimerspec spec;
+        lwm_reactor_timespec(&spec.it_value, first_us);
+        lwm_reactor_timespec(&spec.it_interval, period_us);
+        if (timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0
+            || lwm_reactor_watch(
+                   reactor, t->fd, lwm_reactor_key(LWM_REACTOR_TIMER, i))
+                != LWM_OK)
+        {
+            WARN("lwm_reactor: unable to arm timer, err %s\n",
+                strerror(errno));
+            lwm_reactor_release_timer(t);
+            return LWM_ERR_IO;
+        }
+        t->period_us = period_us;
+        *timer       = t;
+        *id          = i;
+        return LWM_OK;
+    }
+    return LWM_ERR_NO_MEM;
+}
+
+enum lwm_error_t
+lwm_reactor_add_timer(struct lwm_reactor_t* reactor, uint64_t period_us,
+    bool periodic, lwm_reactor_tick_t tick, void* context, uint32_t* id)
+{
+    ASSERT(reactor != NULL);
+    ASSERT(tick != NULL);
+    ASSERT(id != NULL);
+
+    if (period_us == 0)
+    {
+        return LWM_ERR_BAD_PARAM;
+    }
+
+    /* saving power, they fire on ticks along with everything else */
+    period_us = lwm_reactor_align(reactor, period_us);
+    struct lwm_reactor_timer_t* timer;
+    enum lwm_error_t            err = lwm_reactor_arm(reactor,
+        lwm_reactor_align(reactor, time_us() + period_us),
+        periodic ? period_us : 0, &timer, id);
+    if (err != LWM_OK)
+    {
+        return err;
+    }
+    timer->tick    = tick;
+    timer->context = context;
+    return LWM_OK;
+}
+
+void
+lwm_reactor_cancel_timer(struct lwm_reactor_t* reactor, uint32_t id)
+{
+    ASSERT(reactor != NULL);
+    ASSERT(id < MAX_LWM_REACTOR_TIMER);
+
+    if (reactor->timers[id].fd >= 0)
+    {
+        lwm_reactor_release_timer(&reactor->timers[id]);
+    }
+}
+
+static void
+lwm_reactor_watch_link(
+    struct lwm_reactor_t* reactor, uint32_t slot, uint32_t events)
+{
+    struct epoll_event event;
+    event.events   = events;
+    event.data.u64 = lwm_reactor_key(LWM_REACTOR_LINK, slot);
+    if (epoll_ctl(
+            reactor->epoll, EPOLL_CTL_MOD, reactor->links[slot].fd, &event)
+        < 0)
+    {
+        WARN("lwm_reactor: unable to change fd %d, err %s\n",
+            reactor->links[slot].fd, strerror(errno));
+    }
+}
+
+static void
+lwm_reactor_rearm(struct lwm_reactor_t* reactor, uint64_t now, bool force)
+{
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        struct lwm_reactor_link_t* link = &reactor->links[i];
+        if (link->vehicle != NULL && link->rearm_us != 0
+            && (force || now >= link->rearm_us))
+        {
+            lwm_reactor_watch_link(reactor, i, EPOLLIN);
+            link->rearm_us = 0;
+        }
+    }
+}
+
+void
+lwm_reactor_set_power(
+    struct lwm_reactor_t* reactor, const struct lwm_reactor_power_t* power)
+{
+    ASSERT(reactor != NULL);
+
+    if (power != NULL)
+    {
+        reactor->power = *power;
+    }
+    else
+    {
+        memset(&reactor->power, 0, sizeof(struct lwm_reactor_power_t));
+    }
+    if (reactor->power.tick_us == 0)
+    {
+        /* nothing is left unwatched without a tick to bound it */
+        reactor->power.coalesce_us = 0;
+        lwm_reactor_rearm(reactor, 0, true);
+    }
+    reactor->tick_due_us = 0;
+
+    bool holds = lwm_reactor_holds(reactor);
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        struct lwm_vehicle_t* vehicle = reactor->links[i].vehicle;
+        if (vehicle != NULL && vehicle->deferred.is_held != holds)
+        {
+            vehicle->deferred.is_held = holds;
+            lwm_microservice_flush_deferred(vehicle);
+        }
+    }
+}
+
+void
+lwm_reactor_stats(
+    struct lwm_reactor_t* reactor, struct lwm_reactor_stats_t* stats)
+{
+    ASSERT(reactor != NULL);
+    ASSERT(stats != NULL);
+
+    uint64_t now     = time_us();
+    uint64_t wakeups = __atomic_load_n(&reactor->wakeups, __ATOMIC_RELAXED);
+    stats->wakeups   = wakeups;
+    stats->reads     = __atomic_load_n(&reactor->reads, __ATOMIC_RELAXED);
+    stats->wakeups_per_s = now > reactor->stats_us
+        ? (uint32_t)((wakeups - reactor->stats_wakeups) * 1000000
+            / (now - reactor->stats_us))
+        : 0;
+    reactor->stats_us      = now;
+    reactor->stats_wakeups = wakeups;
+}
+
+void
+lwm_reactor_wake(struct lwm_reactor_t* reactor)
+{
+    ASSERT(reactor != NULL);
+
+    uint64_t one = 1;
+    if (write(reactor->wake, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        WARN("lwm_reactor_wake: unable to signal, err %s\n", strerror(errno));
+    }
+}
+
+void
+lwm_reactor_stop(struct lwm_reactor_t* reactor)
+{
+    ASSERT(reactor != NULL);
+
+    __atomic_store_n(&reactor->is_stopping, true, __ATOMIC_RELEASE);
+    lwm_reactor_wake(reactor);
+}
+
+static bool
+lwm_reactor_readable(int fd)
+{
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+static void
+lwm_reactor_link_ready(
+    struct lwm_reactor_t* reactor, uint32_t slot, uint64_t ready_us)
+{
+    struct lwm_reactor_link_t* link    = &reactor->links[slot];
+    struct lwm_vehicle_t*      vehicle = link->vehicle;
+    enum lwm_error_t           err;
+    uint32_t                   reads = 0;
+    /* latency counts from the wakeup, not from this link's turn in it */
+    vehicle->ready_us = ready_us;
+    /* a read is a datagram or what the port held; when coalescing, all
+     * that piled up goes now, without waiting for another wakeup */
+    do
+    {
+        err = lwm_vehicle_process_input(vehicle);
+        reads++;
+    } while (err == LWM_OK && reactor->power.coalesce_us > 0
+        && reads < MAX_LWM_REACTOR_DRAIN && lwm_reactor_readable(link->fd));
+    __atomic_store_n(
+        &reactor->reads, reactor->reads + reads, __ATOMIC_RELAXED);
+    if (err != LWM_OK)
+    {
+        WARN("lwm_reactor: link %d dropped, err %d\n", link->fd, err);
+        lwm_reactor_remove_vehicle(reactor, vehicle);
+        return;
+    }
+    if (reactor->power.coalesce_us > 0 && link->rearm_us == 0)
+    {
+        /* let the next datagrams or bytes pile up in the kernel */
+        lwm_reactor_watch_link(reactor, slot, 0);
+        link->rearm_us = lwm_reactor_align(
+            reactor, time_us() + reactor->power.coalesce_us);
+    }
+}
+
+static void
+lwm_reactor_timer_ready(struct lwm_reactor_timer_t* timer)
+{
+    uint64_t expirations;
+    if (timer->fd < 0
+        || read(timer->fd, &expirations, sizeof(expirations)) < 0)
+    {
+        /* cancelled or re-armed since the wait returned */
+        return;
+    }
+
+    lwm_reactor_tick_t tick    = timer->tick;
+    void*              context = timer->context;
+    if (timer->period_us == 0)
+    {
+        lwm_reactor_release_timer(timer);
+    }
+    /* last, the tick may cancel or add timers */
+    tick(context, expirations);
+}
+
+static void
+lwm_reactor_wake_ready(struct lwm_reactor_t* reactor)
+{
+    uint64_t count;
+    if (read(reactor->wake, &count, sizeof(count)) < 0)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        if (reactor->links[i].vehicle != NULL)
+        {
+            lwm_vehicle_drain_posted(reactor->links[i].vehicle);
+        }
+    }
+}
+
+static uint64_t
+lwm_reactor_link_deadline(
+    struct lwm_reactor_t* reactor, struct lwm_reactor_link_t* link)
+{
+    struct lwm_vehicle_t* vehicle = link->vehicle;
+    uint64_t deadline = lwm_reactor_align(
+        reactor, lwm_vehicle_next_deadline(vehicle));
+    if (link->rearm_us != 0 && (deadline == 0 || link->rearm_us < deadline))
+    {
+        deadline = link->rearm_us;
+    }
+    if (vehicle->deferred.is_held && vehicle->deferred.n > 0
+        && (deadline == 0 || reactor->tick_due_us < deadline))
+    {
+        deadline = reactor->tick_due_us;
+    }
+    return deadline;
+}
+
+static int
+lwm_reactor_timeout(struct lwm_reactor_t* reactor, int timeout_ms)
+{
+    /* each vehicle keeps its earliest deadline, they bound the wait rather
+     * than each waiter and action taking a timer */
+    uint64_t now = time_us();
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        if (reactor->links[i].vehicle == NULL)
+        {
+            continue;
+        }
+        uint64_t deadline
+            = lwm_reactor_link_deadline(reactor, &reactor->links[i]);
+        if (deadline == 0)
+        {
+            continue;
+        }
+        /* actions expire strictly after theirs, hence the extra millisecond */
+        uint64_t left_ms = deadline > now ? (deadline - now) / 1000 + 1 : 0;
+        if (left_ms > INT32_MAX)
+        {
+            continue;
+        }
+        if (timeout_ms < 0 || left_ms < (uint64_t)timeout_ms)
+        {
+            timeout_ms = (int)left_ms;
+        }
+    }
+    return timeout_ms;
+}
+
+static void
+lwm_reactor_expire(struct lwm_reactor_t* reactor)
+{
+    /* waiters and actions of every vehicle, one time_us for all */
+    uint64_t now  = time_us();
+    bool     tick = now >= reactor->tick_due_us;
+    for (uint32_t i = 0; i < MAX_LWM_REACTOR_LINK; i++)
+    {
+        struct lwm_vehicle_t* vehicle = reactor->links[i].vehicle;
+        if (vehicle == NULL)
+        {
+            continue;
+        }
+        lwm_vehicle_process_timers(vehicle, now);
+        if (tick && vehicle->deferred.is_held)
+        {
+            lwm_microservice_flush_deferred(vehicle);
+        }
+    }
+    if (tick)
+    {
+        reactor->tick_due_us = lwm_reactor_align(reactor, now + 1);
+    }
+}
+
+enum lwm_error_t
+lwm_reactor_run_once(struct lwm_reactor_t* reactor, int timeout_ms)
+{
+    ASSERT(reactor != NULL);
+
+    struct epoll_event events[MAX_LWM_REACTOR_EVENT];
+    lwm_reactor_rearm(reactor, time_us(), false);
+    int n = epoll_wait(reactor->epoll, events, MAX_LWM_REACTOR_EVENT,
+        lwm_reactor_timeout(reactor, timeout_ms));
+    if (n == 0 && reactor->power.coalesce_us > 0)
+    {
+        /* a window ended, what piled up comes in this same wakeup */
+        lwm_reactor_rearm(reactor, time_us(), false);
+        n = epoll_wait(reactor->epoll, events, MAX_LWM_REACTOR_EVENT, 0);
+    }
+    if (n < 0 && errno != EINTR)
+    {
+        WARN("lwm_reactor_run_once: epoll_wait failed, err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+    __atomic_store_n(&reactor->wakeups, reactor->wakeups + 1, __ATOMIC_RELAXED);
+
+    uint64_t ready_us = n > 0 ? time_us() : 0;
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t slot = (uint32_t)events[i].data.u64;
+        switch ((enum lwm_reactor_source_t)(events[i].data.u64 >> 32))
+        {
+        case LWM_REACTOR_WAKE: lwm_reactor_wake_ready(reactor); break;
+        case LWM_REACTOR_LINK:
+            if (reactor->links[slot].vehicle != NULL)
+            {
+                lwm_reactor_link_ready(reactor, slot, ready_us);
+            }
+            break;
+        case LWM_REACTOR_TIMER:
+            lwm_reactor_timer_ready(&reactor->timers[slot]);
+            break;
+        }
+    }
+    lwm_reactor_expire(reactor);
+
+    if (__atomic_load_n(&reactor->is_stopping, __ATOMIC_ACQUIRE))
+    {
+        return LWM_ERR_STOPPED;
+    }
+    return LWM_OK;
+}
+
+enum lwm_error_t
+lwm_reactor_run(struct lwm_reactor_t* reactor)
+{
+    ASSERT(reactor != NULL);
+
+    enum lwm_error_t err = LWM_OK;
+    while (err == LWM_OK)
+    {
+        err = lwm_reactor_run_once(reactor, -1);
+    }
+    if (err == LWM_ERR_STOPPED)
+    {
+        /* it can run again */
+        __atomic_store_n(&reactor->is_stopping, false, __ATOMIC_RELEASE);
+    }
+    return err;
+}
@@ -0,0 +1,234 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
+#include "lwmavsdk.h"
+
+#include <alloca.h>
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * Real-time mode: no page fault and no preemption by ordinary threads once
+ * the vehicle spins. Threads are pinned and moved to SCHED_FIFO, memory is
+ * locked, the library's structures and the dispatch stack are touched once
+ * so every page they use is resident before the first frame.
+ *
+ * A failing step undoes the ones before it: threads get their affinity and
+ * policy back, memory is unlocked and the pools grow again if they did.
+ * Only the malloc tuning stays, it costs nothing without the lock.
+ */
+
+/* a thread as it was before lwm_rt_thread changed it */
+struct lwm_rt_saved_t
+{
+    pthread_t          thread;
+    cpu_set_t          affinity;
+    int                policy;
+    struct sched_param param;
+};
+
+void
+lwm_rt_config_init(struct lwm_rt_config_t* config)
+{
+    ASSERT(config != NULL);
+
+    config->dispatch.cpu      = -1;
+    config->dispatch.priority = 0;
+    config->io.cpu            = -1;
+    config->io.priority       = 0;
+    config->workers.cpu       = -1;
+    config->workers.priority  = 0;
+    config->lock_memory       = false;
+    config->stack_prefault    = 0;
+}
+
+static enum lwm_error_t
+lwm_rt_error(const char* what, int err)
+{
+    WARN("lwm_rt_start: unable to %s, err %s\n", what, strerror(err));
+    switch (err)
+    {
+    case EPERM: return LWM_ERR_NOT_SUPPORTED;
+    case EINVAL: return LWM_ERR_BAD_PARAM;
+    default: return LWM_ERR_IO;
+    }
+}
+
+static void
+lwm_rt_restore(const struct lwm_rt_saved_t* saved)
+{
+    pthread_setschedparam(saved->thread, saved->policy, &saved->param);
+    pthread_setaffinity_np(saved->thread, sizeof(cpu_set_t), &saved->affinity);
+}
+
+static enum lwm_error_t
+lwm_rt_thread(
+    pthread_t thread, int cpu, int priority, struct lwm_rt_saved_t* saved)
+{
+    int err;
+    saved->thread = thread;
+    err           = pthread_getaffinity_np(
+        thread, sizeof(cpu_set_t), &saved->affinity);
+    if (err == 0)
+    {
+        err = pthread_getschedparam(thread, &saved->policy, &saved->param);
+    }
+    if (err != 0)
+    {
+        return lwm_rt_error("read thread settings", err);
+    }
+
+    if (cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        err = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+        if (err != 0)
+        {
+            return lwm_rt_error("pin thread", err);
+        }
+    }
+    if (priority > 0)
+    {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        err = pthread_setschedparam(thread, SCHED_FIFO, &param);
+        if (err != 0)
+        {
+            lwm_rt_restore(saved);
+            return lwm_rt_error("set SCHED_FIFO", err);
+        }
+    }
+    return LWM_OK;
+}
+
+static void
+lwm_rt_prefault(void* data, size_t len)
+{
+    /* a write per page, so zero and copy-on-write pages get their own; an
+     * atomic add of zero does not race with the threads already running */
+    uint8_t* p    = data;
+    size_t   page = (size_t)sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < len; i += page)
+    {
+        __atomic_fetch_add(&p[i], 0, __ATOMIC_RELAXED);
+    }
+    if (len > 0)
+    {
+        __atomic_fetch_add(&p[len - 1], 0, __ATOMIC_RELAXED);
+    }
+}
+
+static void __attribute__((noinline))
+lwm_rt_prefault_stack(size_t len)
+{
+    /* the frames the loop will use later land in these pages */
+    uint8_t* stack = alloca(len);
+    lwm_rt_prefault(stack, len);
+}
+
+static enum lwm_error_t
+lwm_rt_lock(struct lwm_vehicle_t* vehicle)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+    {
+        return lwm_rt_error("lock memory", errno);
+    }
+#if defined(__GLIBC__)
+    /* freed memory stays mapped, a later malloc does not fault again */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+    /* new slabs would be allocated, and faulted in, inside the loop */
+    lwm_microservice_pool_growth(vehicle, false);
+    return LWM_OK;
+}
+
+enum lwm_error_t
+lwm_rt_start(
+    struct lwm_vehicle_t* vehicle, const struct lwm_rt_config_t* config)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(config != NULL);
+
+    /* the I/O thread, every worker and the dispatch thread */
+    struct lwm_rt_saved_t saved[MAX_LWM_WORKER + 2];
+    size_t                n_saved = 0;
+    bool                  grow    = vehicle->service_pool.grow;
+    enum lwm_error_t      err     = LWM_OK;
+    if (config->lock_memory)
+    {
+        err = lwm_rt_lock(vehicle);
+        if (err != LWM_OK)
+        {
+            return err;
+        }
+    }
+
+    lwm_rt_prefault(vehicle, sizeof(struct lwm_vehicle_t));
+    if (vehicle->telemetry != NULL)
+    {
+        lwm_rt_prefault(vehicle->telemetry, sizeof(struct lwm_telemetry_t));
+    }
+    if (vehicle->latency != NULL)
+    {
+        lwm_rt_prefault(vehicle->latency, sizeof(struct lwm_latency_t));
+    }
+    if (vehicle->io != NULL)
+    {
+        lwm_rt_prefault(vehicle->io, sizeof(struct lwm_io_thread_t));
+        err = lwm_rt_thread(vehicle->io->thread, config->io.cpu,
+            config->io.priority, &saved[n_saved]);
+        if (err != LWM_OK)
+        {
+            goto cleanup;
+        }
+        n_saved++;
+    }
+    if (vehicle->workers != NULL)
+    {
+        struct lwm_workers_t* workers = vehicle->workers;
+        lwm_rt_prefault(workers, sizeof(struct lwm_workers_t));
+        for (uint32_t i = 0; i < workers->n; i++)
+        {
+            int cpu = config->workers.cpu < 0
+                ? -1 : config->workers.cpu + (int)i;
+            err = lwm_rt_thread(workers->workers[i].thread, cpu,
+                config->workers.priority, &saved[n_saved]);
+            if (err != LWM_OK)
+            {
+                goto cleanup;
+            }
+            n_saved++;
+        }
+    }
+
+    err = lwm_rt_thread(pthread_self(), config->dispatch.cpu,
+        config->dispatch.priority, &saved[n_saved]);
+    if (err != LWM_OK)
+    {
+        goto cleanup;
+    }
+    if (config->stack_prefault > 0)
+    {
+        lwm_rt_prefault_stack(config->stack_prefault);
+    }
+    return LWM_OK;
+
+cleanup:
+    while (n_saved > 0)
+    {
+        lwm_rt_restore(&saved[--n_saved]);
+    }
+    if (config->lock_memory)
+    {
+        munlockall();
+        lwm_microservice_pool_growth(vehicle, grow);
+    }
+    return err;
+}
@@ -3,6 +3,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 
@@ -10,6 +11,7 @@ struct posix_serial_t
 {
     int                fd, epoll;
     struct epoll_event event[1];
+    bool               is_coalescing; /* fd blocks, VMIN/VTIME apply */
 };
 
 static speed_t
@@ -123,6 +125,7 @@ posix_serial_open(
         goto cleanup;
     }
 
+    serial->is_coalescing = false;
     INFO("serial device %s:%s opened (fd = %d)\n", params->params.serial.device,
         posix_serial_baudrate_string(params->params.serial.baudrate),
         serial->fd);
@@ -178,6 +181,20 @@ posix_serial_recv(struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
     ASSERT(len > 0);
 
     struct posix_serial_t* serial = (struct posix_serial_t*)ctx->opaque;
+    if (serial->is_coalescing)
+    {
+        /* the line discipline returns once VMIN bytes are in, or VTIME
+         * after the last one: one wakeup per burst rather than per byte */
+        ssize_t n = read(serial->fd, data, len);
+        if (n < 0)
+        {
+            WARN("posix_serial_recv: unable to read from serial device, err "
+                 "%s\n",
+                strerror(errno));
+            return -1;
+        }
+        return n;
+    }
 
     /* wait for event */
     int n_events = epoll_wait(serial->epoll, serial->event, 1, -1);
@@ -202,13 +219,113 @@ posix_serial_recv(struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
     return n;
 }
 
+static int
+posix_serial_fd(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+
+    return ((struct posix_serial_t*)ctx->opaque)->fd;
+}
+
+static ssize_t
+posix_serial_try_recv(
+    struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+    ASSERT(data != NULL);
+    ASSERT(len > 0);
+
+    /* the device is opened O_NDELAY, read never waits; when coalescing it
+     * blocks, reading no more than is there does not wait for VMIN */
+    struct posix_serial_t* serial = (struct posix_serial_t*)ctx->opaque;
+    if (serial->is_coalescing)
+    {
+        int avail = 0;
+        if (ioctl(serial->fd, FIONREAD, &avail) < 0 || avail <= 0)
+        {
+            return 0;
+        }
+        if ((size_t)avail < len)
+        {
+            len = (size_t)avail;
+        }
+    }
+    ssize_t n = read(serial->fd, data, len);
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 0;
+        }
+        WARN("posix_serial_try_recv: unable to read from serial device, err "
+             "%s\n",
+            strerror(errno));
+        return -1;
+    }
+    return n;
+}
+
+static enum lwm_error_t
+posix_serial_coalesce(
+    struct lwm_conn_context_t* ctx, uint32_t max_delay_us, uint32_t min_bytes)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+
+    struct posix_serial_t* serial = (struct posix_serial_t*)ctx->opaque;
+    struct termios         tty;
+    if (tcgetattr(serial->fd, &tty) != 0)
+    {
+        WARN("posix_serial_coalesce: unable to get serial device attributes, "
+             "err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+
+    bool is_coalescing = max_delay_us > 0 && min_bytes > 1;
+    /* VTIME counts tenths of a second, VMIN bytes, both in a cc_t */
+    uint32_t tenths = (max_delay_us + 99999) / 100000;
+    tty.c_cc[VMIN]  = is_coalescing ? (cc_t)(min_bytes > 255 ? 255 : min_bytes)
+                                    : 0;
+    tty.c_cc[VTIME] = is_coalescing ? (cc_t)(tenths > 255 ? 255 : tenths) : 0;
+    if (tcsetattr(serial->fd, TCSANOW, &tty) != 0)
+    {
+        WARN("posix_serial_coalesce: unable to set serial device attributes, "
+             "err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+
+    /* VMIN and VTIME only hold back reads that may block */
+    int flags = fcntl(serial->fd, F_GETFL);
+    if (flags < 0
+        || fcntl(serial->fd, F_SETFL,
+               is_coalescing ? flags & ~O_NDELAY : flags | O_NDELAY)
+            < 0)
+    {
+        WARN("posix_serial_coalesce: unable to set fd flags, err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+    serial->is_coalescing = is_coalescing;
+    return LWM_OK;
+}
+
 void
 posix_serial_register(struct lwm_conn_context_t* ctx)
 {
     ASSERT(ctx != NULL);
 
-    ctx->open  = posix_serial_open;
-    ctx->close = posix_serial_close;
-    ctx->send  = posix_serial_send;
-    ctx->recv  = posix_serial_recv;
+    ctx->open     = posix_serial_open;
+    ctx->close    = posix_serial_close;
+    ctx->send     = posix_serial_send;
+    ctx->recv     = posix_serial_recv;
+    ctx->try_recv = posix_serial_try_recv;
+    ctx->fd       = posix_serial_fd;
+    ctx->coalesce = posix_serial_coalesce;
+
+    /* the port is a byte stream, frames can go out together */
+    ctx->output_max = LWM_WRITE_BUFFER_SIZE;
 }
@@ -0,0 +1,117 @@
+#include "lwmavsdk.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The telemetry store in a named POSIX shared memory segment. The vehicle
+ * process writes it as usual, readers map it read-only and go through
+ * lwm_telemetry_read.
+ */
+
+enum lwm_error_t
+lwm_telemetry_shm_create(const char* name, struct lwm_telemetry_t** telemetry)
+{
+    ASSERT(name != NULL);
+    ASSERT(telemetry != NULL);
+
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+    {
+        WARN("lwm_telemetry_shm_create: unable to open %s, err %s\n", name,
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+    if (ftruncate(fd, sizeof(struct lwm_telemetry_t)) < 0)
+    {
+        WARN("lwm_telemetry_shm_create: unable to size %s, err %s\n", name,
+            strerror(errno));
+        close(fd);
+        return LWM_ERR_IO;
+    }
+
+    void* p = mmap(NULL, sizeof(struct lwm_telemetry_t),
+        PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        WARN("lwm_telemetry_shm_create: unable to map %s, err %s\n", name,
+            strerror(errno));
+        return LWM_ERR_NO_MEM;
+    }
+
+    /* readers still mapping an older store see it as not ready */
+    struct lwm_telemetry_t* store = p;
+    __atomic_store_n(&store->magic, 0, __ATOMIC_RELEASE);
+    lwm_telemetry_init(store);
+    *telemetry = store;
+    return LWM_OK;
+}
+
+void
+lwm_telemetry_shm_destroy(const char* name, struct lwm_telemetry_t* telemetry)
+{
+    ASSERT(name != NULL);
+
+    if (telemetry != NULL)
+    {
+        munmap(telemetry, sizeof(struct lwm_telemetry_t));
+    }
+    shm_unlink(name);
+}
+
+enum lwm_error_t
+lwm_telemetry_shm_attach(
+    const char* name, const struct lwm_telemetry_t** telemetry)
+{
+    ASSERT(name != NULL);
+    ASSERT(telemetry != NULL);
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        WARN("lwm_telemetry_shm_attach: unable to open %s, err %s\n", name,
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct lwm_telemetry_t))
+    {
+        /* not sized yet, or published by an incompatible build */
+        close(fd);
+        return LWM_ERR_NO_DATA;
+    }
+
+    void* p = mmap(
+        NULL, sizeof(struct lwm_telemetry_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        WARN("lwm_telemetry_shm_attach: unable to map %s, err %s\n", name,
+            strerror(errno));
+        return LWM_ERR_NO_MEM;
+    }
+
+    const struct lwm_telemetry_t* store = p;
+    if (__atomic_load_n(&store->magic, __ATOMIC_ACQUIRE) != LWM_TELEMETRY_MAGIC
+        || store->size != sizeof(struct lwm_telemetry_t))
+    {
+        munmap(p, sizeof(struct lwm_telemetry_t));
+        return LWM_ERR_NO_DATA;
+    }
+    *telemetry = store;
+    return LWM_OK;
+}
+
+void
+lwm_telemetry_shm_detach(const struct lwm_telemetry_t* telemetry)
+{
+    if (telemetry != NULL)
+    {
+        munmap((void*)telemetry, sizeof(struct lwm_telemetry_t));
+    }
+}
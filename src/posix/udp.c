@@ -7,11 +7,29 @@
 
 struct posix_udp_t
 {
-    int                fd;
-    struct sockaddr_in client;
-    bool               has_client;
+    int      fd;
+    uint64_t client; /* see posix_udp_learn */
 };
 
+/* the peer is packed as address << 16 | port, network order, and published
+ * whole: recvfrom may run on an I/O thread while sendto runs on another */
+static void
+posix_udp_learn(struct posix_udp_t* udp, const struct sockaddr_in* from)
+{
+    uint64_t peer = (uint64_t)from->sin_addr.s_addr << 16 | from->sin_port;
+    __atomic_store_n(&udp->client, peer, __ATOMIC_RELAXED);
+}
+
+static void
+posix_udp_peer(struct posix_udp_t* udp, struct sockaddr_in* addr)
+{
+    uint64_t peer = __atomic_load_n(&udp->client, __ATOMIC_RELAXED);
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = (in_addr_t)(peer >> 16);
+    addr->sin_port        = (in_port_t)(peer & 0xffff);
+}
+
 static enum lwm_error_t
 posix_udp_open(
     struct lwm_conn_context_t* ctx, struct lwm_conn_params_t* params)
@@ -54,10 +72,11 @@ posix_udp_open(
         goto cleanup;
     }
 
-    uint8_t   buf[1];
-    socklen_t caddr_len = sizeof(udp->client);
-    ssize_t   n = recvfrom(udp->fd, buf, sizeof(buf), 0,
-                  (struct sockaddr*)&udp->client, &caddr_len);
+    uint8_t            buf[1];
+    struct sockaddr_in client;
+    socklen_t          caddr_len = sizeof(client);
+    ssize_t            n = recvfrom(udp->fd, buf, sizeof(buf), 0,
+                  (struct sockaddr*)&client, &caddr_len);
     INFO("Wait for UDP client ...\n");
     if (n <= 0)
     {
@@ -67,9 +86,9 @@ posix_udp_open(
         goto cleanup;
     }
 
-    udp->has_client = true;
+    posix_udp_learn(udp, &client);
     INFO("UDP connection: %d <--> %s:%d\n", params->params.udp.port,
-        inet_ntoa(udp->client.sin_addr), ntohs(udp->client.sin_port));
+        inet_ntoa(client.sin_addr), ntohs(client.sin_port));
 
     ctx->opaque = udp;
     return LWM_OK;
@@ -106,7 +125,9 @@ posix_udp_send(
     struct posix_udp_t* udp;
     udp = (struct posix_udp_t*)ctx->opaque;
 
-    ssize_t rv = sendto(udp->fd, data, len, 0, (struct sockaddr *) &udp->client,
+    struct sockaddr_in client;
+    posix_udp_peer(udp, &client);
+    ssize_t rv = sendto(udp->fd, data, len, 0, (struct sockaddr *) &client,
         sizeof(struct sockaddr_in));
     if (rv < 0)
     {
@@ -128,14 +149,53 @@ posix_udp_recv(struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
     struct posix_udp_t* udp;
     udp = (struct posix_udp_t*)ctx->opaque;
 
-    socklen_t caddr_len = sizeof(udp->client);
-    ssize_t n = recvfrom(udp->fd, data, len, 0, (struct sockaddr *) &udp->client, &caddr_len);
+    struct sockaddr_in client;
+    socklen_t caddr_len = sizeof(client);
+    ssize_t n = recvfrom(udp->fd, data, len, 0, (struct sockaddr *) &client, &caddr_len);
     if (n < 0)
     {
         WARN("posix_udp_recv: unable to recv data, err %s\n",
             strerror(errno));
         return -LWM_ERR_IO;
     }
+    posix_udp_learn(udp, &client);
+    return n;
+}
+
+static int
+posix_udp_fd(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+
+    return ((struct posix_udp_t*)ctx->opaque)->fd;
+}
+
+static ssize_t
+posix_udp_try_recv(struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+    ASSERT(data != NULL);
+    ASSERT(len > 0);
+
+    struct posix_udp_t* udp = (struct posix_udp_t*)ctx->opaque;
+
+    struct sockaddr_in client;
+    socklen_t          caddr_len = sizeof(client);
+    ssize_t            n = recvfrom(udp->fd, data, len, MSG_DONTWAIT,
+          (struct sockaddr*)&client, &caddr_len);
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 0;
+        }
+        WARN("posix_udp_try_recv: unable to recv data, err %s\n",
+            strerror(errno));
+        return -LWM_ERR_IO;
+    }
+    posix_udp_learn(udp, &client);
     return n;
 }
 
@@ -144,8 +204,13 @@ posix_udp_register(struct lwm_conn_context_t* ctx)
 {
     ASSERT(ctx != NULL);
 
-    ctx->open  = posix_udp_open;
-    ctx->close = posix_udp_close;
-    ctx->send  = posix_udp_send;
-    ctx->recv  = posix_udp_recv;
+    ctx->open     = posix_udp_open;
+    ctx->close    = posix_udp_close;
+    ctx->send     = posix_udp_send;
+    ctx->recv     = posix_udp_recv;
+    ctx->try_recv = posix_udp_try_recv;
+    ctx->fd       = posix_udp_fd;
+
+    /* several frames may share one datagram */
+    ctx->output_max = LWM_WRITE_BUFFER_SIZE;
 }
@@ -7,10 +7,32 @@
 
 struct posix_udp_client_t
 {
-    int                fd;
-    struct sockaddr_in addr;
+    int      fd;
+    uint64_t addr; /* see posix_udp_client_learn */
 };
 
+/* the server is packed as address << 16 | port, network order, and
+ * published whole: recvfrom may run on an I/O thread while sendto runs on
+ * another */
+static void
+posix_udp_client_learn(
+    struct posix_udp_client_t* udp, const struct sockaddr_in* from)
+{
+    uint64_t addr = (uint64_t)from->sin_addr.s_addr << 16 | from->sin_port;
+    __atomic_store_n(&udp->addr, addr, __ATOMIC_RELAXED);
+}
+
+static void
+posix_udp_client_peer(
+    struct posix_udp_client_t* udp, struct sockaddr_in* addr)
+{
+    uint64_t peer = __atomic_load_n(&udp->addr, __ATOMIC_RELAXED);
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family      = AF_INET;
+    addr->sin_addr.s_addr = (in_addr_t)(peer >> 16);
+    addr->sin_port        = (in_port_t)(peer & 0xffff);
+}
+
 static enum lwm_error_t
 posix_udp_client_open(struct lwm_conn_context_t* ctx, struct lwm_conn_params_t* params)
 {
@@ -37,10 +59,12 @@ posix_udp_client_open(struct lwm_conn_context_t* ctx, struct lwm_conn_params_t*
         goto cleanup;
     }
 
-    memset(&udp->addr, 0, sizeof(struct sockaddr_in));
-    udp->addr.sin_family      = AF_INET;
-    udp->addr.sin_port        = htons(params->params.udp.port);
-    udp->addr.sin_addr.s_addr = inet_addr(params->params.udp.host);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(params->params.udp.port);
+    addr.sin_addr.s_addr = inet_addr(params->params.udp.host);
+    posix_udp_client_learn(udp, &addr);
 
     ctx->opaque = udp;
     return LWM_OK;
@@ -76,7 +100,9 @@ posix_udp_client_send(struct lwm_conn_context_t* ctx, const uint8_t* data, size_
     struct posix_udp_client_t* udp;
     udp = (struct posix_udp_client_t*)ctx->opaque;
 
-    ssize_t rv = sendto(udp->fd, data, len, 0, (struct sockaddr*)&udp->addr,
+    struct sockaddr_in addr;
+    posix_udp_client_peer(udp, &addr);
+    ssize_t rv = sendto(udp->fd, data, len, 0, (struct sockaddr*)&addr,
         sizeof(struct sockaddr_in));
     if (rv < 0)
     {
@@ -97,14 +123,54 @@ posix_udp_client_recv(struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
     struct posix_udp_client_t* udp;
     udp = (struct posix_udp_client_t*)ctx->opaque;
 
+    struct sockaddr_in addr;
     socklen_t addr_len = sizeof(struct sockaddr_in);
-    ssize_t n = recvfrom(udp->fd, data, len, 0, (struct sockaddr*)&udp->addr,
+    ssize_t n = recvfrom(udp->fd, data, len, 0, (struct sockaddr*)&addr,
         &addr_len);
     if (n < 0)
     {
         WARN("posix_udp_client_recv: unable to recv data, err %s\n", strerror(errno));
         return -LWM_ERR_IO;
     }
+    posix_udp_client_learn(udp, &addr);
+    return n;
+}
+
+static int
+posix_udp_client_fd(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+
+    return ((struct posix_udp_client_t*)ctx->opaque)->fd;
+}
+
+static ssize_t
+posix_udp_client_try_recv(
+    struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+    ASSERT(data != NULL);
+    ASSERT(len > 0);
+
+    struct posix_udp_client_t* udp = (struct posix_udp_client_t*)ctx->opaque;
+
+    struct sockaddr_in addr;
+    socklen_t          addr_len = sizeof(struct sockaddr_in);
+    ssize_t            n = recvfrom(udp->fd, data, len, MSG_DONTWAIT,
+          (struct sockaddr*)&addr, &addr_len);
+    if (n < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return 0;
+        }
+        WARN("posix_udp_client_try_recv: unable to recv data, err %s\n",
+            strerror(errno));
+        return -LWM_ERR_IO;
+    }
+    posix_udp_client_learn(udp, &addr);
     return n;
 }
 
@@ -113,8 +179,13 @@ posix_udp_client_register(struct lwm_conn_context_t* ctx)
 {
     ASSERT(ctx != NULL);
 
-    ctx->open  = posix_udp_client_open;
-    ctx->close = posix_udp_client_close;
-    ctx->send  = posix_udp_client_send;
-    ctx->recv  = posix_udp_client_recv;
+    ctx->open     = posix_udp_client_open;
+    ctx->close    = posix_udp_client_close;
+    ctx->send     = posix_udp_client_send;
+    ctx->recv     = posix_udp_client_recv;
+    ctx->try_recv = posix_udp_client_try_recv;
+    ctx->fd       = posix_udp_client_fd;
+
+    /* several frames may share one datagram */
+    ctx->output_max = LWM_WRITE_BUFFER_SIZE;
 }
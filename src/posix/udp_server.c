@@ -0,0 +1,520 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* recvmmsg, pthread_setaffinity_np */
+#endif
+#include "lwmavsdk.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * One port, many clients. Every shard binds its own socket to the port
+ * with SO_REUSEPORT, the kernel hashes each peer's address to one of them
+ * and keeps sending it there. A shard's thread owns its socket, its peer
+ * table and the vehicles in it: datagrams are parsed with each peer's own
+ * state and dispatched on that thread, nothing is shared across cores.
+ * A peer silent for the server's idle_us gives its slot back, so one that
+ * reconnects from a new port does not keep the old one forever.
+ */
+
+struct posix_udp_peer_t
+{
+    int                fd;
+    struct sockaddr_in addr;
+};
+
+static enum lwm_error_t
+posix_udp_peer_open(
+    struct lwm_conn_context_t* ctx, struct lwm_conn_params_t* params)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(params != NULL);
+    ASSERT(params->type == LWM_CONN_TYPE_UDP_PEER);
+
+    struct posix_udp_peer_t* peer
+        = (struct posix_udp_peer_t*)malloc(sizeof(struct posix_udp_peer_t));
+    if (peer == NULL)
+    {
+        WARN("posix_udp_peer_open: unable to allocate peer context, err %s\n",
+            strerror(errno));
+        return LWM_ERR_NO_MEM;
+    }
+    peer->fd = params->params.udp_peer.fd;
+    memcpy(&peer->addr, params->params.udp_peer.addr,
+        sizeof(struct sockaddr_in));
+    ctx->opaque = peer;
+    return LWM_OK;
+}
+
+static void
+posix_udp_peer_close(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+
+    /* the socket belongs to the shard */
+    free(ctx->opaque);
+    ctx->opaque = NULL;
+}
+
+static enum lwm_error_t
+posix_udp_peer_send(
+    struct lwm_conn_context_t* ctx, const uint8_t* data, size_t len)
+{
+    ASSERT(ctx != NULL);
+    ASSERT(ctx->opaque != NULL);
+    ASSERT(data != NULL);
+    ASSERT(len > 0);
+
+    struct posix_udp_peer_t* peer = (struct posix_udp_peer_t*)ctx->opaque;
+    ssize_t rv = sendto(peer->fd, data, len, 0, (struct sockaddr*)&peer->addr,
+        sizeof(struct sockaddr_in));
+    if (rv < 0)
+    {
+        WARN("posix_udp_peer_send: unable to send data, err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+    return LWM_OK;
+}
+
+static ssize_t
+posix_udp_peer_recv(struct lwm_conn_context_t* ctx, uint8_t* data, size_t len)
+{
+    /* the shard hands datagrams over, see lwm_udp_shard_feed */
+    return 0;
+}
+
+void
+posix_udp_peer_register(struct lwm_conn_context_t* ctx)
+{
+    ASSERT(ctx != NULL);
+
+    ctx->open  = posix_udp_peer_open;
+    ctx->close = posix_udp_peer_close;
+    ctx->send  = posix_udp_peer_send;
+    ctx->recv  = posix_udp_peer_recv;
+
+    /* several frames may share one datagram */
+    ctx->output_max = LWM_WRITE_BUFFER_SIZE;
+}
+
+static uint32_t
+lwm_udp_peer_hash(uint32_t addr, uint16_t port)
+{
+    uint64_t key = (uint64_t)addr << 16 | port;
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull)
+        >> (64 - LWM_UDP_PEER_BITS));
+}
+
+static void
+lwm_udp_server_release(
+    struct lwm_udp_server_t* server, struct lwm_vehicle_t* vehicle)
+{
+    lwm_conn_close(&vehicle->conn);
+    vehicle->conn.status = LWM_CONN_STATUS_CLOSED;
+    if (server->release != NULL)
+    {
+        server->release(server->context, vehicle);
+    }
+}
+
+static struct lwm_udp_peer_t*
+lwm_udp_shard_peer(struct lwm_udp_shard_t* shard,
+    const struct sockaddr_in* from, uint64_t now)
+{
+    uint32_t addr = from->sin_addr.s_addr;
+    uint16_t port = from->sin_port;
+    uint32_t i    = lwm_udp_peer_hash(addr, port);
+    /* the table is never full, a free slot ends the probe */
+    for (; shard->peers[i].is_used; i = (i + 1) & (LWM_UDP_PEER_SIZE - 1))
+    {
+        if (shard->peers[i].addr == addr && shard->peers[i].port == port)
+        {
+            return &shard->peers[i];
+        }
+    }
+    if (shard->n_used >= MAX_LWM_UDP_PEER)
+    {
+        return NULL;
+    }
+
+    /* refused peers keep their slot until they expire, so they are not
+     * asked about on every datagram */
+    struct lwm_udp_server_t* server = shard->server;
+    struct lwm_udp_peer_t*   peer   = &shard->peers[i];
+    peer->addr    = addr;
+    peer->port    = port;
+    peer->is_used = true;
+    peer->last_us = now;
+    peer->vehicle = server->accept(server->context, shard->index, addr, port);
+    shard->n_used++;
+    if (peer->vehicle != NULL
+        && lwm_conn_open(&peer->vehicle->conn, LWM_CONN_TYPE_UDP_PEER,
+               shard->fd, from)
+            != LWM_OK)
+    {
+        char name[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &from->sin_addr, name, sizeof(name));
+        WARN("lwm_udp_server: unable to open peer %s:%d\n", name,
+            ntohs(port));
+        if (server->release != NULL)
+        {
+            server->release(server->context, peer->vehicle);
+        }
+        peer->vehicle = NULL;
+    }
+    /* counters are read from other threads by lwm_udp_server_stats */
+    if (peer->vehicle != NULL)
+    {
+        __atomic_store_n(
+            &shard->n_peers, shard->n_peers + 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_store_n(
+            &shard->n_refused, shard->n_refused + 1, __ATOMIC_RELAXED);
+    }
+    return peer;
+}
+
+static void
+lwm_udp_shard_expire(struct lwm_udp_shard_t* shard, uint32_t i)
+{
+    struct lwm_udp_peer_t* peers = shard->peers;
+    if (peers[i].vehicle != NULL)
+    {
+        lwm_udp_server_release(shard->server, peers[i].vehicle);
+        __atomic_store_n(
+            &shard->n_peers, shard->n_peers - 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_store_n(
+            &shard->n_refused, shard->n_refused - 1, __ATOMIC_RELAXED);
+    }
+    shard->n_used--;
+
+    /* no tombstones: pull back the peers whose probe ran over the hole */
+    const uint32_t mask = LWM_UDP_PEER_SIZE - 1;
+    for (uint32_t j = (i + 1) & mask; peers[j].is_used; j = (j + 1) & mask)
+    {
+        uint32_t home = lwm_udp_peer_hash(peers[j].addr, peers[j].port);
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            peers[i] = peers[j];
+            i        = j;
+        }
+    }
+    peers[i].is_used = false;
+    peers[i].vehicle = NULL;
+}
+
+static void
+lwm_udp_shard_feed(
+    struct lwm_vehicle_t* vehicle, const uint8_t* data, size_t len)
+{
+    struct lwm_read_buffer_t* input = &vehicle->conn.input;
+    while (len > 0)
+    {
+        size_t chunk = len < LWM_READ_BUFFER_SIZE ? len : LWM_READ_BUFFER_SIZE;
+        memcpy(input->buffer, data, chunk);
+        input->len = chunk;
+        input->pos = 0;
+        /* parses what is in the buffer, without reading */
+        lwm_vehicle_process_input(vehicle);
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+static void
+lwm_udp_shard_sweep(struct lwm_udp_shard_t* shard, uint64_t now)
+{
+    uint64_t idle_us
+        = __atomic_load_n(&shard->server->idle_us, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < LWM_UDP_PEER_SIZE; i++)
+    {
+        struct lwm_udp_peer_t* peer = &shard->peers[i];
+        /* a slot filled back by the expiry is looked at again */
+        while (peer->is_used && now - peer->last_us >= idle_us)
+        {
+            lwm_udp_shard_expire(shard, i);
+        }
+        struct lwm_vehicle_t* vehicle = peer->vehicle;
+        if (vehicle == NULL)
+        {
+            continue;
+        }
+        lwm_vehicle_drain_posted(vehicle);
+        if (lwm_vehicle_next_deadline(vehicle) != 0)
+        {
+            lwm_vehicle_process_timers(vehicle, now);
+        }
+    }
+}
+
+static void
+lwm_udp_shard_pin(struct lwm_udp_shard_t* shard)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus <= 1)
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(shard->index % (uint32_t)cpus, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+    if (err != 0)
+    {
+        INFO("lwm_udp_server: shard %u not pinned, err %s\n", shard->index,
+            strerror(err));
+    }
+}
+
+static void*
+lwm_udp_shard_main(void* arg)
+{
+    struct lwm_udp_shard_t* shard = arg;
+    struct mmsghdr          msgs[LWM_UDP_BATCH];
+    struct iovec            iov[LWM_UDP_BATCH];
+    struct sockaddr_in      from[LWM_UDP_BATCH];
+
+    lwm_udp_shard_pin(shard);
+    memset(msgs, 0, sizeof(msgs));
+    for (uint32_t i = 0; i < LWM_UDP_BATCH; i++)
+    {
+        iov[i].iov_base            = shard->buffers[i];
+        iov[i].iov_len             = LWM_UDP_DATAGRAM_SIZE;
+        msgs[i].msg_hdr.msg_iov    = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name   = &from[i];
+    }
+
+    while (!__atomic_load_n(&shard->server->is_stopping, __ATOMIC_ACQUIRE))
+    {
+        for (uint32_t i = 0; i < LWM_UDP_BATCH; i++)
+        {
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        }
+        /* blocks for the first, at most SO_RCVTIMEO, takes what is queued
+         * behind it */
+        int n = recvmmsg(shard->fd, msgs, LWM_UDP_BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                WARN("lwm_udp_server: shard %u stopped, err %s\n",
+                    shard->index, strerror(errno));
+                break;
+            }
+            n = 0;
+        }
+
+        uint64_t now     = time_us();
+        uint64_t dropped = 0;
+        for (int i = 0; i < n; i++)
+        {
+            struct lwm_udp_peer_t* peer
+                = lwm_udp_shard_peer(shard, &from[i], now);
+            if (peer == NULL || peer->vehicle == NULL
+                || (msgs[i].msg_hdr.msg_flags & MSG_TRUNC))
+            {
+                dropped++;
+                continue;
+            }
+            peer->last_us = now;
+            lwm_udp_shard_feed(
+                peer->vehicle, shard->buffers[i], msgs[i].msg_len);
+        }
+        /* counters are read from other threads by lwm_udp_server_stats */
+        __atomic_store_n(
+            &shard->datagrams, shard->datagrams + n, __ATOMIC_RELAXED);
+        __atomic_store_n(
+            &shard->dropped, shard->dropped + dropped, __ATOMIC_RELAXED);
+
+        if (now >= shard->sweep_us)
+        {
+            lwm_udp_shard_sweep(shard, now);
+            shard->sweep_us = now + LWM_UDP_WAIT_US;
+        }
+    }
+    return NULL;
+}
+
+static enum lwm_error_t
+lwm_udp_shard_open(struct lwm_udp_server_t* server,
+    struct lwm_udp_shard_t* shard, uint32_t index)
+{
+    memset(shard, 0, sizeof(struct lwm_udp_shard_t));
+    shard->index  = index;
+    shard->server = server;
+    shard->fd     = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
+    if (shard->fd < 0)
+    {
+        WARN("lwm_udp_server_start: unable to open udp socket, err %s\n",
+            strerror(errno));
+        return LWM_ERR_IO;
+    }
+
+    int            one = 1;
+    struct timeval wait;
+    wait.tv_sec  = 0;
+    wait.tv_usec = LWM_UDP_WAIT_US;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(server->port);
+    addr.sin_addr.s_addr = INADDR_ANY;
+    if (setsockopt(shard->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0
+        || setsockopt(shard->fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait))
+            < 0
+        || bind(shard->fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in))
+            < 0)
+    {
+        WARN("lwm_udp_server_start: unable to bind port %d, err %s\n",
+            server->port, strerror(errno));
+        close(shard->fd);
+        return LWM_ERR_IO;
+    }
+    /* bursts from the whole swarm queue here, the kernel caps it at
+     * net.core.rmem_max */
+    int size = LWM_UDP_RCVBUF_SIZE;
+    setsockopt(shard->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    if (server->port == 0)
+    {
+        /* the others join the group on the port the kernel picked */
+        socklen_t len = sizeof(struct sockaddr_in);
+        getsockname(shard->fd, (struct sockaddr*)&addr, &len);
+        server->port = ntohs(addr.sin_port);
+    }
+    return LWM_OK;
+}
+
+static void
+lwm_udp_server_join(struct lwm_udp_server_t* server, uint32_t started)
+{
+    __atomic_store_n(&server->is_stopping, true, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < started; i++)
+    {
+        pthread_join(server->shards[i].thread, NULL);
+    }
+}
+
+static void
+lwm_udp_server_close(struct lwm_udp_server_t* server, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        struct lwm_udp_shard_t* shard = &server->shards[i];
+        for (uint32_t j = 0; j < LWM_UDP_PEER_SIZE; j++)
+        {
+            struct lwm_vehicle_t* vehicle = shard->peers[j].vehicle;
+            if (vehicle == NULL)
+            {
+                continue;
+            }
+            lwm_udp_server_release(server, vehicle);
+            shard->peers[j].vehicle = NULL;
+        }
+        close(shard->fd);
+    }
+}
+
+enum lwm_error_t
+lwm_udp_server_start(struct lwm_udp_server_t* server, uint16_t port,
+    uint32_t n, lwm_udp_accept_t accept, lwm_udp_release_t release,
+    void* context)
+{
+    ASSERT(server != NULL);
+    ASSERT(accept != NULL);
+
+    if (n == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n         = cpus > 0 ? (uint32_t)cpus : 1;
+    }
+    if (n > MAX_LWM_UDP_SHARD)
+    {
+        n = MAX_LWM_UDP_SHARD;
+    }
+    server->port        = port;
+    server->n           = 0;
+    server->is_stopping = false;
+    server->accept      = accept;
+    server->release     = release;
+    server->context     = context;
+    server->idle_us     = LWM_UDP_PEER_IDLE_US;
+
+    /* the whole group is bound before anything is read, so a peer is not
+     * hashed to another shard once it has a vehicle */
+    enum lwm_error_t err = LWM_OK;
+    uint32_t         i;
+    for (i = 0; i < n && err == LWM_OK; i++)
+    {
+        err = lwm_udp_shard_open(server, &server->shards[i], i);
+    }
+    if (err != LWM_OK)
+    {
+        lwm_udp_server_close(server, i - 1);
+        return err;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        int rv = pthread_create(&server->shards[i].thread, NULL,
+            lwm_udp_shard_main, &server->shards[i]);
+        if (rv != 0)
+        {
+            WARN("lwm_udp_server_start: unable to create thread, err %s\n",
+                strerror(rv));
+            lwm_udp_server_join(server, i);
+            lwm_udp_server_close(server, n);
+            return LWM_ERR_NO_MEM;
+        }
+    }
+    server->n = n;
+    return LWM_OK;
+}
+
+void
+lwm_udp_server_stop(struct lwm_udp_server_t* server)
+{
+    ASSERT(server != NULL);
+
+    lwm_udp_server_join(server, server->n);
+    lwm_udp_server_close(server, server->n);
+    server->n = 0;
+}
+
+void
+lwm_udp_server_set_idle(struct lwm_udp_server_t* server, uint64_t idle_us)
+{
+    ASSERT(server != NULL);
+
+    __atomic_store_n(&server->idle_us, idle_us, __ATOMIC_RELAXED);
+}
+
+void
+lwm_udp_server_stats(
+    struct lwm_udp_server_t* server, struct lwm_udp_server_stats_t* stats)
+{
+    ASSERT(server != NULL);
+    ASSERT(stats != NULL);
+
+    memset(stats, 0, sizeof(struct lwm_udp_server_stats_t));
+    for (uint32_t i = 0; i < server->n; i++)
+    {
+        struct lwm_udp_shard_t* shard = &server->shards[i];
+        stats->peers += __atomic_load_n(&shard->n_peers, __ATOMIC_RELAXED);
+        stats->refused
+            += __atomic_load_n(&shard->n_refused, __ATOMIC_RELAXED);
+        stats->datagrams
+            += __atomic_load_n(&shard->datagrams, __ATOMIC_RELAXED);
+        stats->dropped += __atomic_load_n(&shard->dropped, __ATOMIC_RELAXED);
+    }
+}
@@ -0,0 +1,217 @@
+#include "lwmavsdk.h"
+
+#include <errno.h>
+#include <sched.h>
+
+/*
+ * Handlers of services marked `on_worker` run on a small thread pool. The
+ * dispatcher still parses, admits and rate limits on its own thread and
+ * only hands the copied delivery over, through one single-producer
+ * single-consumer ring per worker. A service always maps to the same
+ * worker, so its handler never runs concurrently with itself and sees
+ * messages in the order they arrived.
+ */
+
+#define LWM_WORKER_QUEUE_MASK (LWM_WORKER_QUEUE_SIZE - 1)
+
+static struct lwm_worker_t*
+lwm_workers_shard(
+    struct lwm_workers_t* workers, const struct lwm_microservice_t* service)
+{
+    /* services sit in pool arrays, consecutive ones land on different
+     * workers */
+    uintptr_t slot = (uintptr_t)service / sizeof(struct lwm_microservice_t);
+    return &workers->workers[slot % workers->n];
+}
+
+static void
+lwm_worker_run(struct lwm_worker_job_t* job)
+{
+    if (job->deliver != NULL)
+    {
+        struct lwm_decoded_t  decoded;
+        struct lwm_delivery_t delivery;
+        decoded.is_valid      = false;
+        delivery.msg          = &job->msg;
+        delivery.subscription = NULL;
+        delivery.index        = job->index;
+        delivery.skipped      = job->skipped;
+        delivery.time_us      = job->time_us;
+        delivery.decoded      = &decoded;
+        job->deliver(job->context, &delivery);
+    }
+    else
+    {
+        job->handler(job->context, &job->msg);
+    }
+}
+
+static void
+lwm_worker_sleep(struct lwm_worker_t* worker, uint32_t head)
+{
+    pthread_mutex_lock(&worker->lock);
+    /* pairs with the load in lwm_workers_submit: either the dispatcher sees
+     * us sleeping, or we see its job */
+    __atomic_store_n(&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&worker->tail, __ATOMIC_SEQ_CST) == head
+        && !__atomic_load_n(&worker->pool->is_stopping, __ATOMIC_SEQ_CST))
+    {
+        pthread_cond_wait(&worker->wake, &worker->lock);
+    }
+    __atomic_store_n(&worker->sleeping, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static void*
+lwm_worker_main(void* arg)
+{
+    struct lwm_worker_t* worker = arg;
+    for (;;)
+    {
+        uint32_t head = worker->head;
+        uint32_t tail = __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            /* queued jobs still run when stopping */
+            if (__atomic_load_n(&worker->pool->is_stopping, __ATOMIC_ACQUIRE))
+            {
+                return NULL;
+            }
+            lwm_worker_sleep(worker, head);
+            continue;
+        }
+
+        lwm_worker_run(&worker->jobs[head & LWM_WORKER_QUEUE_MASK]);
+        /* the slot is only reused once the job is done with it */
+        __atomic_store_n(&worker->head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+lwm_worker_wake(struct lwm_worker_t* worker)
+{
+    pthread_mutex_lock(&worker->lock);
+    pthread_cond_signal(&worker->wake);
+    pthread_mutex_unlock(&worker->lock);
+}
+
+static void
+lwm_workers_join(struct lwm_workers_t* workers, uint32_t n)
+{
+    __atomic_store_n(&workers->is_stopping, true, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        struct lwm_worker_t* worker = &workers->workers[i];
+        lwm_worker_wake(worker);
+        pthread_join(worker->thread, NULL);
+        pthread_cond_destroy(&worker->wake);
+        pthread_mutex_destroy(&worker->lock);
+    }
+}
+
+enum lwm_error_t
+lwm_workers_start(
+    struct lwm_vehicle_t* vehicle, struct lwm_workers_t* workers, uint32_t n)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(workers != NULL);
+    ASSERT(vehicle->workers == NULL);
+
+    if (n == 0 || n > MAX_LWM_WORKER)
+    {
+        return LWM_ERR_BAD_PARAM;
+    }
+
+    memset(workers, 0, sizeof(struct lwm_workers_t));
+    workers->n = n;
+    for (uint32_t i = 0; i < n; i++)
+    {
+        struct lwm_worker_t* worker = &workers->workers[i];
+        worker->pool                = workers;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_cond_init(&worker->wake, NULL);
+
+        int err = pthread_create(&worker->thread, NULL, lwm_worker_main, worker);
+        if (err != 0)
+        {
+            WARN("lwm_workers_start: unable to create worker, err %s\n",
+                strerror(err));
+            pthread_cond_destroy(&worker->wake);
+            pthread_mutex_destroy(&worker->lock);
+            lwm_workers_join(workers, i);
+            return LWM_ERR_NO_MEM;
+        }
+    }
+    vehicle->workers = workers;
+    return LWM_OK;
+}
+
+bool
+lwm_workers_submit(struct lwm_workers_t* workers,
+    struct lwm_subscription_t* sub, struct lwm_delivery_t* delivery)
+{
+    struct lwm_microservice_t* service = sub->service;
+    struct lwm_worker_t*       worker  = lwm_workers_shard(workers, service);
+
+    uint32_t tail = worker->tail;
+    uint32_t used = tail - __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE);
+    if (used >= LWM_WORKER_QUEUE_SIZE)
+    {
+        worker->overflow++;
+        return false;
+    }
+    if (used + 1 > worker->high_water)
+    {
+        worker->high_water = used + 1;
+    }
+
+    struct lwm_worker_job_t* job = &worker->jobs[tail & LWM_WORKER_QUEUE_MASK];
+    memcpy(&job->msg, delivery->msg, sizeof(mavlink_message_t));
+    job->context = service->context;
+    job->handler = service->handler;
+    job->deliver = service->deliver;
+    job->index   = sub->index;
+    job->skipped = delivery->skipped;
+    job->time_us = delivery->time_us;
+
+    __atomic_store_n(&worker->tail, tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&worker->sleeping, __ATOMIC_SEQ_CST))
+    {
+        lwm_worker_wake(worker);
+    }
+    return true;
+}
+
+void
+lwm_workers_drain(struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(vehicle != NULL);
+
+    struct lwm_workers_t* workers = vehicle->workers;
+    if (workers == NULL)
+    {
+        return;
+    }
+    for (uint32_t i = 0; i < workers->n; i++)
+    {
+        struct lwm_worker_t* worker = &workers->workers[i];
+        while (__atomic_load_n(&worker->head, __ATOMIC_ACQUIRE) != worker->tail)
+        {
+            sched_yield();
+        }
+    }
+}
+
+void
+lwm_workers_stop(struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(vehicle != NULL);
+
+    struct lwm_workers_t* workers = vehicle->workers;
+    if (workers == NULL)
+    {
+        return;
+    }
+    vehicle->workers = NULL;
+    lwm_workers_join(workers, workers->n);
+}
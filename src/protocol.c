@@ -16,32 +16,81 @@ lwm_action_init(
     action->except_msgid_list.n = 0;
     action->timeout_time        = 0;
     action->then                = NULL;
+    action->service             = NULL;
     action->except              = NULL;
     action->timeout             = NULL;
     action->result              = NULL;
+    action->next                = NULL;
 }
 
+/*
+ * Actions waiting for a response within a deadline hang off the vehicle, so
+ * the deadline fires without anyone polling the action. The vehicle keeps
+ * the earliest one, as for waiters.
+ */
+
 static void
-lwm_action_destroy_microservices(struct lwm_action_t* action)
+lwm_action_recompute(struct lwm_vehicle_t* vehicle)
 {
-    ASSERT(action != NULL);
+    uint64_t deadline = 0;
+    for (struct lwm_action_t* a = vehicle->actions; a != NULL; a = a->next)
+    {
+        if (deadline == 0 || a->timeout_time < deadline)
+        {
+            deadline = a->timeout_time;
+        }
+    }
+    vehicle->action_deadline_us = deadline;
+}
 
-    struct lwm_vehicle_t *vehicle = action->vehicle;
-    for (size_t i = 0; i < action->except_msgid_list.n; i++)
+static void
+lwm_action_link(struct lwm_action_t* action)
+{
+    /* not linked: submit has taken it off the list */
+    struct lwm_vehicle_t* vehicle = action->vehicle;
+    action->next     = vehicle->actions;
+    vehicle->actions = action;
+    if (vehicle->action_deadline_us == 0
+        || action->timeout_time < vehicle->action_deadline_us)
     {
-        lwm_microservice_destroy(vehicle,
-                action->except_msgid_list.microservice[i]);
-        action->except_msgid_list.microservice[i] = NULL;
+        vehicle->action_deadline_us = action->timeout_time;
     }
-    for (size_t i = 0; i < action->then_msgid_list.n; i++)
+}
+
+static void
+lwm_action_unlink(struct lwm_action_t* action)
+{
+    struct lwm_vehicle_t* vehicle = action->vehicle;
+    struct lwm_action_t** link    = &vehicle->actions;
+    while (*link != NULL)
     {
-        lwm_microservice_destroy(vehicle,
-                action->then_msgid_list.microservice[i]);
-        action->then_msgid_list.microservice[i] = NULL;
+        if (*link == action)
+        {
+            *link        = action->next;
+            action->next = NULL;
+            lwm_action_recompute(vehicle);
+            return;
+        }
+        link = &(*link)->next;
     }
 }
 
 static void
+lwm_action_destroy_microservices(struct lwm_action_t* action)
+{
+    ASSERT(action != NULL);
+
+    /* every way an action ends goes through here, the caller may reuse or
+     * drop it right after */
+    lwm_action_unlink(action);
+    if (action->service != NULL)
+    {
+        lwm_microservice_destroy(action->vehicle, action->service);
+        action->service = NULL;
+    }
+}
+
+static enum lwm_error_t
 lwm_do_execute(struct lwm_action_t* action)
 {
     enum lwm_error_t err;
@@ -60,60 +109,49 @@ lwm_do_execute(struct lwm_action_t* action)
         lwm_action_destroy_microservices(action);
         action->status = LWM_ACTION_FAILED;
     }
+    return err;
 }
 
 
 
 
 static void
-lwm_action_microservice_handler(void* context, mavlink_message_t* msg)
+lwm_action_microservice_deliver(void* context, struct lwm_delivery_t* delivery)
 {
     ASSERT(context != NULL);
-    ASSERT(msg != NULL);
+    ASSERT(delivery != NULL);
 
     struct lwm_action_t*      action = context;
     struct lwm_action_param_t param;
-    param.action         = action;
-    param.event          = LWM_EVENT_MSG;
-    param.detail.msg.msg = msg;
-
-    /* if the message in the `then` list */
-    struct lwm_msgid_list_t* msgid_list = &action->then_msgid_list;
-    ASSERT(msgid_list->n <= SIZEOF_ARRAY(msgid_list->msgid));
+    param.action              = action;
+    param.event               = LWM_EVENT_MSG;
+    param.detail.msg.msg      = delivery->msg;
+    param.detail.msg.delivery = delivery;
 
-    for (size_t i = 0; i < msgid_list->n; i++)
+    /* `then` msgids are indexed first, `except` msgids after them */
+    if (delivery->index < LWM_MSGID_LIST_SIZE)
     {
-        if (msg->msgid == msgid_list->msgid[i])
+        enum lwm_action_continuation_t continuation
+            = action->then(action, &param);
+        switch (continuation)
         {
-            enum lwm_action_continuation_t continuation
-                = action->then(action, &param);
-            switch (continuation)
-            {
-            case LWM_ACTION_CONTINUE: break;
-            case LWM_ACTION_STOP:
-                lwm_action_destroy_microservices(action);
-                action->status = LWM_ACTION_FINISHED;
-                break;
-            case LWM_ACTION_RESTART:
-                lwm_do_execute(action);
-                action->status = LWM_ACTION_EXECUTING;
-                break;
-            default: break;
-            }
-            return;
+        case LWM_ACTION_CONTINUE: break;
+        case LWM_ACTION_STOP:
+            lwm_action_destroy_microservices(action);
+            action->status = LWM_ACTION_FINISHED;
+            break;
+        case LWM_ACTION_RESTART:
+            lwm_do_execute(action);
+            action->status = LWM_ACTION_EXECUTING;
+            break;
+        default: break;
         }
     }
-    /* if the message in the `except` list */
-    msgid_list = &action->except_msgid_list;
-    for (size_t i = 0; i < msgid_list->n; i++)
+    else
     {
-        if (msg->msgid == msgid_list->msgid[i])
-        {
-            action->except(action, &param);
-            action->status = LWM_ACTION_FAILED;
-            lwm_action_destroy_microservices(action);
-            return;
-        }
+        action->except(action, &param);
+        action->status = LWM_ACTION_FAILED;
+        lwm_action_destroy_microservices(action);
     }
 }
 
@@ -134,53 +172,74 @@ lwm_action_timeout_handler(struct lwm_action_t* action, uint64_t time)
     lwm_action_destroy_microservices(action);
 }
 
-void
+static enum lwm_error_t
+lwm_action_subscribe(struct lwm_action_t* action)
+{
+    struct lwm_vehicle_t* vehicle = action->vehicle;
+    if (action->then_msgid_list.n == 0 && action->except_msgid_list.n == 0)
+    {
+        return LWM_OK;
+    }
+
+    /* one service for the whole action, the index tells the lists apart */
+    struct lwm_microservice_t* service = lwm_microservice_create(vehicle);
+    if (service == NULL)
+    {
+        return LWM_ERR_NO_MEM;
+    }
+    service->context = action;
+    service->deliver = lwm_action_microservice_deliver;
+    action->service  = service;
+
+    /* `then` first: a msgid in both lists keeps its `then` index */
+    enum lwm_error_t err = lwm_microservice_add_set(vehicle,
+        action->then_msgid_list.msgid, action->then_msgid_list.n, service);
+    for (size_t i = 0; err == LWM_OK && i < action->except_msgid_list.n; i++)
+    {
+        err = lwm_microservice_add_indexed(vehicle,
+            action->except_msgid_list.msgid[i], LWM_MSGID_LIST_SIZE + i,
+            service);
+    }
+    return err;
+}
+
+enum lwm_error_t
 lwm_action_submit(struct lwm_action_t* action, uint64_t timeout_us)
 {
     ASSERT(action != NULL);
     ASSERT(action->vehicle != NULL);
 
-
-    if(action->except_msgid_list.n > 0 || action->then_msgid_list.n > 0)
+    /* submitted again while running: its old service and deadline go */
+    lwm_action_destroy_microservices(action);
+    enum lwm_error_t err = lwm_action_subscribe(action);
+    if (err != LWM_OK)
     {
-        struct lwm_vehicle_t*      vehicle = action->vehicle;
-        for (size_t i = 0; i < action->except_msgid_list.n; i++)
-        {
-            struct lwm_microservice_t* action_service
-                = lwm_microservice_create(vehicle);
-            ASSERT(action_service != NULL); /* graceful realloc */
-
-            action_service->context = action;
-            action_service->handler = lwm_action_microservice_handler;
-
-            lwm_microservice_add_to(
-                vehicle, action->except_msgid_list.msgid[i], action_service);
-
-            action->except_msgid_list.microservice[i] = action_service;
-        }
-        for (size_t i = 0; i < action->then_msgid_list.n; i++)
+        /* out of services or subscriptions: fail the action, not the process */
+        WARN("action submit failed: %d\n", err);
+        if (action->except != NULL)
         {
-            struct lwm_microservice_t* action_service
-                = lwm_microservice_create(vehicle);
-            ASSERT(action_service != NULL); /* graceful realloc */
-
-            action_service->context = action;
-            action_service->handler = lwm_action_microservice_handler;
-
-            lwm_microservice_add_to(
-                vehicle, action->then_msgid_list.msgid[i], action_service);
-
-            action->then_msgid_list.microservice[i] = action_service;
+            struct lwm_action_param_t param;
+            param.action          = action;
+            param.event           = LWM_EVENT_FAIL;
+            param.detail.fail.err = err;
+            action->except(action, &param);
         }
+        lwm_action_destroy_microservices(action);
+        action->status = LWM_ACTION_FAILED;
+        return err;
     }
 
     if (timeout_us > 0)
     {
         action->timeout_time = time_us() + timeout_us;
         INFO("timeout_us: %llu (%llu)\n", timeout_us, action->timeout_time);
+        if (action->then_msgid_list.n > 0)
+        {
+            lwm_action_link(action);
+        }
     }
 
-    lwm_do_execute(action);
+    return lwm_do_execute(action);
 }
 
 enum lwm_error_t
@@ -210,6 +269,23 @@ lwm_action_poll_once(struct lwm_action_t* action)
     return err;
 }
 
+enum lwm_error_t
+lwm_action_expire(struct lwm_action_t* action, uint64_t now_us)
+{
+    ASSERT(action != NULL);
+
+    if (action->status != LWM_ACTION_EXECUTING)
+    {
+        return LWM_ERR_STOPPED;
+    }
+    if (action->timeout_time == 0 || now_us <= action->timeout_time)
+    {
+        return LWM_OK;
+    }
+    lwm_action_timeout_handler(action, action->timeout_time);
+    return LWM_ERR_TIMEOUT;
+}
+
 enum lwm_error_t
 lwm_action_poll(struct lwm_action_t* action)
 {
@@ -230,6 +306,35 @@ lwm_action_poll(struct lwm_action_t* action)
     return err;
 }
 
+void
+lwm_action_notify(struct lwm_vehicle_t* vehicle, uint64_t now_us)
+{
+    ASSERT(vehicle != NULL);
+
+    if (vehicle->action_deadline_us == 0
+        || now_us <= vehicle->action_deadline_us)
+    {
+        return;
+    }
+    struct lwm_action_t* a = vehicle->actions;
+    while (a != NULL)
+    {
+        /* expiring unlinks it, and its timeout may submit others */
+        struct lwm_action_t* next = a->next;
+        enum lwm_error_t     err  = lwm_action_expire(a, now_us);
+        if (err == LWM_ERR_TIMEOUT)
+        {
+            next = vehicle->actions;
+        }
+        else if (err == LWM_ERR_STOPPED)
+        {
+            /* ended by a handler that only set its status */
+            lwm_action_unlink(a);
+        }
+        a = next;
+    }
+}
+
 void
 _lwm_action_upon_msgid(struct lwm_msgid_list_t* list, uint32_t *args, size_t n)
 {
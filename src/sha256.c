@@ -0,0 +1,347 @@
+#include "lwmavsdk.h"
+
+/*
+ * SHA-256 for MAVLink 2 signing.
+ *
+ * The block function is picked once at runtime: SHA-NI on x86-64, the ARMv8
+ * crypto extensions on aarch64, and a portable C implementation everywhere
+ * else (including baremetal, where no intrinsics headers are available).
+ */
+
+#if (defined(POSIX_LIBC) || defined(_MUSL_)) && defined(__x86_64__)
+#define LWM_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#elif (defined(POSIX_LIBC) || defined(_MUSL_)) && defined(__aarch64__) \
+    && defined(__linux__)
+#define LWM_SHA256_ARM
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+#endif
+
+typedef void (*lwm_sha256_block_t)(
+    uint32_t state[8], const uint8_t* data, size_t n_blocks);
+
+static const uint32_t lwm_sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void
+lwm_sha256_block_generic(uint32_t state[8], const uint8_t* data, size_t n_blocks)
+{
+    uint32_t w[64];
+
+    for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            w[i] = ((uint32_t)data[4 * i] << 24)
+                | ((uint32_t)data[4 * i + 1] << 16)
+                | ((uint32_t)data[4 * i + 2] << 8) | (uint32_t)data[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++)
+        {
+            uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18)
+                ^ (w[i - 15] >> 3);
+            uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19)
+                ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+        for (int i = 0; i < 64; i++)
+        {
+            uint32_t s1  = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+            uint32_t ch  = (e & f) ^ (~e & g);
+            uint32_t t1  = h + s1 + ch + lwm_sha256_k[i] + w[i];
+            uint32_t s0  = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t t2  = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+}
+
+#if defined(LWM_SHA256_X86)
+__attribute__((target("sha,sse4.1"))) static void
+lwm_sha256_block_shani(uint32_t state[8], const uint8_t* data, size_t n_blocks)
+{
+    const __m128i mask
+        = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i w[4];
+    __m128i tmp, msg, abef, cdgh;
+
+    /* state is kept as ABEF/CDGH, the layout sha256rnds2 works on */
+    tmp  = _mm_loadu_si128((const __m128i*)&state[0]);
+    cdgh = _mm_loadu_si128((const __m128i*)&state[4]);
+    tmp  = _mm_shuffle_epi32(tmp, 0xB1);
+    cdgh = _mm_shuffle_epi32(cdgh, 0x1B);
+    abef = _mm_alignr_epi8(tmp, cdgh, 8);
+    cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+
+    for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+        __m128i abef_save = abef;
+        __m128i cdgh_save = cdgh;
+
+        for (int g = 0; g < 16; g++)
+        {
+            __m128i* cur = &w[g & 3];
+            if (g < 4)
+            {
+                *cur = _mm_shuffle_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + 16 * g)), mask);
+            }
+            else
+            {
+                __m128i prev1 = w[(g + 3) & 3];
+                __m128i prev2 = w[(g + 2) & 3];
+                tmp  = _mm_sha256msg1_epu32(*cur, w[(g + 1) & 3]);
+                tmp  = _mm_add_epi32(tmp, _mm_alignr_epi8(prev1, prev2, 4));
+                *cur = _mm_sha256msg2_epu32(tmp, prev1);
+            }
+            msg = _mm_add_epi32(
+                *cur, _mm_loadu_si128((const __m128i*)&lwm_sha256_k[4 * g]));
+            cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);
+            msg  = _mm_shuffle_epi32(msg, 0x0E);
+            abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);
+        }
+
+        abef = _mm_add_epi32(abef, abef_save);
+        cdgh = _mm_add_epi32(cdgh, cdgh_save);
+    }
+
+    tmp  = _mm_shuffle_epi32(abef, 0x1B);
+    cdgh = _mm_shuffle_epi32(cdgh, 0xB1);
+    abef = _mm_blend_epi16(tmp, cdgh, 0xF0);
+    cdgh = _mm_alignr_epi8(cdgh, tmp, 8);
+    _mm_storeu_si128((__m128i*)&state[0], abef);
+    _mm_storeu_si128((__m128i*)&state[4], cdgh);
+}
+
+static bool
+lwm_sha256_has_hw(void)
+{
+    unsigned int a, b, c, d;
+    if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+    {
+        return false;
+    }
+    bool sha = (b & (1u << 29)) != 0;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+    {
+        return false;
+    }
+    bool sse41 = (c & (1u << 19)) != 0;
+    bool ssse3 = (c & (1u << 9)) != 0;
+    return sha && sse41 && ssse3;
+}
+#endif /* LWM_SHA256_X86 */
+
+#if defined(LWM_SHA256_ARM)
+__attribute__((target("+crypto"))) static void
+lwm_sha256_block_armv8(uint32_t state[8], const uint8_t* data, size_t n_blocks)
+{
+    uint32x4_t abcd = vld1q_u32(&state[0]);
+    uint32x4_t efgh = vld1q_u32(&state[4]);
+    uint32x4_t w[4];
+
+    for (; n_blocks > 0; n_blocks--, data += 64)
+    {
+        uint32x4_t abcd_save = abcd;
+        uint32x4_t efgh_save = efgh;
+
+        for (int g = 0; g < 16; g++)
+        {
+            uint32x4_t* cur = &w[g & 3];
+            if (g < 4)
+            {
+                *cur = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * g)));
+            }
+            else
+            {
+                *cur = vsha256su1q_u32(vsha256su0q_u32(*cur, w[(g + 1) & 3]),
+                    w[(g + 2) & 3], w[(g + 3) & 3]);
+            }
+            uint32x4_t msg  = vaddq_u32(*cur, vld1q_u32(&lwm_sha256_k[4 * g]));
+            uint32x4_t prev = abcd;
+            abcd            = vsha256hq_u32(abcd, efgh, msg);
+            efgh            = vsha256h2q_u32(efgh, prev, msg);
+        }
+
+        abcd = vaddq_u32(abcd, abcd_save);
+        efgh = vaddq_u32(efgh, efgh_save);
+    }
+
+    vst1q_u32(&state[0], abcd);
+    vst1q_u32(&state[4], efgh);
+}
+
+static bool
+lwm_sha256_has_hw(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+}
+#endif /* LWM_SHA256_ARM */
+
+static lwm_sha256_block_t lwm_sha256_block      = NULL;
+static const char*        lwm_sha256_block_name = "generic";
+
+static lwm_sha256_block_t
+lwm_sha256_select(void)
+{
+    if (lwm_sha256_block == NULL)
+    {
+        lwm_sha256_block = lwm_sha256_block_generic;
+#if defined(LWM_SHA256_X86)
+        if (lwm_sha256_has_hw())
+        {
+            lwm_sha256_block      = lwm_sha256_block_shani;
+            lwm_sha256_block_name = "sha-ni";
+        }
+#elif defined(LWM_SHA256_ARM)
+        if (lwm_sha256_has_hw())
+        {
+            lwm_sha256_block      = lwm_sha256_block_armv8;
+            lwm_sha256_block_name = "armv8-ce";
+        }
+#endif
+    }
+    return lwm_sha256_block;
+}
+
+const char*
+lwm_sha256_backend(void)
+{
+    lwm_sha256_select();
+    return lwm_sha256_block_name;
+}
+
+void
+lwm_sha256_force_generic(bool generic)
+{
+    lwm_sha256_block      = NULL;
+    lwm_sha256_block_name = "generic";
+    if (generic)
+    {
+        lwm_sha256_block = lwm_sha256_block_generic;
+    }
+}
+
+void
+lwm_sha256_init(struct lwm_sha256_t* ctx)
+{
+    ASSERT(ctx != NULL);
+
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count    = 0;
+}
+
+void
+lwm_sha256_update(struct lwm_sha256_t* ctx, const void* data, size_t len)
+{
+    ASSERT(ctx != NULL);
+
+    lwm_sha256_block_t block = lwm_sha256_select();
+    const uint8_t*     p     = (const uint8_t*)data;
+    size_t             used  = (size_t)(ctx->count & 63);
+
+    ctx->count += len;
+    if (used > 0)
+    {
+        size_t fill = 64 - used;
+        if (len < fill)
+        {
+            memcpy(&ctx->buffer[used], p, len);
+            return;
+        }
+        memcpy(&ctx->buffer[used], p, fill);
+        block(ctx->state, ctx->buffer, 1);
+        p += fill;
+        len -= fill;
+    }
+    if (len >= 64)
+    {
+        block(ctx->state, p, len / 64);
+        p += len & ~(size_t)63;
+        len &= 63;
+    }
+    if (len > 0)
+    {
+        memcpy(ctx->buffer, p, len);
+    }
+}
+
+void
+lwm_sha256_final(struct lwm_sha256_t* ctx, uint8_t digest[32])
+{
+    ASSERT(ctx != NULL);
+    ASSERT(digest != NULL);
+
+    lwm_sha256_block_t block = lwm_sha256_select();
+    uint64_t           bits  = ctx->count * 8;
+    size_t             used  = (size_t)(ctx->count & 63);
+
+    ctx->buffer[used++] = 0x80;
+    if (used > 56)
+    {
+        memset(&ctx->buffer[used], 0, 64 - used);
+        block(ctx->state, ctx->buffer, 1);
+        used = 0;
+    }
+    memset(&ctx->buffer[used], 0, 56 - used);
+    for (int i = 0; i < 8; i++)
+    {
+        ctx->buffer[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    block(ctx->state, ctx->buffer, 1);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i]     = (uint8_t)(ctx->state[i] >> 24);
+        digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+        digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+        digest[4 * i + 3] = (uint8_t)(ctx->state[i]);
+    }
+}
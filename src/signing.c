@@ -0,0 +1,223 @@
+#include "lwmavsdk.h"
+
+/*
+ * MAVLink 2 message signing.
+ *
+ * signature = link id (1) | timestamp (6) | sha256(secret key | header |
+ *             payload | crc | link id | timestamp)[0:6]
+ */
+
+static uint64_t
+lwm_signing_wallclock(void)
+{
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000ull;
+    if (now < LWM_SIGNING_EPOCH_US)
+    {
+        return 0;
+    }
+    return (now - LWM_SIGNING_EPOCH_US) / 10;
+#else
+    /* no wall clock, timestamps only move forward from the last one seen */
+    return 0;
+#endif
+}
+
+/*
+ * The timestamp is shared by signing and verifying, which an I/O thread
+ * runs apart from the sending thread: it only moves forward through
+ * compare-and-swap. The streams are touched by the receiving side alone.
+ */
+
+static uint64_t
+lwm_signing_next_timestamp(struct lwm_signing_t* signing)
+{
+    uint64_t now  = lwm_signing_wallclock();
+    uint64_t last = __atomic_load_n(&signing->timestamp, __ATOMIC_RELAXED);
+    uint64_t next;
+    do
+    {
+        next = now > last ? now : last + 1;
+    } while (!__atomic_compare_exchange_n(&signing->timestamp, &last, next,
+        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return next;
+}
+
+static void
+lwm_signing_seen_timestamp(struct lwm_signing_t* signing, uint64_t ts)
+{
+    uint64_t last = __atomic_load_n(&signing->timestamp, __ATOMIC_RELAXED);
+    while (ts > last
+        && !__atomic_compare_exchange_n(&signing->timestamp, &last, ts, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+static void
+lwm_signing_header(
+    const mavlink_message_t* msg, uint8_t header[MAVLINK_NUM_HEADER_BYTES])
+{
+    header[0] = msg->magic;
+    header[1] = msg->len;
+    header[2] = msg->incompat_flags;
+    header[3] = msg->compat_flags;
+    header[4] = msg->seq;
+    header[5] = msg->sysid;
+    header[6] = msg->compid;
+    header[7] = msg->msgid & 0xFF;
+    header[8] = (msg->msgid >> 8) & 0xFF;
+    header[9] = (msg->msgid >> 16) & 0xFF;
+}
+
+static void
+lwm_signing_digest(const struct lwm_signing_t* signing, const uint8_t* header,
+    const mavlink_message_t* msg, const uint8_t* crc, const uint8_t* signature,
+    uint8_t out[6])
+{
+    struct lwm_sha256_t sha;
+    uint8_t             digest[32];
+
+    lwm_sha256_init(&sha);
+    lwm_sha256_update(&sha, signing->secret_key, LWM_SIGNING_KEY_LEN);
+    lwm_sha256_update(&sha, header, MAVLINK_NUM_HEADER_BYTES);
+    lwm_sha256_update(&sha, _MAV_PAYLOAD(msg), msg->len);
+    lwm_sha256_update(&sha, crc, 2);
+    lwm_sha256_update(&sha, signature, 7);
+    lwm_sha256_final(&sha, digest);
+    memcpy(out, digest, 6);
+}
+
+static struct lwm_signing_stream_t*
+lwm_signing_stream_find(
+    struct lwm_signing_t* signing, uint8_t link_id, uint8_t sysid, uint8_t compid)
+{
+    for (uint32_t i = 0; i < signing->n_streams; i++)
+    {
+        struct lwm_signing_stream_t* s = &signing->streams[i];
+        if (s->link_id == link_id && s->sysid == sysid && s->compid == compid)
+        {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+void
+lwm_signing_init(struct lwm_signing_t* signing, uint8_t link_id,
+    const uint8_t key[LWM_SIGNING_KEY_LEN], uint32_t flags)
+{
+    ASSERT(signing != NULL);
+    ASSERT(key != NULL);
+
+    memset(signing, 0, sizeof(struct lwm_signing_t));
+    signing->flags   = flags;
+    signing->link_id = link_id;
+    memcpy(signing->secret_key, key, LWM_SIGNING_KEY_LEN);
+    signing->timestamp = lwm_signing_wallclock();
+}
+
+enum lwm_error_t
+lwm_signing_sign(struct lwm_signing_t* signing, mavlink_message_t* msg)
+{
+    ASSERT(signing != NULL);
+    ASSERT(msg != NULL);
+
+    if (msg->magic != MAVLINK_STX)
+    {
+        /* MAVLink 1 has no signature block */
+        return LWM_ERR_NOT_SUPPORTED;
+    }
+
+    uint8_t header[MAVLINK_NUM_HEADER_BYTES];
+    msg->incompat_flags |= MAVLINK_IFLAG_SIGNED;
+    lwm_signing_header(msg, header);
+
+    /* the crc covers the incompat flags, redo it now that the flag is set */
+    uint16_t checksum = crc_calculate(&header[1], MAVLINK_CORE_HEADER_LEN);
+    crc_accumulate_buffer(&checksum, _MAV_PAYLOAD(msg), msg->len);
+    crc_accumulate(mavlink_get_crc_extra(msg), &checksum);
+    mavlink_ck_a(msg) = (uint8_t)(checksum & 0xFF);
+    mavlink_ck_b(msg) = (uint8_t)(checksum >> 8);
+    msg->checksum     = checksum;
+
+    uint8_t  crc[2] = { (uint8_t)(checksum & 0xFF), (uint8_t)(checksum >> 8) };
+    uint64_t ts     = lwm_signing_next_timestamp(signing);
+    msg->signature[0] = signing->link_id;
+    for (int i = 0; i < 6; i++)
+    {
+        msg->signature[1 + i] = (uint8_t)(ts >> (8 * i));
+    }
+    lwm_signing_digest(
+        signing, header, msg, crc, msg->signature, &msg->signature[7]);
+    return LWM_OK;
+}
+
+enum lwm_error_t
+lwm_signing_verify(struct lwm_signing_t* signing, const mavlink_message_t* msg)
+{
+    ASSERT(signing != NULL);
+    ASSERT(msg != NULL);
+
+    if (msg->magic != MAVLINK_STX
+        || (msg->incompat_flags & MAVLINK_IFLAG_SIGNED) == 0)
+    {
+        if (signing->flags & LWM_SIGNING_ALLOW_UNSIGNED)
+        {
+            return LWM_OK;
+        }
+        signing->rx_rejected++;
+        return LWM_ERR_BAD_MESSAGE;
+    }
+
+    uint8_t header[MAVLINK_NUM_HEADER_BYTES];
+    uint8_t expected[6];
+    lwm_signing_header(msg, header);
+    lwm_signing_digest(signing, header, msg, msg->ck, msg->signature, expected);
+
+    uint8_t diff = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        diff |= expected[i] ^ msg->signature[7 + i];
+    }
+    if (diff != 0)
+    {
+        signing->rx_rejected++;
+        return LWM_ERR_BAD_MESSAGE;
+    }
+
+    uint64_t ts = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        ts |= (uint64_t)msg->signature[1 + i] << (8 * i);
+    }
+
+    /* replay protection, per (link id, sysid, compid) */
+    struct lwm_signing_stream_t* stream = lwm_signing_stream_find(
+        signing, msg->signature[0], msg->sysid, msg->compid);
+    if (stream == NULL)
+    {
+        if (signing->n_streams >= MAX_LWM_SIGNING_STREAM
+            || ts + LWM_SIGNING_REPLAY_LIMIT
+                < __atomic_load_n(&signing->timestamp, __ATOMIC_RELAXED))
+        {
+            signing->rx_rejected++;
+            return LWM_ERR_BAD_MESSAGE;
+        }
+        stream          = &signing->streams[signing->n_streams++];
+        stream->link_id = msg->signature[0];
+        stream->sysid   = msg->sysid;
+        stream->compid  = msg->compid;
+    }
+    else if (ts <= stream->timestamp)
+    {
+        signing->rx_rejected++;
+        return LWM_ERR_BAD_MESSAGE;
+    }
+
+    stream->timestamp = ts;
+    lwm_signing_seen_timestamp(signing, ts);
+    return LWM_OK;
+}
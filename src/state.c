@@ -0,0 +1,249 @@
+#include "lwmavsdk.h"
+
+/*
+ * Vehicle state, folded from HEARTBEAT, GLOBAL_POSITION_INT, ATTITUDE,
+ * SYS_STATUS and BATTERY_STATUS. Every report refreshes the timestamp of
+ * its fields, `changed` only collects the ones whose value moved.
+ */
+
+static uint32_t
+lwm_state_field_index(enum lwm_state_field_t field)
+{
+    return (uint32_t)__builtin_ctz((uint32_t)field);
+}
+
+static void
+lwm_state_touch(struct lwm_vehicle_state_t* state, uint32_t fields, uint64_t now)
+{
+    while (fields != 0)
+    {
+        uint32_t i = (uint32_t)__builtin_ctz(fields);
+        state->updated_us[i] = now;
+        fields &= fields - 1;
+    }
+}
+
+static uint32_t
+lwm_state_heartbeat(
+    struct lwm_vehicle_state_t* state, const mavlink_heartbeat_t* hb)
+{
+    uint32_t changed = 0;
+    bool     armed   = (hb->base_mode & MAV_MODE_FLAG_SAFETY_ARMED) != 0;
+    if (armed != state->armed)
+    {
+        changed |= LWM_STATE_ARMED;
+    }
+    if (hb->custom_mode != state->custom_mode
+        || hb->base_mode != state->base_mode)
+    {
+        changed |= LWM_STATE_MODE;
+    }
+    if (hb->system_status != state->system_status)
+    {
+        changed |= LWM_STATE_STATUS;
+    }
+    state->armed         = armed;
+    state->custom_mode   = hb->custom_mode;
+    state->base_mode     = hb->base_mode;
+    state->system_status = hb->system_status;
+    return changed;
+}
+
+static uint32_t
+lwm_state_position(struct lwm_vehicle_state_t* state,
+    const mavlink_global_position_int_t*       pos)
+{
+    uint32_t changed = 0;
+    if (pos->lat != state->lat || pos->lon != state->lon
+        || pos->alt != state->alt)
+    {
+        changed |= LWM_STATE_POSITION;
+    }
+    if (pos->relative_alt != state->relative_alt)
+    {
+        changed |= LWM_STATE_ALTITUDE;
+    }
+    if (pos->vx != state->vx || pos->vy != state->vy || pos->vz != state->vz)
+    {
+        changed |= LWM_STATE_VELOCITY;
+    }
+    if (pos->hdg != state->hdg)
+    {
+        changed |= LWM_STATE_HEADING;
+    }
+    state->lat          = pos->lat;
+    state->lon          = pos->lon;
+    state->alt          = pos->alt;
+    state->relative_alt = pos->relative_alt;
+    state->vx           = pos->vx;
+    state->vy           = pos->vy;
+    state->vz           = pos->vz;
+    state->hdg          = pos->hdg;
+    return changed;
+}
+
+static uint32_t
+lwm_state_attitude(
+    struct lwm_vehicle_state_t* state, const mavlink_attitude_t* att)
+{
+    uint32_t changed = 0;
+    if (att->roll != state->roll || att->pitch != state->pitch
+        || att->yaw != state->yaw)
+    {
+        changed |= LWM_STATE_ATTITUDE;
+    }
+    if (att->rollspeed != state->rollspeed
+        || att->pitchspeed != state->pitchspeed
+        || att->yawspeed != state->yawspeed)
+    {
+        changed |= LWM_STATE_RATES;
+    }
+    state->roll       = att->roll;
+    state->pitch      = att->pitch;
+    state->yaw        = att->yaw;
+    state->rollspeed  = att->rollspeed;
+    state->pitchspeed = att->pitchspeed;
+    state->yawspeed   = att->yawspeed;
+    return changed;
+}
+
+static uint32_t
+lwm_state_sys_status(
+    struct lwm_vehicle_state_t* state, const mavlink_sys_status_t* sys)
+{
+    uint32_t changed = 0;
+    if (sys->battery_remaining != state->battery_remaining)
+    {
+        changed |= LWM_STATE_BATTERY;
+    }
+    if (sys->voltage_battery != state->voltage_battery
+        || sys->current_battery != state->current_battery)
+    {
+        changed |= LWM_STATE_POWER;
+    }
+    if (sys->onboard_control_sensors_present != state->sensors_present
+        || sys->onboard_control_sensors_enabled != state->sensors_enabled
+        || sys->onboard_control_sensors_health != state->sensors_health
+        || sys->load != state->load)
+    {
+        changed |= LWM_STATE_SENSORS;
+    }
+    state->battery_remaining = sys->battery_remaining;
+    state->voltage_battery   = sys->voltage_battery;
+    state->current_battery   = sys->current_battery;
+    state->sensors_present   = sys->onboard_control_sensors_present;
+    state->sensors_enabled   = sys->onboard_control_sensors_enabled;
+    state->sensors_health    = sys->onboard_control_sensors_health;
+    state->load              = sys->load;
+    return changed;
+}
+
+static uint32_t
+lwm_state_battery_status(
+    struct lwm_vehicle_state_t* state, const mavlink_battery_status_t* bat)
+{
+    uint32_t changed = 0;
+    if (bat->battery_remaining != state->battery_remaining)
+    {
+        changed |= LWM_STATE_BATTERY;
+    }
+    if (bat->current_consumed != state->current_consumed
+        || bat->energy_consumed != state->energy_consumed)
+    {
+        changed |= LWM_STATE_POWER;
+    }
+    state->battery_remaining = bat->battery_remaining;
+    state->current_consumed  = bat->current_consumed;
+    state->energy_consumed   = bat->energy_consumed;
+    return changed;
+}
+
+void
+lwm_vehicle_state_init(struct lwm_vehicle_state_t* state)
+{
+    ASSERT(state != NULL);
+
+    memset(state, 0, sizeof(struct lwm_vehicle_state_t));
+    state->hdg               = UINT16_MAX;
+    state->battery_remaining = -1;
+}
+
+uint32_t
+lwm_vehicle_state_update(
+    struct lwm_vehicle_state_t* state, struct lwm_delivery_t* delivery)
+{
+    ASSERT(state != NULL);
+    ASSERT(delivery != NULL);
+
+    uint32_t changed;
+    uint32_t fields;
+    state->reported = 0;
+    switch (delivery->msg->msgid)
+    {
+    case MAVLINK_MSG_ID_HEARTBEAT:
+        fields  = LWM_STATE_ARMED | LWM_STATE_MODE | LWM_STATE_STATUS;
+        changed = lwm_state_heartbeat(
+            state, LWM_DECODED(delivery, mavlink_heartbeat_t));
+        break;
+    case MAVLINK_MSG_ID_GLOBAL_POSITION_INT:
+        fields = LWM_STATE_POSITION | LWM_STATE_ALTITUDE | LWM_STATE_VELOCITY
+            | LWM_STATE_HEADING;
+        changed = lwm_state_position(
+            state, LWM_DECODED(delivery, mavlink_global_position_int_t));
+        break;
+    case MAVLINK_MSG_ID_ATTITUDE:
+        fields  = LWM_STATE_ATTITUDE | LWM_STATE_RATES;
+        changed = lwm_state_attitude(
+            state, LWM_DECODED(delivery, mavlink_attitude_t));
+        break;
+    case MAVLINK_MSG_ID_SYS_STATUS:
+        fields  = LWM_STATE_BATTERY | LWM_STATE_POWER | LWM_STATE_SENSORS;
+        changed = lwm_state_sys_status(
+            state, LWM_DECODED(delivery, mavlink_sys_status_t));
+        break;
+    case MAVLINK_MSG_ID_BATTERY_STATUS:
+        /* the primary battery only, SYS_STATUS already sums up the rest */
+        if (LWM_DECODED(delivery, mavlink_battery_status_t)->id != 0)
+        {
+            return 0;
+        }
+        fields  = LWM_STATE_BATTERY | LWM_STATE_POWER;
+        changed = lwm_state_battery_status(
+            state, LWM_DECODED(delivery, mavlink_battery_status_t));
+        break;
+    default: return 0;
+    }
+
+    if (delivery->time_us == 0)
+    {
+        delivery->time_us = time_us();
+    }
+    lwm_state_touch(state, fields, delivery->time_us);
+    state->reported = fields;
+    state->changed |= changed;
+    return changed;
+}
+
+uint32_t
+lwm_vehicle_state_changes(struct lwm_vehicle_state_t* state)
+{
+    ASSERT(state != NULL);
+
+    uint32_t changed = state->changed;
+    state->changed   = 0;
+    return changed;
+}
+
+uint64_t
+lwm_vehicle_state_age(const struct lwm_vehicle_state_t* state,
+    enum lwm_state_field_t field, uint64_t now_us)
+{
+    ASSERT(state != NULL);
+
+    uint64_t updated = state->updated_us[lwm_state_field_index(field)];
+    if (updated == 0)
+    {
+        return UINT64_MAX;
+    }
+    return now_us > updated ? now_us - updated : 0;
+}
@@ -0,0 +1,163 @@
+#include "lwmavsdk.h"
+
+/*
+ * Posting messages and actions from other threads.
+ *
+ * Bounded multi-producer single-consumer queue: each cell carries a turn
+ * number. A cell is free for the producer claiming position `pos` when its
+ * seq is `pos`, holds a posted item once it is `pos + 1`, and is handed
+ * back by the consumer as `pos + LWM_SUBMIT_QUEUE_SIZE`. Producers only
+ * contend on the tail, the spinning thread never blocks on them.
+ */
+
+#define LWM_SUBMIT_QUEUE_MASK (LWM_SUBMIT_QUEUE_SIZE - 1)
+
+void
+lwm_submit_init(struct lwm_submit_queue_t* queue)
+{
+    ASSERT(queue != NULL);
+
+    queue->tail     = 0;
+    queue->rejected = 0;
+    queue->head     = 0;
+    queue->drained  = 0;
+    for (uint32_t i = 0; i < LWM_SUBMIT_QUEUE_SIZE; i++)
+    {
+        queue->cells[i].seq = i;
+    }
+}
+
+static struct lwm_submission_t*
+lwm_submit_claim(struct lwm_submit_queue_t* queue, uint32_t* pos)
+{
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        struct lwm_submission_t* cell
+            = &queue->cells[tail & LWM_SUBMIT_QUEUE_MASK];
+        uint32_t seq  = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        int32_t  turn = (int32_t)(seq - tail);
+        if (turn == 0)
+        {
+            if (__atomic_compare_exchange_n(&queue->tail, &tail, tail + 1,
+                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = tail;
+                return cell;
+            }
+        }
+        else if (turn < 0)
+        {
+            /* the consumer has not handed this cell back yet */
+            __atomic_fetch_add(&queue->rejected, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        else
+        {
+            tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void
+lwm_submit_publish(struct lwm_vehicle_t* vehicle,
+    struct lwm_submission_t* cell, uint32_t pos)
+{
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    /* a loop waiting on the descriptor would only see it on the next frame */
+    lwm_wake_t wake = __atomic_load_n(&vehicle->wake, __ATOMIC_ACQUIRE);
+    if (wake != NULL)
+    {
+        wake(vehicle->wake_context);
+    }
+}
+
+enum lwm_error_t
+lwm_vehicle_post(struct lwm_vehicle_t* vehicle, const mavlink_message_t* msg)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(msg != NULL);
+
+    uint32_t                 pos;
+    struct lwm_submission_t* cell
+        = lwm_submit_claim(&vehicle->submitted, &pos);
+    if (cell == NULL)
+    {
+        return LWM_ERR_NO_MEM;
+    }
+    cell->type   = LWM_SUBMIT_MESSAGE;
+    cell->action = NULL;
+    memcpy(&cell->msg, msg, sizeof(mavlink_message_t));
+    lwm_submit_publish(vehicle, cell, pos);
+    return LWM_OK;
+}
+
+enum lwm_error_t
+lwm_vehicle_post_action(struct lwm_vehicle_t* vehicle,
+    struct lwm_action_t* action, uint64_t timeout_us)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(action != NULL);
+
+    uint32_t                 pos;
+    struct lwm_submission_t* cell
+        = lwm_submit_claim(&vehicle->submitted, &pos);
+    if (cell == NULL)
+    {
+        return LWM_ERR_NO_MEM;
+    }
+    cell->type       = LWM_SUBMIT_ACTION;
+    cell->action     = action;
+    cell->timeout_us = timeout_us;
+    lwm_submit_publish(vehicle, cell, pos);
+    return LWM_OK;
+}
+
+void
+lwm_vehicle_drain_posted(struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(vehicle != NULL);
+
+    struct lwm_submit_queue_t* queue = &vehicle->submitted;
+    bool                       wrote = false;
+    for (;;)
+    {
+        uint32_t                 head = queue->head;
+        struct lwm_submission_t* cell
+            = &queue->cells[head & LWM_SUBMIT_QUEUE_MASK];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != head + 1)
+        {
+            break;
+        }
+
+        if (cell->type == LWM_SUBMIT_MESSAGE)
+        {
+            /* consecutive messages leave in as few sends as fit */
+            enum lwm_error_t err = lwm_conn_write(&vehicle->conn, &cell->msg);
+            if (err != LWM_OK)
+            {
+                WARN("lwm_vehicle_drain_posted: send failed: %d\n", err);
+            }
+            wrote = true;
+        }
+        else
+        {
+            /* its own sends flush what was written before it */
+            lwm_action_submit(cell->action, cell->timeout_us);
+        }
+
+        __atomic_store_n(
+            &cell->seq, head + LWM_SUBMIT_QUEUE_SIZE, __ATOMIC_RELEASE);
+        queue->head = head + 1;
+        queue->drained++;
+    }
+
+    if (wrote)
+    {
+        enum lwm_error_t err = lwm_conn_flush(&vehicle->conn);
+        if (err != LWM_OK)
+        {
+            WARN("lwm_vehicle_drain_posted: send failed: %d\n", err);
+        }
+    }
+}
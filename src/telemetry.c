@@ -0,0 +1,140 @@
+#include "lwmavsdk.h"
+
+/*
+ * Latest-value store. Slots are handed out in order and never freed, a
+ * reader that found a slot through the index can keep using it.
+ *
+ * writer: seq++ (odd), copy, seq++ (even)
+ * reader: retry while seq is odd or changed across the copy
+ */
+
+#if MAX_LWM_TELEMETRY * 2 > LWM_TELEMETRY_HASH_SIZE
+#error "telemetry hash table must be at least twice MAX_LWM_TELEMETRY"
+#endif
+
+static uint64_t
+lwm_telemetry_key(uint32_t msgid, uint8_t sysid, uint8_t compid)
+{
+    /* msgids are 24 bits */
+    return (uint64_t)msgid | ((uint64_t)sysid << 24) | ((uint64_t)compid << 32);
+}
+
+static uint32_t
+lwm_telemetry_hash(uint32_t msgid, uint8_t sysid, uint8_t compid)
+{
+    uint32_t x = msgid ^ ((uint32_t)sysid << 24) ^ ((uint32_t)compid << 16);
+    return (x * 2654435769u) >> (32 - LWM_TELEMETRY_HASH_BITS);
+}
+
+static struct lwm_telemetry_slot_t*
+lwm_telemetry_find(const struct lwm_telemetry_t* telemetry, uint32_t msgid,
+    uint8_t sysid, uint8_t compid, uint32_t* hole)
+{
+    uint64_t key = lwm_telemetry_key(msgid, sysid, compid);
+    uint32_t h   = lwm_telemetry_hash(msgid, sysid, compid);
+    for (;;)
+    {
+        /* terminates: the table is never more than half full */
+        uint32_t index = __atomic_load_n(&telemetry->index[h], __ATOMIC_ACQUIRE);
+        if (index == 0)
+        {
+            if (hole != NULL)
+            {
+                *hole = h;
+            }
+            return NULL;
+        }
+        const struct lwm_telemetry_slot_t* slot = &telemetry->slots[index - 1];
+        if (slot->key == key)
+        {
+            return (struct lwm_telemetry_slot_t*)slot;
+        }
+        h = (h + 1) & (LWM_TELEMETRY_HASH_SIZE - 1);
+    }
+}
+
+void
+lwm_telemetry_init(struct lwm_telemetry_t* telemetry)
+{
+    ASSERT(telemetry != NULL);
+
+    memset(telemetry->index, 0, sizeof(telemetry->index));
+    telemetry->n       = 0;
+    telemetry->dropped = 0;
+    telemetry->size    = sizeof(struct lwm_telemetry_t);
+    /* last, an attaching reader checks it */
+    __atomic_store_n(&telemetry->magic, LWM_TELEMETRY_MAGIC, __ATOMIC_RELEASE);
+}
+
+void
+lwm_telemetry_update(struct lwm_telemetry_t* telemetry,
+    const mavlink_message_t* msg, uint64_t time_us)
+{
+    ASSERT(telemetry != NULL);
+    ASSERT(msg != NULL);
+
+    uint32_t                     hole;
+    struct lwm_telemetry_slot_t* slot = lwm_telemetry_find(
+        telemetry, msg->msgid, msg->sysid, msg->compid, &hole);
+    if (slot == NULL)
+    {
+        if (telemetry->n >= MAX_LWM_TELEMETRY)
+        {
+            telemetry->dropped++;
+            return;
+        }
+        /* fill the slot before the index makes it visible to readers */
+        slot          = &telemetry->slots[telemetry->n];
+        slot->seq     = 0;
+        slot->key     = lwm_telemetry_key(msg->msgid, msg->sysid, msg->compid);
+        slot->count   = 0;
+        slot->time_us = 0;
+        memcpy(&slot->msg, msg, sizeof(mavlink_message_t));
+        telemetry->n++;
+        __atomic_store_n(&telemetry->index[hole], telemetry->n, __ATOMIC_RELEASE);
+    }
+
+    uint32_t seq = slot->seq;
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&slot->msg, msg, sizeof(mavlink_message_t));
+    slot->time_us = time_us;
+    slot->count++;
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+enum lwm_error_t
+lwm_telemetry_read(const struct lwm_telemetry_t* telemetry, uint32_t msgid,
+    uint8_t sysid, uint8_t compid, mavlink_message_t* msg, uint64_t* time_us)
+{
+    ASSERT(telemetry != NULL);
+    ASSERT(msg != NULL);
+
+    const struct lwm_telemetry_slot_t* slot
+        = lwm_telemetry_find(telemetry, msgid, sysid, compid, NULL);
+    if (slot == NULL)
+    {
+        return LWM_ERR_NO_DATA;
+    }
+
+    uint32_t begin, end = 0;
+    uint64_t t;
+    do
+    {
+        begin = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (begin & 1)
+        {
+            continue;
+        }
+        memcpy(msg, &slot->msg, sizeof(mavlink_message_t));
+        t = slot->time_us;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        end = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    } while ((begin & 1) || begin != end);
+
+    if (time_us != NULL)
+    {
+        *time_us = t;
+    }
+    return LWM_OK;
+}
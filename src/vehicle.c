@@ -5,17 +5,231 @@ void lwm_vehicle_init(struct lwm_vehicle_t* vehicle)
     vehicle->conn.status = LWM_CONN_STATUS_CLOSED;
     vehicle->sysid = 1;
     vehicle->compid = MAV_COMP_ID_AUTOPILOT1;
+    vehicle->telemetry = NULL;
+    vehicle->workers = NULL;
+    vehicle->io = NULL;
+    vehicle->wake = NULL;
+    vehicle->wake_context = NULL;
+    lwm_submit_init(&vehicle->submitted);
+    lwm_vehicle_state_init(&vehicle->state);
+    vehicle->waiters = NULL;
+    vehicle->waiter_depends = 0;
+    vehicle->waiter_deadline_us = 0;
+    vehicle->actions = NULL;
+    vehicle->action_deadline_us = 0;
+    vehicle->latency = NULL;
+    vehicle->grouped = false;
+    vehicle->ready_us = 0;
     lwm_microservice_init(vehicle);
 }
 
+void lwm_vehicle_set_telemetry(
+    struct lwm_vehicle_t* vehicle, struct lwm_telemetry_t* store)
+{
+    if (store != NULL)
+    {
+        lwm_telemetry_init(store);
+    }
+    vehicle->telemetry = store;
+}
+
+void lwm_vehicle_set_wake(
+    struct lwm_vehicle_t* vehicle, lwm_wake_t wake, void* context)
+{
+    vehicle->wake_context = context;
+    /* posting threads load `wake` first, then its context */
+    __atomic_store_n(&vehicle->wake, wake, __ATOMIC_RELEASE);
+}
+
+int lwm_vehicle_fd(struct lwm_vehicle_t* vehicle)
+{
+    if (vehicle->io != NULL)
+    {
+        return -1;
+    }
+    return lwm_conn_fd(&vehicle->conn);
+}
+
+uint64_t lwm_vehicle_next_deadline(const struct lwm_vehicle_t* vehicle)
+{
+    uint64_t waiter = vehicle->waiter_deadline_us;
+    uint64_t action = vehicle->action_deadline_us;
+    if (waiter == 0 || (action != 0 && action < waiter))
+    {
+        return action;
+    }
+    return waiter;
+}
+
+void lwm_vehicle_process_timers(struct lwm_vehicle_t* vehicle, uint64_t now_us)
+{
+    if (vehicle->waiter_deadline_us != 0
+        && now_us >= vehicle->waiter_deadline_us)
+    {
+        lwm_waiter_notify(vehicle, 0, now_us);
+    }
+    lwm_action_notify(vehicle, now_us);
+}
+
+void lwm_vehicle_set_latency(
+    struct lwm_vehicle_t* vehicle, struct lwm_latency_t* latency)
+{
+    if (latency != NULL)
+    {
+        memset(latency, 0, sizeof(struct lwm_latency_t));
+    }
+    vehicle->latency = latency;
+}
+
+void lwm_vehicle_set_grouped(struct lwm_vehicle_t* vehicle, bool grouped)
+{
+    vehicle->grouped = grouped;
+}
+
+static uint64_t lwm_vehicle_clock(struct lwm_vehicle_t* vehicle)
+{
+    /* only measured loops pay for reading the clock */
+    return vehicle->latency != NULL ? time_us() : 0;
+}
+
+static uint64_t lwm_vehicle_ready(struct lwm_vehicle_t* vehicle)
+{
+    /* the reactor's wakeup if it left one, else now, before the read */
+    uint64_t ready_us = vehicle->ready_us;
+    vehicle->ready_us = 0;
+    if (vehicle->latency == NULL)
+    {
+        return 0;
+    }
+    return ready_us != 0 ? ready_us : time_us();
+}
+
+static void lwm_vehicle_measure(struct lwm_vehicle_t* vehicle, uint64_t start)
+{
+    struct lwm_latency_t* latency = vehicle->latency;
+    if (latency == NULL)
+    {
+        return;
+    }
+    uint64_t us     = time_us() - start;
+    uint32_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= LWM_LATENCY_BUCKETS)
+    {
+        bucket = LWM_LATENCY_BUCKETS - 1;
+    }
+    /* read from other threads while the vehicle spins */
+    __atomic_store_n(&latency->loops, latency->loops + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&latency->total_us, latency->total_us + us, __ATOMIC_RELAXED);
+    __atomic_store_n(&latency->buckets[bucket], latency->buckets[bucket] + 1,
+        __ATOMIC_RELAXED);
+    if (us > latency->max_us)
+    {
+        __atomic_store_n(&latency->max_us, us, __ATOMIC_RELAXED);
+    }
+}
+
+static void lwm_vehicle_flush_deferred(struct lwm_vehicle_t* vehicle)
+{
+    /* a reactor saving power runs them on its tick instead */
+    if (!vehicle->deferred.is_held)
+    {
+        lwm_microservice_flush_deferred(vehicle);
+    }
+}
+
+static void lwm_vehicle_batch_sort(struct lwm_batch_t* batch)
+{
+    /* stable insertion sort, the batch is small and mostly grouped */
+    for (size_t i = 0; i < batch->n; i++)
+    {
+        uint8_t  index = (uint8_t)i;
+        uint32_t msgid = batch->frames[i].msgid;
+        size_t   j     = i;
+        for (; j > 0 && batch->frames[batch->order[j - 1]].msgid > msgid; j--)
+        {
+            batch->order[j] = batch->order[j - 1];
+        }
+        batch->order[j] = index;
+    }
+}
+
+static void lwm_vehicle_dispatch(struct lwm_vehicle_t* vehicle, bool grouped)
+{
+    struct lwm_batch_t* batch = &vehicle->batch;
+    if (grouped)
+    {
+        lwm_vehicle_batch_sort(batch);
+        lwm_microservice_process_batch(
+            vehicle, batch->frames, batch->order, batch->n);
+    }
+    else
+    {
+        for (size_t i = 0; i < batch->n; i++)
+        {
+            lwm_microservice_process(vehicle, &batch->frames[i]);
+        }
+    }
+    lwm_vehicle_flush_deferred(vehicle);
+}
+
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+static enum lwm_error_t lwm_vehicle_spin_ring(
+    struct lwm_vehicle_t* vehicle, bool grouped)
+{
+    struct lwm_batch_t* batch = &vehicle->batch;
+    enum lwm_error_t    err   = lwm_io_thread_pop(vehicle->io, batch->frames,
+        MAX_LWM_BATCH, &batch->n, LWM_IO_WAIT_US);
+    if (err == LWM_ERR_NO_DATA)
+    {
+        return LWM_OK;
+    }
+    if (err != LWM_OK)
+    {
+        return err;
+    }
+
+    /* the I/O thread's read, waking up to take it off the ring counts */
+    uint64_t start = vehicle->latency != NULL
+        ? __atomic_load_n(&vehicle->io->ring.read_us, __ATOMIC_ACQUIRE) : 0;
+    lwm_vehicle_dispatch(vehicle, grouped);
+    lwm_vehicle_measure(vehicle, start);
+    return LWM_OK;
+}
+#endif
+
+static void lwm_vehicle_expire(struct lwm_vehicle_t* vehicle)
+{
+    if (lwm_vehicle_next_deadline(vehicle) != 0)
+    {
+        /* expire waits even when nothing they depend on arrives */
+        lwm_vehicle_process_timers(vehicle, time_us());
+    }
+}
+
 enum lwm_error_t lwm_vehicle_spin_once(struct lwm_vehicle_t* vehicle)
 {
     enum lwm_error_t err;
     mavlink_message_t msg;
+    lwm_vehicle_drain_posted(vehicle);
+    lwm_vehicle_expire(vehicle);
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+    if (vehicle->io != NULL)
+    {
+        /* the I/O thread owns the read side of the connection */
+        return lwm_vehicle_spin_ring(vehicle, false);
+    }
+#endif
     err = lwm_conn_recv(&vehicle->conn, &msg);
     if (err == LWM_OK)
     {
+        uint64_t start = lwm_vehicle_clock(vehicle);
         lwm_microservice_process(vehicle, &msg);
+        if (vehicle->conn.input.pos >= vehicle->conn.input.len)
+        {
+            /* last message of this read, run what was held back */
+            lwm_vehicle_flush_deferred(vehicle);
+        }
+        lwm_vehicle_measure(vehicle, start);
         return LWM_OK;
     }
     else if (err == LWM_ERR_NO_DATA)
@@ -25,6 +239,78 @@ enum lwm_error_t lwm_vehicle_spin_once(struct lwm_vehicle_t* vehicle)
     return err;
 }
 
+enum lwm_error_t lwm_vehicle_spin_batch(struct lwm_vehicle_t* vehicle)
+{
+    lwm_vehicle_drain_posted(vehicle);
+#if defined(POSIX_LIBC) || defined(_MUSL_)
+    if (vehicle->io != NULL)
+    {
+        enum lwm_error_t err = lwm_vehicle_spin_ring(vehicle, true);
+        if (err == LWM_OK)
+        {
+            lwm_vehicle_expire(vehicle);
+        }
+        return err;
+    }
+#endif
+
+    struct lwm_batch_t* batch = &vehicle->batch;
+    enum lwm_error_t    err   = lwm_conn_recv_batch(
+        &vehicle->conn, batch->frames, MAX_LWM_BATCH, &batch->n);
+    if (err == LWM_OK)
+    {
+        uint64_t start = lwm_vehicle_clock(vehicle);
+        lwm_vehicle_dispatch(vehicle, true);
+        lwm_vehicle_measure(vehicle, start);
+    }
+    else if (err != LWM_ERR_NO_DATA)
+    {
+        return err;
+    }
+    /* after the batch, a wait it completed is no longer due */
+    lwm_vehicle_expire(vehicle);
+    return LWM_OK;
+}
+
+enum lwm_error_t lwm_vehicle_process_input(struct lwm_vehicle_t* vehicle)
+{
+    ASSERT(vehicle->io == NULL);
+
+    struct lwm_batch_t* batch = &vehicle->batch;
+    uint64_t            start = lwm_vehicle_ready(vehicle);
+    /* one read, then whatever it left in the buffer: the descriptor says
+     * when the next read would not block */
+    do
+    {
+        enum lwm_error_t err = lwm_conn_try_recv_batch(
+            &vehicle->conn, batch->frames, MAX_LWM_BATCH, &batch->n);
+        if (err == LWM_ERR_NO_DATA)
+        {
+            return LWM_OK;
+        }
+        if (err != LWM_OK)
+        {
+            return err;
+        }
+
+        lwm_vehicle_dispatch(vehicle, vehicle->grouped);
+        lwm_vehicle_measure(vehicle, start);
+    } while (vehicle->conn.input.pos < vehicle->conn.input.len);
+    return LWM_OK;
+}
+
+enum lwm_error_t lwm_vehicle_process(struct lwm_vehicle_t* vehicle, bool readable)
+{
+    enum lwm_error_t err = LWM_OK;
+    lwm_vehicle_drain_posted(vehicle);
+    if (readable)
+    {
+        err = lwm_vehicle_process_input(vehicle);
+    }
+    lwm_vehicle_process_timers(vehicle, time_us());
+    return err;
+}
+
 void lwm_vehicle_spin(struct lwm_vehicle_t* vehicle)
 {
     enum lwm_error_t err = LWM_OK;
@@ -0,0 +1,201 @@
+#include "lwmavsdk.h"
+
+/*
+ * Waiters hang off the vehicle in a singly linked list. The vehicle keeps
+ * the union of their dependencies and the earliest deadline, so a message
+ * no waiter depends on costs one AND.
+ */
+
+static void
+lwm_waiter_recompute(struct lwm_vehicle_t* vehicle)
+{
+    uint32_t depends  = 0;
+    uint64_t deadline = 0;
+    for (struct lwm_waiter_t* w = vehicle->waiters; w != NULL; w = w->next)
+    {
+        depends |= w->depends;
+        if (w->deadline_us != 0 && (deadline == 0 || w->deadline_us < deadline))
+        {
+            deadline = w->deadline_us;
+        }
+    }
+    vehicle->waiter_depends     = depends;
+    vehicle->waiter_deadline_us = deadline;
+}
+
+static void
+lwm_waiter_unlink(struct lwm_vehicle_t* vehicle, struct lwm_waiter_t* waiter)
+{
+    struct lwm_waiter_t** link = &vehicle->waiters;
+    while (*link != NULL)
+    {
+        if (*link == waiter)
+        {
+            *link        = waiter->next;
+            waiter->next = NULL;
+            return;
+        }
+        link = &(*link)->next;
+    }
+}
+
+static void
+lwm_waiter_finish(struct lwm_waiter_t* waiter, enum lwm_waiter_status_t status)
+{
+    waiter->status = status;
+    if (waiter->done != NULL)
+    {
+        waiter->done(waiter);
+    }
+}
+
+void
+lwm_waiter_init(struct lwm_waiter_t* waiter, lwm_predicate_t predicate,
+    void* context, uint32_t depends)
+{
+    ASSERT(waiter != NULL);
+    ASSERT(predicate != NULL);
+
+    waiter->predicate   = predicate;
+    waiter->context     = context;
+    waiter->depends     = depends;
+    waiter->status      = LWM_WAITER_INIT;
+    waiter->deadline_us = 0;
+    waiter->done        = NULL;
+    waiter->next        = NULL;
+}
+
+enum lwm_error_t
+lwm_waiter_submit(struct lwm_vehicle_t* vehicle, struct lwm_waiter_t* waiter,
+    uint64_t timeout_us)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(waiter != NULL);
+    ASSERT(waiter->status != LWM_WAITER_PENDING);
+
+    waiter->deadline_us = timeout_us > 0 ? time_us() + timeout_us : 0;
+    if (waiter->predicate(&vehicle->state, waiter->context))
+    {
+        lwm_waiter_finish(waiter, LWM_WAITER_SATISFIED);
+        return LWM_OK;
+    }
+
+    waiter->status   = LWM_WAITER_PENDING;
+    waiter->next     = vehicle->waiters;
+    vehicle->waiters = waiter;
+    vehicle->waiter_depends |= waiter->depends;
+    if (waiter->deadline_us != 0
+        && (vehicle->waiter_deadline_us == 0
+            || waiter->deadline_us < vehicle->waiter_deadline_us))
+    {
+        vehicle->waiter_deadline_us = waiter->deadline_us;
+    }
+    return LWM_OK;
+}
+
+void
+lwm_waiter_cancel(struct lwm_vehicle_t* vehicle, struct lwm_waiter_t* waiter)
+{
+    ASSERT(vehicle != NULL);
+    ASSERT(waiter != NULL);
+
+    if (waiter->status == LWM_WAITER_PENDING)
+    {
+        lwm_waiter_unlink(vehicle, waiter);
+        waiter->status = LWM_WAITER_INIT;
+        lwm_waiter_recompute(vehicle);
+    }
+}
+
+void
+lwm_waiter_notify(
+    struct lwm_vehicle_t* vehicle, uint32_t reported, uint64_t now_us)
+{
+    ASSERT(vehicle != NULL);
+
+    bool check   = (reported & vehicle->waiter_depends) != 0;
+    bool expired = vehicle->waiter_deadline_us != 0
+        && now_us >= vehicle->waiter_deadline_us;
+    if (!check && !expired)
+    {
+        return;
+    }
+
+    struct lwm_waiter_t** link = &vehicle->waiters;
+    while (*link != NULL)
+    {
+        struct lwm_waiter_t*     w      = *link;
+        enum lwm_waiter_status_t status = LWM_WAITER_PENDING;
+        if ((reported & w->depends) != 0
+            && w->predicate(&vehicle->state, w->context))
+        {
+            status = LWM_WAITER_SATISFIED;
+        }
+        else if (w->deadline_us != 0 && now_us >= w->deadline_us)
+        {
+            status = LWM_WAITER_TIMEOUT;
+        }
+
+        if (status == LWM_WAITER_PENDING)
+        {
+            link = &w->next;
+            continue;
+        }
+        /* unlink first, `done` may submit the waiter again */
+        *link   = w->next;
+        w->next = NULL;
+        lwm_waiter_finish(w, status);
+    }
+    lwm_waiter_recompute(vehicle);
+}
+
+enum lwm_error_t
+lwm_waiter_wait(struct lwm_vehicle_t* vehicle, struct lwm_waiter_t* waiter,
+    uint64_t timeout_us)
+{
+    enum lwm_error_t err = lwm_waiter_submit(vehicle, waiter, timeout_us);
+    while (err == LWM_OK && waiter->status == LWM_WAITER_PENDING)
+    {
+        err = lwm_vehicle_spin_once(vehicle);
+    }
+    if (err != LWM_OK)
+    {
+        lwm_waiter_cancel(vehicle, waiter);
+        return err;
+    }
+    return waiter->status == LWM_WAITER_SATISFIED ? LWM_OK : LWM_ERR_TIMEOUT;
+}
+
+static bool
+lwm_state_known(
+    const struct lwm_vehicle_state_t* state, enum lwm_state_field_t field)
+{
+    return state->updated_us[__builtin_ctz((uint32_t)field)] != 0;
+}
+
+bool
+lwm_predicate_armed(const struct lwm_vehicle_state_t* state, void* context)
+{
+    return state->armed;
+}
+
+bool
+lwm_predicate_disarmed(const struct lwm_vehicle_state_t* state, void* context)
+{
+    return lwm_state_known(state, LWM_STATE_ARMED) && !state->armed;
+}
+
+bool
+lwm_predicate_mode(const struct lwm_vehicle_state_t* state, void* context)
+{
+    return lwm_state_known(state, LWM_STATE_MODE)
+        && state->custom_mode == (uint32_t)(uintptr_t)context;
+}
+
+bool
+lwm_predicate_altitude_above(
+    const struct lwm_vehicle_state_t* state, void* context)
+{
+    return lwm_state_known(state, LWM_STATE_ALTITUDE)
+        && state->relative_alt > (int32_t)(intptr_t)context;
+}
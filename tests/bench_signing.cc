@@ -0,0 +1,141 @@
+#include <benchmark/benchmark.h>
+#include "lwmavsdk.h"
+
+/*
+ * Signed vs. unsigned throughput of `lwm_conn_send` and `lwm_conn_recv`,
+ * with a backend that discards output and replays a captured stream.
+ */
+
+static const uint8_t key[LWM_SIGNING_KEY_LEN] = {
+    0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42,
+    0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42,
+    0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42,
+    0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42, 0x42,
+};
+
+#define N_FRAMES 256
+
+static uint8_t              stream[N_FRAMES * MAVLINK_MAX_PACKET_LEN];
+static size_t               stream_len;
+static size_t               stream_pos;
+static struct lwm_signing_t rx_signing;
+
+static enum lwm_error_t
+null_send(struct lwm_conn_context_t* ctx, const uint8_t* buf, size_t len)
+{
+    benchmark::DoNotOptimize(buf);
+    return LWM_OK;
+}
+
+static ssize_t
+replay_recv(struct lwm_conn_context_t* ctx, uint8_t* buf, size_t len)
+{
+    if (stream_pos >= stream_len)
+    {
+        /* the same frames come around again, forget their timestamps */
+        stream_pos = 0;
+        lwm_signing_init(&rx_signing, 0, key, 0);
+    }
+    size_t n = MIN(len, stream_len - stream_pos);
+    memcpy(buf, &stream[stream_pos], n);
+    stream_pos += n;
+    return (ssize_t)n;
+}
+
+static void
+conn_setup(struct lwm_conn_context_t* ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->status = LWM_CONN_STATUS_OPEN;
+    ctx->send   = null_send;
+    ctx->recv   = replay_recv;
+}
+
+static void
+pack_position(mavlink_message_t* msg, uint32_t t)
+{
+    mavlink_msg_global_position_int_pack(SYSTEM_ID, COMPONENT_ID, msg, t,
+        473977420, 85455940, 488000, 10000, 120, -40, 3, 18000);
+}
+
+static void
+stream_setup(bool sign)
+{
+    struct lwm_signing_t tx;
+    lwm_signing_init(&tx, 1, key, LWM_SIGNING_SIGN_OUTGOING);
+
+    stream_len = 0;
+    stream_pos = 0;
+    for (uint32_t i = 0; i < N_FRAMES; i++)
+    {
+        mavlink_message_t msg;
+        pack_position(&msg, i);
+        if (sign)
+        {
+            lwm_signing_sign(&tx, &msg);
+        }
+        stream_len += mavlink_msg_to_send_buffer(&stream[stream_len], &msg);
+    }
+    lwm_signing_init(&rx_signing, 0, key, 0);
+}
+
+static void
+BM_send(benchmark::State& state, bool sign, bool generic)
+{
+    struct lwm_conn_context_t ctx;
+    struct lwm_signing_t      signing;
+    mavlink_message_t         msg;
+
+    conn_setup(&ctx);
+    lwm_sha256_force_generic(generic);
+    if (sign)
+    {
+        lwm_signing_init(&signing, 1, key, LWM_SIGNING_SIGN_OUTGOING);
+        lwm_conn_set_signing(&ctx, &signing);
+    }
+
+    uint32_t t = 0;
+    for (auto _ : state)
+    {
+        pack_position(&msg, t++);
+        lwm_conn_send(&ctx, &msg);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(sign ? lwm_sha256_backend() : "unsigned");
+    lwm_sha256_force_generic(false);
+}
+
+static void
+BM_recv(benchmark::State& state, bool sign, bool generic)
+{
+    struct lwm_conn_context_t ctx;
+    mavlink_message_t         msg;
+
+    conn_setup(&ctx);
+    lwm_sha256_force_generic(generic);
+    stream_setup(sign);
+    if (sign)
+    {
+        lwm_conn_set_signing(&ctx, &rx_signing);
+    }
+
+    for (auto _ : state)
+    {
+        while (lwm_conn_recv(&ctx, &msg) != LWM_OK)
+        {
+        }
+        benchmark::DoNotOptimize(msg);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(sign ? lwm_sha256_backend() : "unsigned");
+    lwm_sha256_force_generic(false);
+}
+
+BENCHMARK_CAPTURE(BM_send, unsigned, false, false);
+BENCHMARK_CAPTURE(BM_send, signed, true, false);
+BENCHMARK_CAPTURE(BM_send, signed_generic, true, true);
+BENCHMARK_CAPTURE(BM_recv, unsigned, false, false);
+BENCHMARK_CAPTURE(BM_recv, signed, true, false);
+BENCHMARK_CAPTURE(BM_recv, signed_generic, true, true);
+
+BENCHMARK_MAIN();
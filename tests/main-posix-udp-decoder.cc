@@ -40,8 +40,10 @@ main(int argc, char** argv)
 
     lwm_microservice_t* log = lwm_microservice_create(&vehicle);
     log->handler            = ms_log;
-    lwm_microservice_add_to(&vehicle, MAVLINK_MSG_ID_HEARTBEAT, log);
-    lwm_microservice_add_to(&vehicle, MAVLINK_MSG_ID_BATTERY_STATUS, log);
+    lwm_filter_t all;
+    lwm_filter_init(&all);
+    lwm_filter_any(&all);
+    lwm_microservice_add_filter(&vehicle, &all, 0, log);
     lwm_vehicle_spin(&vehicle);
 
     return 0;
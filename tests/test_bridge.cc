@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char * path = "/tmp/lwm_test_bridge.sock";
+
+class BridgeTest : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        unlink(path);
+        vehicle = new lwm_vehicle_t();
+        lwm_vehicle_init(vehicle);
+        lwm_filter_init(&filter);
+        lwm_filter_any(&filter);
+    }
+
+    void TearDown() override
+    {
+        lwm_microservice_fini(vehicle);
+        delete vehicle;
+        unlink(path);
+    }
+
+    int connect_client()
+    {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        EXPECT_EQ(connect(fd, (struct sockaddr *)&addr, sizeof(addr)), 0);
+        return fd;
+    }
+
+    void dispatch(uint32_t msgid)
+    {
+        mavlink_message_t msg = {};
+        msg.msgid = msgid;
+        msg.len = 4;
+        lwm_microservice_process(vehicle, &msg);
+    }
+
+    struct lwm_vehicle_t * vehicle;
+    struct lwm_filter_t filter;
+    struct lwm_bridge_t bridge;
+};
+
+TEST_F(BridgeTest, keeps_a_file_in_the_way)
+{
+    int fd = open(path, O_CREAT | O_WRONLY, 0600);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    ASSERT_EQ(lwm_bridge_open(&bridge, vehicle, path, &filter), LWM_ERR_IO);
+    ASSERT_EQ(bridge.fd, -1);
+    struct stat st;
+    ASSERT_EQ(lstat(path, &st), 0);
+    ASSERT_TRUE(S_ISREG(st.st_mode));
+    /* closing after the failed open touches nothing */
+    lwm_bridge_close(&bridge);
+    ASSERT_EQ(lstat(path, &st), 0);
+}
+
+TEST_F(BridgeTest, replaces_a_stale_socket)
+{
+    ASSERT_EQ(lwm_bridge_open(&bridge, vehicle, path, &filter), LWM_OK);
+    /* a crashed run leaves its socket behind */
+    close(bridge.fd);
+    lwm_microservice_destroy(vehicle, bridge.service);
+
+    ASSERT_EQ(lwm_bridge_open(&bridge, vehicle, path, &filter), LWM_OK);
+    int client = connect_client();
+    lwm_bridge_poll(&bridge);
+    ASSERT_GE(bridge.clients[0].fd, 0);
+    close(client);
+    lwm_bridge_close(&bridge);
+    ASSERT_NE(access(path, F_OK), 0);
+}
+
+TEST_F(BridgeTest, full_rate_table_sends_unlimited)
+{
+    ASSERT_EQ(lwm_bridge_open(&bridge, vehicle, path, &filter), LWM_OK);
+    int client = connect_client();
+    lwm_bridge_poll(&bridge);
+    const char config[] = "binary 1000000\n";
+    ASSERT_EQ(write(client, config, sizeof(config) - 1),
+        (ssize_t)sizeof(config) - 1);
+    usleep(1000);
+    lwm_bridge_poll(&bridge);
+    ASSERT_EQ(bridge.clients[0].interval_us, 1000000u);
+
+    /* msgids outside the dialect, sent with their raw length */
+    const uint32_t base = 100000;
+    for (int round = 0; round < 2; round++)
+    {
+        for (uint32_t i = 0; i <= MAX_LWM_BRIDGE_RATE; i++)
+        {
+            dispatch(base + i);
+        }
+    }
+
+    size_t record = sizeof(struct lwm_bridge_header_t) + 4;
+    uint8_t buf[4096];
+    ssize_t n = recv(client, buf, sizeof(buf), MSG_DONTWAIT);
+    /* each limited msgid once, the one past the table both times */
+    ASSERT_EQ(n, (ssize_t)((MAX_LWM_BRIDGE_RATE + 2) * record));
+    ASSERT_EQ(bridge.clients[0].unlimited, 2u);
+    ASSERT_EQ(bridge.clients[0].dropped, 0u);
+
+    close(client);
+    lwm_bridge_close(&bridge);
+}
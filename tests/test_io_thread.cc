@@ -0,0 +1,172 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/* a connection over a pipe: read() blocks and is a cancellation point, as
+ * the backends' recv */
+static ssize_t pipe_recv(struct lwm_conn_context_t * ctx, uint8_t * buf,
+    size_t len)
+{
+    ssize_t n = read(*(int *)ctx->opaque, buf, len);
+    return n > 0 ? n : -LWM_ERR_IO;
+}
+
+static enum lwm_error_t pipe_send(struct lwm_conn_context_t * ctx,
+    const uint8_t * buf, size_t len)
+{
+    (void)ctx;
+    (void)buf;
+    (void)len;
+    return LWM_OK;
+}
+
+class IoThreadTest : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ASSERT_EQ(pipe(fds), 0);
+        vehicle = new lwm_vehicle_t();
+        lwm_vehicle_init(vehicle);
+        vehicle->conn.opaque = &fds[0];
+        vehicle->conn.recv = pipe_recv;
+        vehicle->conn.send = pipe_send;
+        vehicle->conn.status = LWM_CONN_STATUS_OPEN;
+        io = new lwm_io_thread_t();
+        ASSERT_EQ(lwm_io_thread_start(vehicle, io), LWM_OK);
+    }
+
+    void TearDown() override
+    {
+        lwm_io_thread_stop(vehicle);
+        close(fds[0]);
+        close(fds[1]);
+        lwm_microservice_fini(vehicle);
+        delete io;
+        delete vehicle;
+    }
+
+    /* heartbeats numbered in custom_mode, sent in one write */
+    void send(uint32_t first, uint32_t n)
+    {
+        std::string bytes;
+        for (uint32_t i = first; i < first + n; i++)
+        {
+            mavlink_message_t msg = {};
+            uint8_t * payload = (uint8_t *)_MAV_PAYLOAD_NON_CONST(&msg);
+            memcpy(payload, &i, sizeof(i));
+            payload[8] = 3; /* mavlink_version, nothing gets trimmed */
+            msg.msgid = MAVLINK_MSG_ID_HEARTBEAT;
+            mavlink_finalize_message(&msg, 1, 1, 9, 9, 50);
+            uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+            bytes.append((char *)buf, mavlink_msg_to_send_buffer(buf, &msg));
+        }
+        ASSERT_EQ(write(fds[1], bytes.data(), bytes.size()),
+            (ssize_t)bytes.size());
+    }
+
+    /* pop until `n` frames came or nothing did for a while */
+    std::vector<uint32_t> receive(uint32_t n)
+    {
+        std::vector<uint32_t> got;
+        int idle = 0;
+        while (got.size() < n && idle < 100)
+        {
+            mavlink_message_t msgs[MAX_LWM_BATCH];
+            size_t k = 0;
+            lwm_io_thread_pop(io, msgs, MAX_LWM_BATCH, &k, LWM_IO_WAIT_US);
+            idle = k == 0 ? idle + 1 : 0;
+            for (size_t i = 0; i < k; i++)
+            {
+                uint32_t seq;
+                memcpy(&seq, _MAV_PAYLOAD(&msgs[i]), sizeof(seq));
+                got.push_back(seq);
+            }
+        }
+        return got;
+    }
+
+    struct lwm_io_stats_t stats()
+    {
+        struct lwm_io_stats_t s;
+        lwm_io_thread_stats(io, &s);
+        return s;
+    }
+
+    int fds[2];
+    struct lwm_vehicle_t * vehicle;
+    struct lwm_io_thread_t * io;
+};
+
+TEST_F(IoThreadTest, ring_wraps_in_order)
+{
+    const uint32_t burst = 64;
+    const uint32_t total = 4 * LWM_FRAME_RING_SIZE;
+    std::vector<uint32_t> got;
+    for (uint32_t first = 0; first < total; first += burst)
+    {
+        send(first, burst);
+        std::vector<uint32_t> part = receive(burst);
+        got.insert(got.end(), part.begin(), part.end());
+    }
+
+    ASSERT_EQ(got.size(), total);
+    for (uint32_t i = 0; i < total; i++)
+    {
+        ASSERT_EQ(got[i], i);
+    }
+    ASSERT_EQ(stats().overflow, 0u);
+    ASSERT_EQ(stats().frames, total);
+}
+
+TEST_F(IoThreadTest, full_ring_counts_overflow)
+{
+    const uint32_t extra = 100;
+    send(0, LWM_FRAME_RING_SIZE + extra);
+    for (int i = 0; i < 1000 && stats().frames < LWM_FRAME_RING_SIZE + extra;
+         i++)
+    {
+        usleep(1000);
+    }
+
+    struct lwm_io_stats_t s = stats();
+    ASSERT_EQ(s.frames, LWM_FRAME_RING_SIZE + extra);
+    ASSERT_EQ(s.overflow, extra);
+    ASSERT_EQ(s.occupancy, LWM_FRAME_RING_SIZE);
+    ASSERT_EQ(s.high_water, LWM_FRAME_RING_SIZE);
+
+    /* the oldest frames are kept, the ones past a full ring are lost */
+    std::vector<uint32_t> got = receive(LWM_FRAME_RING_SIZE);
+    ASSERT_EQ(got.size(), LWM_FRAME_RING_SIZE);
+    for (uint32_t i = 0; i < LWM_FRAME_RING_SIZE; i++)
+    {
+        ASSERT_EQ(got[i], i);
+    }
+
+    /* and it fills again once drained */
+    send(1000, 10);
+    got = receive(10);
+    ASSERT_EQ(got.size(), 10u);
+    ASSERT_EQ(got.front(), 1000u);
+    ASSERT_EQ(stats().overflow, extra);
+}
+
+TEST_F(IoThreadTest, latency_counts_from_the_read)
+{
+    struct lwm_latency_t latency;
+    lwm_vehicle_set_latency(vehicle, &latency);
+    send(0, 4);
+    for (int i = 0; i < 1000 && stats().frames < 4; i++)
+    {
+        usleep(1000);
+    }
+
+    /* the frames wait on the ring, that wait is part of their latency */
+    usleep(20000);
+    ASSERT_EQ(lwm_vehicle_spin_once(vehicle), LWM_OK);
+    ASSERT_EQ(latency.loops, 1u);
+    ASSERT_GE(latency.max_us, 20000u);
+    lwm_vehicle_set_latency(vehicle, NULL);
+}
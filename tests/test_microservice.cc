@@ -0,0 +1,432 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <ctype.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+static void count(void * context, mavlink_message_t * msg)
+{
+    (void)msg;
+    (*(int *)context)++;
+}
+
+class MicroserviceTest : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        vehicle = new lwm_vehicle_t();
+        lwm_microservice_init(vehicle);
+    }
+
+    void TearDown() override
+    {
+        lwm_microservice_fini(vehicle);
+        delete vehicle;
+    }
+
+    struct lwm_microservice_t * counter(int * hits)
+    {
+        struct lwm_microservice_t * service = lwm_microservice_create(vehicle);
+        service->handler = count;
+        service->context = hits;
+        return service;
+    }
+
+    void dispatch(uint32_t msgid, uint8_t sysid = 1, uint8_t compid = 1)
+    {
+        mavlink_message_t msg = {};
+        msg.msgid = msgid;
+        msg.sysid = sysid;
+        msg.compid = compid;
+        lwm_microservice_process(vehicle, &msg);
+    }
+
+    struct lwm_vehicle_t * vehicle;
+};
+
+TEST_F(MicroserviceTest, add_twice_delivers_once)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    dispatch(30);
+    ASSERT_EQ(hits, 1);
+
+    /* still a duplicate once the first one is active */
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    dispatch(30);
+    ASSERT_EQ(hits, 2);
+}
+
+TEST_F(MicroserviceTest, add_after_remove_delivers_again)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 31, service), LWM_OK);
+    ASSERT_EQ(lwm_microservice_remove_from(vehicle, 30, service), LWM_OK);
+    dispatch(30);
+    ASSERT_EQ(hits, 0);
+
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    dispatch(30);
+    dispatch(31);
+    ASSERT_EQ(hits, 2);
+}
+
+TEST_F(MicroserviceTest, same_msgid_other_service)
+{
+    int a = 0, b = 0;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, counter(&a)), LWM_OK);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, counter(&b)), LWM_OK);
+    dispatch(30);
+    ASSERT_EQ(a, 1);
+    ASSERT_EQ(b, 1);
+}
+
+TEST_F(MicroserviceTest, many_msgids_one_service)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    std::vector<uint32_t> msgids;
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        msgids.push_back(i * 37 + (i % 3) * 65536);
+    }
+    for (uint32_t msgid : msgids)
+    {
+        ASSERT_EQ(lwm_microservice_add_to(vehicle, msgid, service), LWM_OK);
+    }
+    for (uint32_t msgid : msgids)
+    {
+        dispatch(msgid);
+    }
+    ASSERT_EQ(hits, 100);
+
+    lwm_microservice_destroy(vehicle, service);
+    for (uint32_t msgid : msgids)
+    {
+        dispatch(msgid);
+    }
+    ASSERT_EQ(hits, 100);
+}
+
+static void deliver_skipped(void * context, struct lwm_delivery_t * delivery)
+{
+    ((std::vector<uint32_t> *)context)->push_back(delivery->skipped);
+}
+
+TEST_F(MicroserviceTest, decimation)
+{
+    std::vector<uint32_t> skipped;
+    struct lwm_microservice_t * service = lwm_microservice_create(vehicle);
+    service->deliver = deliver_skipped;
+    service->context = &skipped;
+    service->decimation = 5;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 1, service), LWM_OK);
+
+    int hits = 0;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 1, counter(&hits)), LWM_OK);
+
+    for (int i = 0; i < 100; i++)
+    {
+        dispatch(1);
+    }
+    /* every fifth, reporting the four held back in between */
+    ASSERT_EQ(skipped.size(), 20u);
+    for (uint32_t n : skipped)
+    {
+        ASSERT_EQ(n, 4u);
+    }
+    ASSERT_EQ(hits, 100);
+}
+
+TEST_F(MicroserviceTest, interval)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    service->interval_us = 100000;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 1, service), LWM_OK);
+
+    for (int i = 0; i < 50; i++)
+    {
+        dispatch(1);
+    }
+    ASSERT_EQ(hits, 1);
+
+    usleep(110000);
+    for (int i = 0; i < 50; i++)
+    {
+        dispatch(1);
+    }
+    ASSERT_EQ(hits, 2);
+}
+
+class ChangeTest : public MicroserviceTest
+{
+public:
+    void send(uint32_t msgid, uint8_t sysid, uint32_t value, uint8_t len = 8)
+    {
+        mavlink_message_t msg = {};
+        msg.msgid = msgid;
+        msg.sysid = sysid;
+        msg.compid = 1;
+        msg.len = len;
+        memcpy(msg.payload64, &value, sizeof(value));
+        lwm_microservice_process(vehicle, &msg);
+    }
+};
+
+TEST_F(ChangeTest, repeated_payload_skipped)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    service->on_change = true;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 1, service), LWM_OK);
+
+    send(1, 1, 100);
+    send(1, 1, 100);
+    ASSERT_EQ(hits, 1);
+    send(1, 1, 101);
+    ASSERT_EQ(hits, 2);
+    /* the zeros MAVLink 2 trims off the end do not count */
+    send(1, 1, 101, 4);
+    ASSERT_EQ(hits, 2);
+}
+
+TEST_F(ChangeTest, per_sender)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    service->on_change = true;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 1, service), LWM_OK);
+
+    /* as many senders as slots, none evicts another */
+    for (int round = 0; round < 2; round++)
+    {
+        for (uint8_t sysid = 1; sysid <= MAX_LWM_CHANGE_SOURCE; sysid++)
+        {
+            send(1, sysid, 7);
+        }
+    }
+    ASSERT_EQ(hits, MAX_LWM_CHANGE_SOURCE);
+}
+
+TEST_F(ChangeTest, filter_keyed_by_msgid)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    service->on_change = true;
+    struct lwm_filter_t filter;
+    lwm_filter_init(&filter);
+    lwm_filter_msgid(&filter, 1);
+    lwm_filter_msgid(&filter, 2);
+    ASSERT_EQ(lwm_microservice_add_filter(vehicle, &filter, 0, service),
+        LWM_OK);
+
+    /* alternating msgids of one sender, each compared with its own */
+    for (int i = 0; i < 4; i++)
+    {
+        send(1, 1, 5);
+        send(2, 1, 6);
+    }
+    ASSERT_EQ(hits, 2);
+}
+
+TEST_F(ChangeTest, mask_per_msgid)
+{
+    static const uint8_t ignore_first[4] = { 0x00, 0xff, 0xff, 0xff };
+    static const struct lwm_change_mask_t masks[] = {
+        { 2, ignore_first, sizeof(ignore_first) },
+    };
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    service->on_change = true;
+    service->change_masks = masks;
+    service->n_change_masks = 1;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 1, service), LWM_OK);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 2, service), LWM_OK);
+
+    /* only the first byte changes: masked for 2, compared for 1 */
+    send(1, 1, 0x100);
+    send(1, 1, 0x101);
+    ASSERT_EQ(hits, 2);
+    send(2, 1, 0x100);
+    send(2, 1, 0x101);
+    ASSERT_EQ(hits, 3);
+}
+
+TEST_F(ChangeTest, change_slots_returned)
+{
+    int hits = 0;
+    struct lwm_microservice_t * service = counter(&hits);
+    service->on_change = true;
+    for (int round = 0; round < 2; round++)
+    {
+        for (uint32_t msgid = 0; msgid < MAX_LWM_CHANGE; msgid++)
+        {
+            ASSERT_EQ(lwm_microservice_add_to(vehicle, msgid, service),
+                LWM_OK);
+        }
+        for (uint32_t msgid = 0; msgid < MAX_LWM_CHANGE; msgid++)
+        {
+            lwm_microservice_remove_from(vehicle, msgid, service);
+        }
+    }
+}
+
+struct Tagged
+{
+    std::vector<char> * order;
+    char tag;
+};
+
+static void record_tag(void * context, mavlink_message_t * msg)
+{
+    (void)msg;
+    Tagged * tagged = (Tagged *)context;
+    tagged->order->push_back(tagged->tag);
+}
+
+TEST_F(MicroserviceTest, filters_run_among_exact_by_priority)
+{
+    struct lwm_filter_t filter;
+    lwm_filter_init(&filter);
+    lwm_filter_any(&filter);
+
+    std::vector<char> order;
+    Tagged tagged[] = { { &order, 'a' }, { &order, 'B' }, { &order, 'c' },
+        { &order, 'D' }, { &order, 'E' } };
+    /* lower case exact, upper case filtered */
+    const uint8_t priority[] = { LWM_PRIORITY_NORMAL, LWM_PRIORITY_HIGH,
+        LWM_PRIORITY_LOW, LWM_PRIORITY_NORMAL, LWM_PRIORITY_CRITICAL };
+    for (int i = 0; i < 5; i++)
+    {
+        struct lwm_microservice_t * service = lwm_microservice_create(vehicle);
+        service->handler = record_tag;
+        service->context = &tagged[i];
+        service->priority = priority[i];
+        if (islower(tagged[i].tag))
+        {
+            ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+        }
+        else
+        {
+            ASSERT_EQ(lwm_microservice_add_filter(vehicle, &filter, 0,
+                          service),
+                LWM_OK);
+        }
+    }
+    dispatch(30);
+    ASSERT_EQ(order, std::vector<char>({ 'E', 'B', 'a', 'D', 'c' }));
+
+    /* a msgid no exact one asked for */
+    order.clear();
+    dispatch(31);
+    ASSERT_EQ(order, std::vector<char>({ 'E', 'B', 'D' }));
+}
+
+static void record_seq(void * context, mavlink_message_t * msg)
+{
+    ((std::vector<uint8_t> *)context)->push_back(msg->seq);
+}
+
+TEST_F(MicroserviceTest, batch_runs_in_given_order)
+{
+    std::vector<uint8_t> seen;
+    struct lwm_microservice_t * service = lwm_microservice_create(vehicle);
+    service->handler = record_seq;
+    service->context = &seen;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, service), LWM_OK);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 33, service), LWM_OK);
+
+    /* arrived as 33, 30, 33, 30, 0; grouped by msgid, stable inside */
+    mavlink_message_t msgs[5] = {};
+    const uint32_t msgids[5] = { 33, 30, 33, 30, 0 };
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        msgs[i].msgid = msgids[i];
+        msgs[i].seq = i;
+    }
+    const uint8_t order[5] = { 4, 1, 3, 0, 2 };
+    lwm_microservice_process_batch(vehicle, msgs, order, 5);
+    ASSERT_EQ(seen, std::vector<uint8_t>({ 1, 3, 0, 2 }));
+}
+
+struct SelfDestroy
+{
+    struct lwm_vehicle_t * vehicle;
+    struct lwm_microservice_t * service;
+    struct lwm_microservice_t * victim; /* removed as well, may be NULL */
+    int hits;
+};
+
+static void destroy_self(void * context, mavlink_message_t * msg)
+{
+    (void)msg;
+    SelfDestroy * self = (SelfDestroy *)context;
+    self->hits++;
+    lwm_microservice_destroy(self->vehicle, self->victim);
+    lwm_microservice_destroy(self->vehicle, self->service);
+    self->service = NULL;
+    self->victim = NULL;
+}
+
+TEST_F(MicroserviceTest, handler_destroys_its_filtered_service)
+{
+    struct lwm_filter_t filter;
+    lwm_filter_init(&filter);
+    lwm_filter_any(&filter);
+
+    SelfDestroy first = { vehicle, NULL, NULL, 0 };
+    SelfDestroy second = { vehicle, NULL, NULL, 0 };
+    for (SelfDestroy * self : { &first, &second })
+    {
+        self->service = lwm_microservice_create(vehicle);
+        self->service->handler = destroy_self;
+        self->service->context = self;
+        ASSERT_EQ(lwm_microservice_add_filter(vehicle, &filter, 0,
+                      self->service),
+            LWM_OK);
+    }
+    int hits = 0;
+    ASSERT_EQ(lwm_microservice_add_filter(vehicle, &filter, 0,
+                  counter(&hits)),
+        LWM_OK);
+
+    dispatch(30);
+    ASSERT_EQ(first.hits, 1);
+    ASSERT_EQ(second.hits, 1);
+    ASSERT_EQ(hits, 1);
+    dispatch(30);
+    ASSERT_EQ(first.hits, 1);
+    ASSERT_EQ(hits, 2);
+}
+
+TEST_F(MicroserviceTest, handler_destroys_the_next_service)
+{
+    int hits = 0;
+    SelfDestroy self = { vehicle, NULL, NULL, 0 };
+    self.service = lwm_microservice_create(vehicle);
+    self.service->handler = destroy_self;
+    self.service->context = &self;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, self.service), LWM_OK);
+    self.victim = counter(&hits);
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, self.victim), LWM_OK);
+    int after = 0;
+    ASSERT_EQ(lwm_microservice_add_to(vehicle, 30, counter(&after)), LWM_OK);
+
+    /* the removed one is skipped, the one behind it still runs */
+    dispatch(30);
+    ASSERT_EQ(self.hits, 1);
+    ASSERT_EQ(hits, 0);
+    ASSERT_EQ(after, 1);
+
+    struct lwm_microservice_stats_t stats;
+    lwm_microservice_stats(vehicle, &stats);
+    ASSERT_EQ(stats.subscriptions, 1u);
+}
@@ -0,0 +1,177 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/* a connection over a non-blocking pipe, only try_recv may read it */
+static ssize_t pipe_recv(struct lwm_conn_context_t * ctx, uint8_t * buf,
+    size_t len)
+{
+    (void)ctx;
+    (void)buf;
+    (void)len;
+    ADD_FAILURE() << "the blocking recv was called";
+    return -LWM_ERR_IO;
+}
+
+static ssize_t pipe_try_recv(struct lwm_conn_context_t * ctx, uint8_t * buf,
+    size_t len)
+{
+    ssize_t n = read(*(int *)ctx->opaque, buf, len);
+    if (n < 0 && errno == EAGAIN)
+    {
+        return 0;
+    }
+    return n > 0 ? n : -LWM_ERR_IO;
+}
+
+static enum lwm_error_t pipe_send(struct lwm_conn_context_t * ctx,
+    const uint8_t * buf, size_t len)
+{
+    (void)ctx;
+    (void)buf;
+    (void)len;
+    return LWM_OK;
+}
+
+static void record_msgid(void * context, mavlink_message_t * msg)
+{
+    ((std::vector<uint32_t> *)context)->push_back(msg->msgid);
+}
+
+static enum lwm_error_t run_nothing(struct lwm_action_t * action, void * data)
+{
+    (void)action;
+    (void)data;
+    return LWM_OK;
+}
+
+static void count_timeout(struct lwm_action_t * action,
+    struct lwm_action_param_t * param)
+{
+    (void)param;
+    (*(int *)action->data)++;
+}
+
+class ProcessTest : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        ASSERT_EQ(pipe(fds), 0);
+        ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+        vehicle = new lwm_vehicle_t();
+        lwm_vehicle_init(vehicle);
+        vehicle->conn.opaque = &fds[0];
+        vehicle->conn.recv = pipe_recv;
+        vehicle->conn.try_recv = pipe_try_recv;
+        vehicle->conn.send = pipe_send;
+        vehicle->conn.status = LWM_CONN_STATUS_OPEN;
+
+        struct lwm_microservice_t * service =
+            lwm_microservice_create(vehicle);
+        service->handler = record_msgid;
+        service->context = &seen;
+        lwm_microservice_add_to(vehicle, MAVLINK_MSG_ID_HEARTBEAT, service);
+        lwm_microservice_add_to(vehicle, MAVLINK_MSG_ID_ATTITUDE, service);
+    }
+
+    void TearDown() override
+    {
+        close(fds[0]);
+        close(fds[1]);
+        lwm_microservice_fini(vehicle);
+        delete vehicle;
+    }
+
+    /* heartbeats and attitudes in the given order, sent in one write */
+    void send(const std::vector<uint32_t> & msgids)
+    {
+        std::string bytes;
+        for (uint32_t msgid : msgids)
+        {
+            mavlink_message_t msg = {};
+            uint8_t * payload = (uint8_t *)_MAV_PAYLOAD_NON_CONST(&msg);
+            msg.msgid = msgid;
+            if (msgid == MAVLINK_MSG_ID_HEARTBEAT)
+            {
+                payload[8] = 3; /* mavlink_version, nothing gets trimmed */
+                mavlink_finalize_message(&msg, 1, 1, 9, 9, 50);
+            }
+            else
+            {
+                payload[27] = 1;
+                mavlink_finalize_message(&msg, 1, 1, 28, 28, 39);
+            }
+            uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+            bytes.append((char *)buf, mavlink_msg_to_send_buffer(buf, &msg));
+        }
+        ASSERT_EQ(write(fds[1], bytes.data(), bytes.size()),
+            (ssize_t)bytes.size());
+    }
+
+    int fds[2];
+    struct lwm_vehicle_t * vehicle;
+    std::vector<uint32_t> seen;
+};
+
+TEST_F(ProcessTest, nothing_ready_does_not_block)
+{
+    ASSERT_EQ(lwm_vehicle_process_input(vehicle), LWM_OK);
+    ASSERT_EQ(lwm_vehicle_process(vehicle, true), LWM_OK);
+    ASSERT_TRUE(seen.empty());
+}
+
+TEST_F(ProcessTest, arrival_order_by_default)
+{
+    const uint32_t hb = MAVLINK_MSG_ID_HEARTBEAT;
+    const uint32_t att = MAVLINK_MSG_ID_ATTITUDE;
+    send({ att, hb, att, hb });
+    ASSERT_EQ(lwm_vehicle_process_input(vehicle), LWM_OK);
+    ASSERT_EQ(seen, std::vector<uint32_t>({ att, hb, att, hb }));
+
+    /* the read is used up, the next call finds nothing */
+    ASSERT_EQ(lwm_vehicle_process_input(vehicle), LWM_OK);
+    ASSERT_EQ(seen.size(), 4u);
+}
+
+TEST_F(ProcessTest, grouped_by_msgid_on_request)
+{
+    const uint32_t hb = MAVLINK_MSG_ID_HEARTBEAT;
+    const uint32_t att = MAVLINK_MSG_ID_ATTITUDE;
+    lwm_vehicle_set_grouped(vehicle, true);
+    send({ att, hb, att, hb });
+    ASSERT_EQ(lwm_vehicle_process_input(vehicle), LWM_OK);
+    ASSERT_EQ(seen, std::vector<uint32_t>({ hb, hb, att, att }));
+}
+
+TEST_F(ProcessTest, spin_batch_expires_actions)
+{
+    /* an empty read returns instead of blocking */
+    vehicle->conn.recv = pipe_try_recv;
+    int timeouts = 0;
+    struct lwm_action_t action;
+    lwm_action_init(&action, vehicle, run_nothing);
+    action.data = &timeouts;
+    action.timeout = count_timeout;
+    action.then_msgid_list.msgid[0] = MAVLINK_MSG_ID_SYS_STATUS;
+    action.then_msgid_list.n = 1;
+    ASSERT_EQ(lwm_action_submit(&action, 1000), LWM_OK);
+    usleep(2000);
+
+    /* nothing to read */
+    ASSERT_EQ(lwm_vehicle_spin_batch(vehicle), LWM_OK);
+    ASSERT_EQ(timeouts, 1);
+    ASSERT_EQ(lwm_vehicle_next_deadline(vehicle), 0u);
+
+    /* a batch that does not complete it */
+    ASSERT_EQ(lwm_action_submit(&action, 1000), LWM_OK);
+    usleep(2000);
+    send({ MAVLINK_MSG_ID_HEARTBEAT });
+    ASSERT_EQ(lwm_vehicle_spin_batch(vehicle), LWM_OK);
+    ASSERT_EQ(seen.size(), 1u);
+    ASSERT_EQ(timeouts, 2);
+}
@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <string>
+
+static std::string sha256_hex(const std::string & data)
+{
+    struct lwm_sha256_t sha;
+    uint8_t digest[32];
+    lwm_sha256_init(&sha);
+    lwm_sha256_update(&sha, data.data(), data.size());
+    lwm_sha256_final(&sha, digest);
+
+    char hex[65];
+    for (int i = 0; i < 32; i++)
+    {
+        snprintf(&hex[2 * i], 3, "%02x", digest[i]);
+    }
+    return std::string(hex);
+}
+
+static const uint8_t key[LWM_SIGNING_KEY_LEN] = {
+    0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+    0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10,
+    0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+    0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20,
+};
+
+/* serialize and parse again, so the rx side sees exactly the wire bytes */
+static bool roundtrip(const mavlink_message_t * in, mavlink_message_t * out)
+{
+    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+    mavlink_status_t status;
+    uint16_t len = mavlink_msg_to_send_buffer(buf, in);
+    for (uint16_t i = 0; i < len; i++)
+    {
+        if (mavlink_parse_char(MAVLINK_COMM_1, buf[i], out, &status))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+class SigningTest : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        lwm_signing_init(&tx, 1, key, LWM_SIGNING_SIGN_OUTGOING);
+        lwm_signing_init(&rx, 0, key, 0);
+    }
+
+    void heartbeat(mavlink_message_t * msg)
+    {
+        mavlink_msg_heartbeat_pack(1, 1, msg, MAV_TYPE_QUADROTOR,
+            MAV_AUTOPILOT_ARDUPILOTMEGA, 0, 0, MAV_STATE_ACTIVE);
+    }
+
+    struct lwm_signing_t tx;
+    struct lwm_signing_t rx;
+};
+
+TEST(Sha256Test, known_vectors)
+{
+    for (bool generic : {true, false})
+    {
+        lwm_sha256_force_generic(generic);
+        ASSERT_EQ(sha256_hex(""),
+            "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        ASSERT_EQ(sha256_hex("abc"),
+            "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        ASSERT_EQ(sha256_hex(
+            "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+            "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+        ASSERT_EQ(sha256_hex(std::string(1000, 'a')),
+            "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+    }
+    lwm_sha256_force_generic(false);
+}
+
+TEST_F(SigningTest, sign_and_verify)
+{
+    mavlink_message_t msg, rx_msg;
+    heartbeat(&msg);
+    ASSERT_EQ(lwm_signing_sign(&tx, &msg), LWM_OK);
+    ASSERT_TRUE(roundtrip(&msg, &rx_msg));
+    ASSERT_TRUE(rx_msg.incompat_flags & MAVLINK_IFLAG_SIGNED);
+    ASSERT_EQ(lwm_signing_verify(&rx, &rx_msg), LWM_OK);
+}
+
+TEST_F(SigningTest, reject_replay)
+{
+    mavlink_message_t msg, rx_msg;
+    heartbeat(&msg);
+    lwm_signing_sign(&tx, &msg);
+    ASSERT_TRUE(roundtrip(&msg, &rx_msg));
+    ASSERT_EQ(lwm_signing_verify(&rx, &rx_msg), LWM_OK);
+    ASSERT_EQ(lwm_signing_verify(&rx, &rx_msg), LWM_ERR_BAD_MESSAGE);
+    ASSERT_EQ(rx.rx_rejected, 1u);
+}
+
+TEST_F(SigningTest, reject_wrong_key)
+{
+    uint8_t other[LWM_SIGNING_KEY_LEN] = {0};
+    lwm_signing_init(&rx, 0, other, 0);
+
+    mavlink_message_t msg, rx_msg;
+    heartbeat(&msg);
+    lwm_signing_sign(&tx, &msg);
+    ASSERT_TRUE(roundtrip(&msg, &rx_msg));
+    ASSERT_EQ(lwm_signing_verify(&rx, &rx_msg), LWM_ERR_BAD_MESSAGE);
+}
+
+TEST_F(SigningTest, unsigned_policy)
+{
+    mavlink_message_t msg, rx_msg;
+    heartbeat(&msg);
+    ASSERT_TRUE(roundtrip(&msg, &rx_msg));
+    ASSERT_EQ(lwm_signing_verify(&rx, &rx_msg), LWM_ERR_BAD_MESSAGE);
+
+    rx.flags |= LWM_SIGNING_ALLOW_UNSIGNED;
+    ASSERT_EQ(lwm_signing_verify(&rx, &rx_msg), LWM_OK);
+}
@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <atomic>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+#define PRODUCERS 4
+#define POSTS     10000
+
+struct posted_t
+{
+    struct lwm_action_t action;
+    uint32_t            producer;
+    uint32_t            seq;
+    std::vector<struct posted_t *> * ran;
+};
+
+class SubmitTest : public ::testing::Test
+{
+public:
+    void SetUp() override
+    {
+        vehicle = new lwm_vehicle_t();
+        lwm_vehicle_init(vehicle);
+    }
+
+    void TearDown() override
+    {
+        lwm_microservice_fini(vehicle);
+        delete vehicle;
+    }
+
+    static enum lwm_error_t run(struct lwm_action_t * action, void * data)
+    {
+        (void)action;
+        struct posted_t * posted = (struct posted_t *)data;
+        posted->ran->push_back(posted);
+        return LWM_OK;
+    }
+
+    void init(struct posted_t * posted, uint32_t producer, uint32_t seq)
+    {
+        lwm_action_init(&posted->action, vehicle, run);
+        posted->action.data = posted;
+        posted->producer = producer;
+        posted->seq = seq;
+        posted->ran = &ran;
+    }
+
+    struct lwm_vehicle_t * vehicle;
+    std::vector<struct posted_t *> ran;
+};
+
+TEST_F(SubmitTest, full_queue_rejects_then_wraps)
+{
+    std::vector<struct posted_t> posted(3 * LWM_SUBMIT_QUEUE_SIZE);
+    uint32_t next = 0;
+    for (int round = 0; round < 3; round++)
+    {
+        for (uint32_t i = 0; i < LWM_SUBMIT_QUEUE_SIZE; i++, next++)
+        {
+            init(&posted[next], 0, next);
+            struct lwm_action_t * action = &posted[next].action;
+            ASSERT_EQ(lwm_vehicle_post_action(vehicle, action, 0), LWM_OK);
+        }
+        struct posted_t extra;
+        init(&extra, 0, UINT32_MAX);
+        ASSERT_EQ(lwm_vehicle_post_action(vehicle, &extra.action, 0),
+            LWM_ERR_NO_MEM);
+        lwm_vehicle_drain_posted(vehicle);
+    }
+
+    ASSERT_EQ(ran.size(), posted.size());
+    for (uint32_t i = 0; i < ran.size(); i++)
+    {
+        ASSERT_EQ(ran[i]->seq, i);
+    }
+    ASSERT_EQ(vehicle->submitted.rejected, 3u);
+    ASSERT_EQ(vehicle->submitted.drained, posted.size());
+}
+
+TEST_F(SubmitTest, producers_keep_their_order)
+{
+    std::vector<struct posted_t> posted(PRODUCERS * POSTS);
+    for (uint32_t p = 0; p < PRODUCERS; p++)
+    {
+        for (uint32_t i = 0; i < POSTS; i++)
+        {
+            init(&posted[p * POSTS + i], p, i);
+        }
+    }
+
+    std::atomic<uint32_t> retries(0);
+    std::atomic<int> running(PRODUCERS);
+    std::vector<std::thread> producers;
+    for (uint32_t p = 0; p < PRODUCERS; p++)
+    {
+        producers.emplace_back([&, p]() {
+            for (uint32_t i = 0; i < POSTS; i++)
+            {
+                struct lwm_action_t * action = &posted[p * POSTS + i].action;
+                while (lwm_vehicle_post_action(vehicle, action, 0) != LWM_OK)
+                {
+                    retries++;
+                    sched_yield();
+                }
+            }
+            running--;
+        });
+    }
+    while (running > 0)
+    {
+        lwm_vehicle_drain_posted(vehicle);
+        sched_yield();
+    }
+    for (std::thread & producer : producers)
+    {
+        producer.join();
+    }
+    lwm_vehicle_drain_posted(vehicle);
+
+    ASSERT_EQ(ran.size(), posted.size());
+    int64_t last[PRODUCERS] = { -1, -1, -1, -1 };
+    for (struct posted_t * item : ran)
+    {
+        ASSERT_EQ((int64_t)item->seq, last[item->producer] + 1);
+        last[item->producer] = item->seq;
+    }
+    ASSERT_EQ(vehicle->submitted.rejected, retries.load());
+}
+
+TEST_F(SubmitTest, submitted_again_while_running)
+{
+    struct posted_t posted;
+    init(&posted, 0, 0);
+    posted.action.then_msgid_list.msgid[0] = MAVLINK_MSG_ID_HEARTBEAT;
+    posted.action.then_msgid_list.n = 1;
+    ASSERT_EQ(lwm_action_submit(&posted.action, 1000000), LWM_OK);
+    ASSERT_EQ(lwm_action_submit(&posted.action, 2000000), LWM_OK);
+
+    /* one service, linked once, with the new deadline */
+    struct lwm_microservice_stats_t stats;
+    lwm_microservice_stats(vehicle, &stats);
+    ASSERT_EQ(stats.services, 1u);
+    ASSERT_EQ(stats.subscriptions, 1u);
+    ASSERT_EQ(vehicle->actions, &posted.action);
+    ASSERT_EQ(posted.action.next, nullptr);
+    ASSERT_EQ(vehicle->action_deadline_us, posted.action.timeout_time);
+}
@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+#include "lwmavsdk.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+struct Peer
+{
+    struct lwm_vehicle_t vehicle; /* first, the server hands it back */
+    int got;
+};
+
+static void count(void * context, mavlink_message_t * msg)
+{
+    (void)msg;
+    __atomic_fetch_add(&((Peer *)context)->got, 1, __ATOMIC_RELAXED);
+}
+
+class UdpServerTest : public ::testing::Test
+{
+public:
+    static struct lwm_vehicle_t * accept(void * context, uint32_t shard,
+        uint32_t addr, uint16_t port)
+    {
+        (void)shard;
+        (void)addr;
+        UdpServerTest * test = (UdpServerTest *)context;
+        std::lock_guard<std::mutex> guard(test->lock);
+        test->accepted++;
+        if (ntohs(port) == test->refused_port)
+        {
+            return NULL;
+        }
+        Peer * peer = new Peer();
+        lwm_vehicle_init(&peer->vehicle);
+        struct lwm_microservice_t * service =
+            lwm_microservice_create(&peer->vehicle);
+        service->handler = count;
+        service->context = peer;
+        lwm_microservice_add_to(
+            &peer->vehicle, MAVLINK_MSG_ID_HEARTBEAT, service);
+        test->peers.push_back(peer);
+        return &peer->vehicle;
+    }
+
+    static void release(void * context, struct lwm_vehicle_t * vehicle)
+    {
+        UdpServerTest * test = (UdpServerTest *)context;
+        std::lock_guard<std::mutex> guard(test->lock);
+        test->released++;
+        lwm_microservice_fini(vehicle);
+        Peer * peer = (Peer *)vehicle;
+        test->peers.erase(
+            std::find(test->peers.begin(), test->peers.end(), peer));
+        test->got += peer->got;
+        delete peer;
+    }
+
+    void start(uint32_t shards)
+    {
+        ASSERT_EQ(lwm_udp_server_start(&server, 0, shards, accept, release,
+                      this),
+            LWM_OK);
+    }
+
+    void TearDown() override
+    {
+        lwm_udp_server_stop(&server);
+        for (int fd : fds)
+        {
+            close(fd);
+        }
+    }
+
+    /* a client socket on its own port */
+    int client()
+    {
+        struct sockaddr_in to = {};
+        to.sin_family = AF_INET;
+        to.sin_port = htons(server.port);
+        to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        EXPECT_EQ(connect(fd, (struct sockaddr *)&to, sizeof(to)), 0);
+        fds.push_back(fd);
+        return fd;
+    }
+
+    uint16_t port_of(int fd)
+    {
+        struct sockaddr_in me = {};
+        socklen_t len = sizeof(me);
+        getsockname(fd, (struct sockaddr *)&me, &len);
+        return ntohs(me.sin_port);
+    }
+
+    /* `n` heartbeats in one datagram */
+    void send(int fd, uint32_t n)
+    {
+        std::string bytes;
+        for (uint32_t i = 0; i < n; i++)
+        {
+            mavlink_message_t msg = {};
+            uint8_t * payload = (uint8_t *)_MAV_PAYLOAD_NON_CONST(&msg);
+            payload[8] = 3; /* mavlink_version, nothing gets trimmed */
+            msg.msgid = MAVLINK_MSG_ID_HEARTBEAT;
+            mavlink_finalize_message(&msg, 1, 1, 9, 9, 50);
+            uint8_t buf[MAVLINK_MAX_PACKET_LEN];
+            bytes.append((char *)buf, mavlink_msg_to_send_buffer(buf, &msg));
+        }
+        ASSERT_EQ(::send(fd, bytes.data(), bytes.size(), 0),
+            (ssize_t)bytes.size());
+    }
+
+    /* wait for the shards to have taken `datagrams` off their sockets */
+    struct lwm_udp_server_stats_t settle(uint64_t datagrams)
+    {
+        struct lwm_udp_server_stats_t stats;
+        for (int i = 0; i < 1000; i++)
+        {
+            lwm_udp_server_stats(&server, &stats);
+            if (stats.datagrams >= datagrams)
+            {
+                break;
+            }
+            usleep(1000);
+        }
+        return stats;
+    }
+
+    /* wait for the sweep to have expired every peer */
+    struct lwm_udp_server_stats_t expire()
+    {
+        struct lwm_udp_server_stats_t stats;
+        for (int i = 0; i < 1000; i++)
+        {
+            lwm_udp_server_stats(&server, &stats);
+            if (stats.peers == 0 && stats.refused == 0)
+            {
+                break;
+            }
+            usleep(1000);
+        }
+        return stats;
+    }
+
+    void refuse(uint16_t port)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        refused_port = port;
+    }
+
+    /* the counters move on the shard threads */
+    int counted(const int & counter)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return counter;
+    }
+
+    int total_got()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        int n = got;
+        for (Peer * peer : peers)
+        {
+            n += __atomic_load_n(&peer->got, __ATOMIC_RELAXED);
+        }
+        return n;
+    }
+
+    struct lwm_udp_server_t server;
+    std::vector<int> fds;
+    std::mutex lock;
+    std::vector<Peer *> peers;
+    uint16_t refused_port = 0;
+    int accepted = 0;
+    int released = 0;
+    int got = 0; /* by released peers */
+};
+
+TEST_F(UdpServerTest, accepts_peers_and_drops_refused)
+{
+    start(2);
+    std::vector<int> clients;
+    for (int i = 0; i < 4; i++)
+    {
+        clients.push_back(client());
+        send(clients.back(), 1);
+    }
+    settle(4);
+    int other = client();
+    refuse(port_of(other));
+    send(other, 1);
+    settle(5);
+
+    /* the refused port is remembered, accept is not asked again */
+    for (int round = 0; round < 5; round++)
+    {
+        send(clients[0], 3);
+        send(other, 3);
+    }
+    struct lwm_udp_server_stats_t stats = settle(15);
+    ASSERT_EQ(stats.datagrams, 15u);
+    ASSERT_EQ(stats.peers, 4u);
+    ASSERT_EQ(stats.refused, 1u);
+    ASSERT_EQ(stats.dropped, 6u);
+    ASSERT_EQ(counted(accepted), 5);
+    ASSERT_EQ(total_got(), 4 + 15);
+}
+
+TEST_F(UdpServerTest, idle_peers_are_released)
+{
+    start(2);
+    int fd = client();
+    send(fd, 2);
+    ASSERT_EQ(settle(1).peers, 1u);
+
+    lwm_udp_server_set_idle(&server, 20000);
+    struct lwm_udp_server_stats_t stats = expire();
+    ASSERT_EQ(stats.peers, 0u);
+    ASSERT_EQ(counted(released), 1);
+    ASSERT_EQ(total_got(), 2);
+
+    /* coming back, it is a new peer */
+    lwm_udp_server_set_idle(&server, LWM_UDP_PEER_IDLE_US);
+    send(fd, 1);
+    ASSERT_EQ(settle(2).peers, 1u);
+    ASSERT_EQ(counted(accepted), 2);
+}
+
+TEST_F(UdpServerTest, full_table_takes_peers_after_expiry)
+{
+    start(1);
+    for (uint32_t i = 0; i < MAX_LWM_UDP_PEER; i++)
+    {
+        send(client(), 1);
+    }
+    ASSERT_EQ(settle(MAX_LWM_UDP_PEER).peers, MAX_LWM_UDP_PEER);
+
+    int late = client();
+    send(late, 1);
+    struct lwm_udp_server_stats_t stats = settle(MAX_LWM_UDP_PEER + 1);
+    ASSERT_EQ(stats.peers, MAX_LWM_UDP_PEER);
+    ASSERT_EQ(stats.dropped, 1u);
+
+    lwm_udp_server_set_idle(&server, 20000);
+    ASSERT_EQ(expire().peers, 0u);
+    ASSERT_EQ(counted(released), (int)MAX_LWM_UDP_PEER);
+
+    lwm_udp_server_set_idle(&server, LWM_UDP_PEER_IDLE_US);
+    send(late, 1);
+    ASSERT_EQ(settle(MAX_LWM_UDP_PEER + 2).peers, 1u);
+}